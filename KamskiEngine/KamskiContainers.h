@@ -2,13 +2,45 @@
 #include "KamskiEngine.h"
 #include <cstring>
 #include <utility>
+#include <initializer_list>
 #include <queue>
+#include <type_traits>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
 
 #ifndef KAMSKI_MAX_ENTITY_COUNT
 #define KAMSKI_MAX_ENTITY_COUNT 10000
 #endif
 
-//TODO (phillip): replace templates with code generator
+// Index of the lowest set bit, [bits] must not be 0
+inline u32 countTrailingZeros(u64 bits)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    return (u32)__builtin_ctzll(bits);
+#elif defined(_MSC_VER)
+    unsigned long index;
+    _BitScanForward64(&index, bits);
+    return (u32)index;
+#else
+    u32 count = 0;
+    while (!(bits & 1))
+    {
+        bits >>= 1;
+        count++;
+    }
+    return count;
+#endif
+}
+
+// ComponentList below is the template fallback. Games should register their components through
+// KamskiEngine/tools/KamskiRegistryGenerator, which emits a flat ComponentRegistry with the same interface.
+
+template<typename ... T>
+struct ComponentTypeList
+{
+};
 
 class IDStack
 {
@@ -211,8 +243,142 @@ class ComponentVector
         return denseSize;
     }
 
+    // Position of the entity's component in the dense array
+    u32 denseIndex(const Entity eId) const
+    {
+        assert(hasComponent(eId));
+        return sparse[eId];
+    }
+
+    // Swaps two dense entries and fixes up their sparse indices
+    void swapEntries(const u32 a, const u32 b)
+    {
+        assert(a < denseSize && b < denseSize);
+        const Entity entityA = dense[a];
+        const Entity entityB = dense[b];
+
+        dense[a] = entityB;
+        dense[b] = entityA;
+        sparse[entityA] = b;
+        sparse[entityB] = a;
+
+        const Component aux = compArray[a];
+        compArray[a] = compArray[b];
+        compArray[b] = aux;
+    }
+
+    // Incremental insertion sort of the dense array by key(component, entity), ascending.
+    // Does at most `budget` compares and resumes where it stopped on the next call, so it can be
+    // spread over frames. Adds and removes in between are fine, they only delay convergence.
+    // Cost grows with how far entries are out of place, so it suits keys that drift slowly (positions).
+    // At 512 compares a frame and 10000 entities, confirming a sorted array takes ~20 frames, and an entity
+    // that jumps to a random place costs about a third of the array, ~7 frames. 1% of them teleporting is
+    // ~650 frames (11 s at 60 FPS) before the array is sorted again, see ContainersBench.
+    // onSwap(a, b) runs after every swap. Returns true once a full pass found the array sorted.
+    template<typename KeyFunc, typename SwapFunc>
+    bool sortStep(KeyFunc&& key, u32 budget, SwapFunc&& onSwap)
+    {
+        if (denseSize < 2)
+        {
+            sortCursor = 0;
+            return true;
+        }
+
+        if (sortCursor == 0 || sortCursor >= denseSize || sortPosition > sortCursor)
+        {
+            sortCursor = 1;
+            sortPosition = 1;
+            sortSwapped = false;
+        }
+
+        while (budget--)
+        {
+            if (sortPosition != 0 &&
+                key(compArray[sortPosition], dense[sortPosition]) < key(compArray[sortPosition - 1], dense[sortPosition - 1]))
+            {
+                swapEntries(sortPosition, sortPosition - 1);
+                onSwap(sortPosition, sortPosition - 1);
+                sortPosition--;
+                sortSwapped = true;
+                continue;
+            }
+
+            sortCursor++;
+            sortPosition = sortCursor;
+            if (sortCursor == denseSize)
+            {
+                const bool sorted = !sortSwapped;
+                sortCursor = 1;
+                sortPosition = 1;
+                sortSwapped = false;
+                return sorted;
+            }
+        }
+        return false;
+    }
+
+    template<typename KeyFunc>
+    bool sortStep(KeyFunc&& key, u32 budget)
+    {
+        return sortStep(key, budget, [](u32, u32) {});
+    }
+
+    // Incremental, linear reorder of the dense array to follow the dense order of [lead]
+    // (a ComponentVector or DoubleBufferedComponentVector). Entities the lead does not have end up last.
+    // Visits at most `budget` lead entries per call and resumes on the next one.
+    // Shares its cursor with sortStep, so use one ordering per component.
+    template<typename Lead, typename SwapFunc>
+    bool sortLikeStep(const Lead& lead, u32 budget, SwapFunc&& onSwap)
+    {
+        const Entity* leadEntities = lead.iterateEntities().begin();
+        const u32 leadSize = (u32)lead.size();
+
+        if (sortCursor > leadSize || sortPosition > denseSize || sortPosition > sortCursor)
+        {
+            sortCursor = 0;
+            sortPosition = 0;
+            sortSwapped = false;
+        }
+
+        while (budget--)
+        {
+            if (sortCursor == leadSize || sortPosition == denseSize)
+            {
+                const bool sorted = !sortSwapped;
+                sortCursor = 0;
+                sortPosition = 0;
+                sortSwapped = false;
+                return sorted;
+            }
+
+            const Entity eId = leadEntities[sortCursor++];
+            if (hasComponent(eId))
+            {
+                // Everything before sortPosition is already placed, so the entity sits at or after it
+                if (sparse[eId] != sortPosition)
+                {
+                    const u32 from = sparse[eId];
+                    swapEntries(from, sortPosition);
+                    onSwap(from, sortPosition);
+                    sortSwapped = true;
+                }
+                sortPosition++;
+            }
+        }
+        return false;
+    }
+
+    template<typename Lead>
+    bool sortLikeStep(const Lead& lead, u32 budget)
+    {
+        return sortLikeStep(lead, budget, [](u32, u32) {});
+    }
+
     private:
 
+    template<typename>
+    friend class DoubleBufferedComponentVector;
+
     static constexpr u32 sparseSize = KAMSKI_MAX_ENTITY_COUNT;
     static constexpr u32 denseCapacity = KAMSKI_MAX_ENTITY_COUNT;
 
@@ -221,8 +387,267 @@ class ComponentVector
     Component compArray[denseCapacity];
 
     u32 denseSize;
+
+    u32 sortCursor;
+    u32 sortPosition;
+    bool sortSwapped;
+};
+
+// Components opted in with KAMSKI_DOUBLE_BUFFERED keep two ComponentVectors: update writes one
+// while render reads the other, which holds the state from the last swapBuffers().
+// The macro has to appear after the component definition and before the registry is instantiated.
+template<typename Component>
+inline constexpr bool isDoubleBuffered = false;
+
+#define KAMSKI_DOUBLE_BUFFERED(Component) template<> inline constexpr bool isDoubleBuffered<Component> = true
+
+#ifndef KAMSKI_COMPONENT_PAGE_SIZE
+#define KAMSKI_COMPONENT_PAGE_SIZE 128
+#endif
+
+template<typename Component>
+class DoubleBufferedComponentVector
+{
+    static_assert(std::is_trivially_copyable_v<Component>, "Double buffered components are copied page by page");
+
+public:
+
+    void clear()
+    {
+        writeBuffer().clear();
+    }
+
+    template<typename ... Args>
+    Component& addComponent(const Entity eId, Args&& ... args)
+    {
+        ComponentVector<Component>& vec = writeBuffer();
+        markDense(vec.denseSize);
+        markSparse(eId);
+        return vec.addComponent(eId, std::forward<Args>(args)...);
+    }
+
+    [[nodiscard]]
+    bool hasComponent(const Entity eId) const
+    {
+        return writeBuffer().hasComponent(eId);
+    }
+
+    void removeComponent(Entity eId)
+    {
+        ComponentVector<Component>& vec = writeBuffer();
+        if (!vec.hasComponent(eId))
+        {
+            return;
+        }
+
+        markDense(vec.sparse[eId]);
+        markSparse(vec.dense[vec.denseSize - 1]);
+        vec.removeComponent(eId);
+    }
+
+    // Crashes if entity[eId] doesn't have this Component
+    Component& getComponent(const Entity eId)
+    {
+        ComponentVector<Component>& vec = writeBuffer();
+        assert(vec.hasComponent(eId));
+        markDense(vec.sparse[eId]);
+        return vec.compArray[vec.sparse[eId]];
+    }
+
+    // Crashes if entity[eId] doesn't have this Component
+    const Component& getComponent(const Entity eId) const
+    {
+        return writeBuffer().getComponent(eId);
+    }
+
+    // Mutable iteration marks every live page as dirty
+    ComponentView<Component> iterateComponents()
+    {
+        ComponentVector<Component>& vec = writeBuffer();
+        for (u32 page = 0; page * pageSize < vec.denseSize; page++)
+        {
+            densePages[page / 64] |= (u64)1 << (page % 64);
+        }
+        return vec.iterateComponents();
+    }
+
+    const ComponentView<Component> iterateComponents() const
+    {
+        return writeBuffer().iterateComponents();
+    }
+
+    const EntityView iterateEntities() const
+    {
+        return writeBuffer().iterateEntities();
+    }
+
+    u64 size() const
+    {
+        return writeBuffer().size();
+    }
+
+    u32 denseIndex(const Entity eId) const
+    {
+        return writeBuffer().denseIndex(eId);
+    }
+
+    template<typename KeyFunc>
+    bool sortStep(KeyFunc&& key, u32 budget)
+    {
+        ComponentVector<Component>& vec = writeBuffer();
+        return vec.sortStep(key, budget, [this, &vec](u32 a, u32 b)
+                            {
+                                markSwap(vec, a, b);
+                            });
+    }
+
+    template<typename Lead>
+    bool sortLikeStep(const Lead& lead, u32 budget)
+    {
+        ComponentVector<Component>& vec = writeBuffer();
+        return vec.sortLikeStep(lead, budget, [this, &vec](u32 a, u32 b)
+                                {
+                                    markSwap(vec, a, b);
+                                });
+    }
+
+    // State as of the last swapBuffers(), safe to read while update writes the other buffer
+    const ComponentVector<Component>& renderView() const
+    {
+        return buffers[writeIndex ^ 1];
+    }
+
+    // Publishes the write buffer to render, then brings the stale buffer up to date
+    // by copying only the pages touched since the previous swap.
+    // Must not run while render is reading the render view.
+    void swapBuffers()
+    {
+        writeIndex ^= 1;
+        const ComponentVector<Component>& src = buffers[writeIndex ^ 1];
+        ComponentVector<Component>& dst = buffers[writeIndex];
+
+        for (u32 word = 0; word < densePageWords; word++)
+        {
+            u64 bits = densePages[word];
+            while (bits)
+            {
+                const u32 page = word * 64 + (u32)countTrailingZeros(bits);
+                const u32 first = page * pageSize;
+                const u32 count = glm::min(pageSize, denseCapacity - first);
+                memcpy(dst.dense + first, src.dense + first, count * sizeof(Entity));
+                memcpy(dst.compArray + first, src.compArray + first, count * sizeof(Component));
+                bits &= bits - 1;
+            }
+            densePages[word] = 0;
+        }
+
+        for (u32 word = 0; word < sparsePageWords; word++)
+        {
+            u64 bits = sparsePages[word];
+            while (bits)
+            {
+                const u32 page = word * 64 + (u32)countTrailingZeros(bits);
+                const u32 first = page * pageSize;
+                const u32 count = glm::min(pageSize, sparseSize - first);
+                memcpy(dst.sparse + first, src.sparse + first, count * sizeof(u32));
+                bits &= bits - 1;
+            }
+            sparsePages[word] = 0;
+        }
+
+        dst.denseSize = src.denseSize;
+    }
+
+private:
+
+    static constexpr u32 pageSize = KAMSKI_COMPONENT_PAGE_SIZE;
+    static constexpr u32 sparseSize = ComponentVector<Component>::sparseSize;
+    static constexpr u32 denseCapacity = ComponentVector<Component>::denseCapacity;
+    static constexpr u32 densePageWords = ((denseCapacity + pageSize - 1) / pageSize + 63) / 64;
+    static constexpr u32 sparsePageWords = ((sparseSize + pageSize - 1) / pageSize + 63) / 64;
+
+    ComponentVector<Component>& writeBuffer()
+    {
+        return buffers[writeIndex];
+    }
+
+    const ComponentVector<Component>& writeBuffer() const
+    {
+        return buffers[writeIndex];
+    }
+
+    void markDense(u32 index)
+    {
+        const u32 page = index / pageSize;
+        densePages[page / 64] |= (u64)1 << (page % 64);
+    }
+
+    void markSparse(Entity eId)
+    {
+        const u32 page = eId / pageSize;
+        sparsePages[page / 64] |= (u64)1 << (page % 64);
+    }
+
+    void markSwap(const ComponentVector<Component>& vec, u32 a, u32 b)
+    {
+        markDense(a);
+        markDense(b);
+        markSparse(vec.dense[a]);
+        markSparse(vec.dense[b]);
+    }
+
+    ComponentVector<Component> buffers[2];
+    u64 densePages[densePageWords];
+    u64 sparsePages[sparsePageWords];
+    u32 writeIndex;
 };
 
+template<typename Component>
+using ComponentStorage = std::conditional_t<isDoubleBuffered<Component>, DoubleBufferedComponentVector<Component>, ComponentVector<Component>>;
+
+template<typename Component>
+void swapComponentBuffers(ComponentVector<Component>&)
+{
+}
+
+template<typename Component>
+void swapComponentBuffers(DoubleBufferedComponentVector<Component>& storage)
+{
+    storage.swapBuffers();
+}
+
+template<typename Component>
+const ComponentVector<Component>& componentRenderView(const ComponentVector<Component>& storage)
+{
+    return storage;
+}
+
+template<typename Component>
+const ComponentVector<Component>& componentRenderView(const DoubleBufferedComponentVector<Component>& storage)
+{
+    return storage.renderView();
+}
+
+// Z-order key of a position snapped to cells of cellSize, for sortComponents.
+// Entities in the same or neighbouring cells end up close in the dense array.
+inline u64 mortonKey(const glm::vec2 position, const f32 cellSize)
+{
+    // Flipping the sign bit keeps negative cells ordered before positive ones
+    const u32 x = (u32)(i32)glm::floor(position.x / cellSize) ^ 0x80000000u;
+    const u32 y = (u32)(i32)glm::floor(position.y / cellSize) ^ 0x80000000u;
+
+    auto spread = [](u64 v)
+    {
+        v = (v | (v << 16)) & 0x0000FFFF0000FFFFull;
+        v = (v | (v << 8))  & 0x00FF00FF00FF00FFull;
+        v = (v | (v << 4))  & 0x0F0F0F0F0F0F0F0Full;
+        v = (v | (v << 2))  & 0x3333333333333333ull;
+        v = (v | (v << 1))  & 0x5555555555555555ull;
+        return v;
+    };
+    return spread(x) | (spread(y) << 1);
+}
+
 
 template<typename ... T>
 struct ComponentList;
@@ -237,6 +662,10 @@ struct ComponentList<>
     {
     }
 
+    void swapBuffers()
+    {
+    }
+
     template<typename Component>
     static constexpr u64 componentId()
     {
@@ -244,17 +673,17 @@ struct ComponentList<>
     }
 
     template<typename Component>
-    ComponentVector<Component>& getComponentVector()
+    ComponentStorage<Component>& getComponentVector()
     {
-        ComponentVector<Component> errVec = {};
+        ComponentStorage<Component> errVec = {};
         assert(false && "Component not in list");
         return errVec;
     }
 
     template<typename Component>
-    const ComponentVector<Component>& getComponentVector() const
+    const ComponentStorage<Component>& getComponentVector() const
     {
-        ComponentVector<Component> errVec = {};
+        ComponentStorage<Component> errVec = {};
         assert(false && "Component not in list");
         return errVec;
     }
@@ -288,9 +717,15 @@ struct ComponentList<FirstType, Types ...> : public ComponentList<Types ...>
         next::removeEntity(eId);
     }
 
+    void swapBuffers()
+    {
+        swapComponentBuffers(cvector);
+        using next = ComponentList<Types ...>;
+        next::swapBuffers();
+    }
 
     template<typename Component>
-    ComponentVector<Component>& getComponentVector()
+    ComponentStorage<Component>& getComponentVector()
     {
         if constexpr(std::is_same_v<Component, CurrentType>)
         {
@@ -304,7 +739,7 @@ struct ComponentList<FirstType, Types ...> : public ComponentList<Types ...>
     }
 
     template<typename Component>
-    const ComponentVector<Component>& getComponentVector() const
+    const ComponentStorage<Component>& getComponentVector() const
     {
         if constexpr(std::is_same_v<Component, CurrentType>)
         {
@@ -317,7 +752,7 @@ struct ComponentList<FirstType, Types ...> : public ComponentList<Types ...>
         }
     }
 
-    ComponentVector<FirstType> cvector;
+    ComponentStorage<FirstType> cvector;
 };
 
 template<typename _ComponentList>
@@ -429,34 +864,15 @@ struct TSignature
         return id / SIG_SIZE;
     }
 
-    template<typename ... Next>
-    struct get_sig_t;
-
-    template<>
-    struct get_sig_t<>
-    {
-        static constexpr sig_t<_ComponentList> _getSignature()
-        {
-            return {};
-        }
-    };
-
-    template<typename First, typename ... Next>
-    struct get_sig_t<First, Next ...>
+    static constexpr sig_t<_ComponentList> getSignature()
     {
-        static constexpr sig_t<_ComponentList> _getSignature()
+        sig_t<_ComponentList> retval = {};
+        for (const u64 cId : { _ComponentList::template componentId<FirstComponent>(),
+                               _ComponentList::template componentId<NextComponents>() ... })
         {
-            using next = get_sig_t<Next ...>;
-            sig_t<_ComponentList> retval = {};
-            constexpr u64 cId = _ComponentList::template componentId<First>();
             retval.bytes[componentIdToByte(cId)] |= componentIdToBit(cId);
-            return retval | next::_getSignature();
         }
-    };
-
-    static constexpr sig_t<_ComponentList> getSignature()
-    {
-        return get_sig_t<FirstComponent, NextComponents ...>::_getSignature();
+        return retval;
     }
 };
 
@@ -464,7 +880,7 @@ template<typename Sig, typename _ComponentList>
 class SignatureIterator
 {
     public:
-    using Signature = Signature<_ComponentList>;
+    using Signature = ::Signature<_ComponentList>;
 
     SignatureIterator(Signature* ptr, Signature* end):
         ptr(ptr),
@@ -521,7 +937,7 @@ template<typename Sig, typename _ComponentList>
 class ConstSignatureIterator
 {
     public:
-    using Signature = Signature<_ComponentList>;
+    using Signature = ::Signature<_ComponentList>;
 
     ConstSignatureIterator(const Signature* ptr, const Signature* end):
         ptr(ptr),
@@ -576,7 +992,7 @@ template<typename Sig, typename _ComponentList>
 class SignatureView
 {
 public:
-    using Signature = Signature<_ComponentList>;
+    using Signature = ::Signature<_ComponentList>;
 
     SignatureView(Signature* _begin, Signature* _end):
     _end(_end)
@@ -627,7 +1043,7 @@ template<typename _ComponentList>
 class EntityRegistry
 {
 public:
-    using Signature = Signature<_ComponentList>;
+    using Signature = ::Signature<_ComponentList>;
 
     EntityRegistry():
     nextEntity(0)
@@ -636,24 +1052,38 @@ public:
     }
 
     template<typename Component>
-    ComponentVector<Component>& getComponentVector()
+    ComponentStorage<Component>& getComponentVector()
     {
         return components.template getComponentVector<Component>();
     }
 
     template<typename Component>
-    const ComponentVector<Component>& getComponentVector() const
+    const ComponentStorage<Component>& getComponentVector() const
     {
         return components.template getComponentVector<Component>();
     }
 
+    // Read-only view for render code. For double buffered components this is the
+    // state of the last swapBuffers(), otherwise it is the live vector.
+    template<typename Component>
+    const ComponentVector<Component>& getRenderComponentVector() const
+    {
+        return componentRenderView(components.template getComponentVector<Component>());
+    }
+
+    // Call once per frame after update, while render is not reading
+    void swapBuffers()
+    {
+        components.swapBuffers();
+    }
+
     template<typename Component, typename ...  Args>
     Component& addComponent(Entity eId, Args&& ... args)
     {
         // Asserts maybe useless??
         assert(eId < nextEntity);
         assert(entityIndices[eId] < signatureCount);
-        ComponentVector<Component>& cVec = getComponentVector<Component>();
+        auto& cVec = getComponentVector<Component>();
         entitySignatures[entityIndices[eId]].template addComponent<Component>();
         return cVec.addComponent(eId, std::forward<Args>(args)...);
     }
@@ -661,14 +1091,14 @@ public:
     template<typename Component>
     Component& getComponent(Entity eId)
     {
-        ComponentVector<Component>& cVec = getComponentVector<Component>();
+        auto& cVec = getComponentVector<Component>();
         return cVec.getComponent(eId);
     }
 
     template<typename Component>
     const Component& getComponent(Entity eId) const
     {
-        const ComponentVector<Component>& cVec = getComponentVector<Component>();
+        const auto& cVec = getComponentVector<Component>();
         return cVec.getComponent(eId);
     }
 
@@ -683,16 +1113,30 @@ public:
     void removeComponent(Entity eId)
     {
         assert(eId < KAMSKI_MAX_ENTITY_COUNT);
-        ComponentVector<Component>& cVec = getComponentVector<Component>();
-        const u32 componentId = getComponentId<Component>();
-        entitySignatures[entityIndices[eId]].signature.template removeComponent<Component>();
+        auto& cVec = getComponentVector<Component>();
+        entitySignatures[entityIndices[eId]].template removeComponent<Component>();
         cVec.removeComponent(eId);
     }
 
+    // Budgeted step of reordering Component's dense array by key(component, entity), see ComponentVector::sortStep
+    template<typename Component, typename KeyFunc>
+    bool sortComponents(KeyFunc&& key, u32 budget)
+    {
+        return getComponentVector<Component>().sortStep(key, budget);
+    }
+
+    // Budgeted step of reordering Component's dense array to follow Lead's, so joined iteration
+    // walks both arrays forwards. Entities without a Lead go to the back. See ComponentVector::sortLikeStep
+    template<typename Component, typename Lead>
+    bool sortComponentsLike(u32 budget)
+    {
+        return getComponentVector<Component>().sortLikeStep(getComponentVector<Lead>(), budget);
+    }
+
     template<typename Component>
     void clear()
     {
-        ComponentVector<Component>& cVec = getComponentVector<Component>();
+        auto& cVec = getComponentVector<Component>();
         cVec.clear();
     }
 
@@ -760,14 +1204,14 @@ public:
     template<typename Component>
     ComponentView<Component> iterateComponents()
     {
-        ComponentVector<Component>& cvec = components.template getComponentVector<Component>();
+        auto& cvec = components.template getComponentVector<Component>();
         return cvec.iterateComponents();
     }
 
     template<typename Component>
     const ComponentView<Component> iterateComponents() const
     {
-        const ComponentVector<Component>& cvec = components.template getComponentVector<Component>();
+        const auto& cvec = components.template getComponentVector<Component>();
         return cvec.iterateComponents();
     }
 
@@ -797,3 +1241,458 @@ private:
     _ComponentList components;
     Entity nextEntity;
 };
+
+// ######## FlatHashMap ########
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define KAMSKI_HASH_SSE2 1
+#include <emmintrin.h>
+#endif
+
+inline u64 kamskiHash(u64 key)
+{
+    // murmur3 finalizer
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccdull;
+    key ^= key >> 33;
+    key *= 0xc4ceb9fe1a85ec53ull;
+    key ^= key >> 33;
+    return key;
+}
+
+template<typename Key>
+struct KamskiHasher
+{
+    u64 operator()(const Key& key) const
+    {
+        static_assert(std::is_integral_v<Key> || std::is_enum_v<Key> || std::is_pointer_v<Key>,
+                      "Supply a hasher for this key type");
+        return kamskiHash((u64)key);
+    }
+};
+
+// Open-addressing hash map, Swiss table style: one control byte per slot holds 7 bits of the hash
+// and slots are probed 16 at a time (SSE2 where available).
+// Storage comes from an Arena and is never freed individually: growing abandons the old table
+// in the arena, so size the initial capacity for the expected count. Keys and values must be trivially copyable.
+template<typename Key, typename Value, typename Hasher = KamskiHasher<Key>>
+class FlatHashMap
+{
+    static_assert(std::is_trivially_copyable_v<Key> && std::is_trivially_copyable_v<Value>,
+                  "FlatHashMap moves entries with plain copies");
+
+public:
+
+    FlatHashMap() = default;
+
+    // [capacity] is rounded up to a power of two with room for a 7/8 load factor
+    FlatHashMap(Arena* arena, u32 capacity):
+    arena(arena)
+    {
+        allocateTable(tableSizeFor(capacity));
+    }
+
+    Value* find(const Key& key)
+    {
+        const u64 hash = Hasher{}(key);
+        u32 index;
+        return findIndex(key, hash, index) ? &slots[index].value : nullptr;
+    }
+
+    const Value* find(const Key& key) const
+    {
+        return const_cast<FlatHashMap*>(this)->find(key);
+    }
+
+    bool contains(const Key& key) const
+    {
+        return find(key) != nullptr;
+    }
+
+    // Inserts or overwrites
+    Value& insert(const Key& key, const Value& value)
+    {
+        const u64 hash = Hasher{}(key);
+        u32 index;
+        if (findIndex(key, hash, index))
+        {
+            slots[index].value = value;
+            return slots[index].value;
+        }
+
+        if ((count + tombstones + 1) * 8 > capacity * 7)
+        {
+            // Mostly tombstones: rehash in place size, otherwise grow
+            rehash(capacity == 0 ? GROUP_SIZE : count * 2 + 2 > capacity ? capacity * 2 : capacity);
+        }
+
+        index = findInsertIndex(hash);
+        if (control[index] == DELETED)
+        {
+            tombstones--;
+        }
+        control[index] = h2(hash);
+        slots[index].key = key;
+        slots[index].value = value;
+        count++;
+        return slots[index].value;
+    }
+
+    bool remove(const Key& key)
+    {
+        const u64 hash = Hasher{}(key);
+        u32 index;
+        if (!findIndex(key, hash, index))
+        {
+            return false;
+        }
+        control[index] = DELETED;
+        tombstones++;
+        count--;
+        return true;
+    }
+
+    void clear()
+    {
+        memset(control, EMPTY, capacity);
+        count = 0;
+        tombstones = 0;
+    }
+
+    // func(const Key&, Value&) for every entry, in table order
+    template<typename Func>
+    void forEach(Func&& func)
+    {
+        for (u32 i = 0; i < capacity; i++)
+        {
+            if (isFull(control[i]))
+            {
+                func((const Key&)slots[i].key, slots[i].value);
+            }
+        }
+    }
+
+    u32 size() const
+    {
+        return count;
+    }
+
+    bool empty() const
+    {
+        return count == 0;
+    }
+
+private:
+
+    static constexpr u32 GROUP_SIZE = 16;
+    static constexpr u8 EMPTY = 0x80;
+    static constexpr u8 DELETED = 0xFE;
+
+    struct Slot
+    {
+        Key key;
+        Value value;
+    };
+
+    static bool isFull(u8 ctrl)
+    {
+        return (ctrl & 0x80) == 0;
+    }
+
+    static u8 h2(u64 hash)
+    {
+        return (u8)(hash & 0x7F);
+    }
+
+    static u32 tableSizeFor(u32 capacity)
+    {
+        u32 size = GROUP_SIZE;
+        while (size * 7 < capacity * 8)
+        {
+            size *= 2;
+        }
+        return size;
+    }
+
+    // Bit i set when control[group + i] == value
+    static u32 matchByte(const u8* group, u8 value)
+    {
+#ifdef KAMSKI_HASH_SSE2
+        const __m128i ctrl = _mm_loadu_si128((const __m128i*)group);
+        return (u32)_mm_movemask_epi8(_mm_cmpeq_epi8(ctrl, _mm_set1_epi8((char)value)));
+#else
+        u32 mask = 0;
+        for (u32 half = 0; half < 2; half++)
+        {
+            u64 word;
+            memcpy(&word, group + half * 8, 8);
+            // Zero bytes of word ^ pattern are the matches
+            const u64 x = word ^ (0x0101010101010101ull * value);
+            u64 zeros = (x - 0x0101010101010101ull) & ~x & 0x8080808080808080ull;
+            while (zeros)
+            {
+                const u32 byte = (u32)countTrailingZeros(zeros) / 8;
+                // The subtraction trick can flag a byte after a real match, confirm it
+                if (group[half * 8 + byte] == value)
+                {
+                    mask |= 1u << (half * 8 + byte);
+                }
+                zeros &= zeros - 1;
+            }
+        }
+        return mask;
+#endif
+    }
+
+    // Bit i set when control[group + i] is EMPTY or DELETED
+    static u32 matchFree(const u8* group)
+    {
+#ifdef KAMSKI_HASH_SSE2
+        const __m128i ctrl = _mm_loadu_si128((const __m128i*)group);
+        return (u32)_mm_movemask_epi8(ctrl);
+#else
+        u32 mask = 0;
+        for (u32 i = 0; i < GROUP_SIZE; i++)
+        {
+            mask |= (u32)(group[i] >> 7) << i;
+        }
+        return mask;
+#endif
+    }
+
+    bool findIndex(const Key& key, u64 hash, u32& index) const
+    {
+        if (!capacity)
+        {
+            return false;
+        }
+
+        const u32 groupMask = capacity / GROUP_SIZE - 1;
+        u32 group = (u32)(hash >> 7) & groupMask;
+        const u8 tag = h2(hash);
+
+        for (u32 probe = 0; probe <= groupMask; probe++)
+        {
+            const u8* groupControl = control + group * GROUP_SIZE;
+            u32 matches = matchByte(groupControl, tag);
+            while (matches)
+            {
+                const u32 candidate = group * GROUP_SIZE + countTrailingZeros(matches);
+                if (slots[candidate].key == key)
+                {
+                    index = candidate;
+                    return true;
+                }
+                matches &= matches - 1;
+            }
+            if (matchByte(groupControl, EMPTY))
+            {
+                return false;
+            }
+            // Triangular probing visits every group once for power of two group counts
+            group = (group + probe + 1) & groupMask;
+        }
+        return false;
+    }
+
+    u32 findInsertIndex(u64 hash) const
+    {
+        const u32 groupMask = capacity / GROUP_SIZE - 1;
+        u32 group = (u32)(hash >> 7) & groupMask;
+        for (u32 probe = 0; probe <= groupMask; probe++)
+        {
+            const u32 free = matchFree(control + group * GROUP_SIZE);
+            if (free)
+            {
+                return group * GROUP_SIZE + countTrailingZeros(free);
+            }
+            group = (group + probe + 1) & groupMask;
+        }
+        assert(false && "FlatHashMap is full");
+        return 0;
+    }
+
+    void allocateTable(u32 tableSize)
+    {
+        assert(arena);
+        control = (u8*)arena->alloc(tableSize, GROUP_SIZE);
+        slots = (Slot*)arena->alloc((u64)tableSize * sizeof(Slot), alignof(Slot));
+        assert(control && slots && "FlatHashMap arena is full");
+        capacity = tableSize;
+        count = 0;
+        tombstones = 0;
+        memset(control, EMPTY, capacity);
+    }
+
+    void rehash(u32 tableSize)
+    {
+        const u8* oldControl = control;
+        const Slot* oldSlots = slots;
+        const u32 oldCapacity = capacity;
+
+        allocateTable(tableSize);
+        for (u32 i = 0; i < oldCapacity; i++)
+        {
+            if (isFull(oldControl[i]))
+            {
+                const u64 hash = Hasher{}(oldSlots[i].key);
+                const u32 index = findInsertIndex(hash);
+                control[index] = h2(hash);
+                slots[index] = oldSlots[i];
+                count++;
+            }
+        }
+    }
+
+    Arena* arena = nullptr;
+    u8* control = nullptr;
+    Slot* slots = nullptr;
+    u32 capacity = 0;
+    u32 count = 0;
+    u32 tombstones = 0;
+};
+
+// ######## SmallVector ########
+
+// Vector with room for N elements inline that spills to memory from [allocFunc] when it grows past them.
+// Pass ENGINE.globalAlloc / ENGINE.globalFree (or the engine side equivalents) as the allocator,
+// spilled memory is charged to [tag].
+// Elements must be trivially copyable since growing moves them with memcpy.
+template<typename T, u32 N>
+class SmallVector
+{
+    static_assert(std::is_trivially_copyable_v<T>, "SmallVector moves elements with memcpy");
+    static_assert(N > 0);
+
+public:
+    using AllocFunc = void* (*)(u64 allocSize, MemoryTag tag);
+    using FreeFunc = void (*)(void* ptr);
+
+    SmallVector(AllocFunc allocFunc = nullptr, FreeFunc freeFunc = nullptr, MemoryTag tag = MemoryTag::Untagged):
+    data((T*)inlineStorage), count(0), capacity(N), tag(tag), allocFunc(allocFunc), freeFunc(freeFunc)
+    {
+    }
+
+    SmallVector(const SmallVector&) = delete;
+    SmallVector& operator=(const SmallVector&) = delete;
+
+    ~SmallVector()
+    {
+        release();
+    }
+
+    T& push(const T& value)
+    {
+        if (count == capacity)
+        {
+            reserve(capacity * 2);
+        }
+        data[count] = value;
+        return data[count++];
+    }
+
+    void pop()
+    {
+        assert(count != 0);
+        count--;
+    }
+
+    // Removes element [index] by moving the last one into its place
+    void removeSwap(u32 index)
+    {
+        assert(index < count);
+        data[index] = data[--count];
+    }
+
+    void reserve(u32 newCapacity)
+    {
+        if (newCapacity <= capacity)
+        {
+            return;
+        }
+        assert(allocFunc && "SmallVector outgrew its inline storage without an allocator");
+
+        T* newData = (T*)allocFunc((u64)newCapacity * sizeof(T), tag);
+        assert(newData);
+        memcpy((void*)newData, data, (u64)count * sizeof(T));
+        if (isSpilled())
+        {
+            freeFunc(data);
+        }
+        data = newData;
+        capacity = newCapacity;
+    }
+
+    void clear()
+    {
+        count = 0;
+    }
+
+    // Frees spilled memory and goes back to the inline storage
+    void release()
+    {
+        if (isSpilled())
+        {
+            freeFunc(data);
+        }
+        data = (T*)inlineStorage;
+        capacity = N;
+        count = 0;
+    }
+
+    bool isSpilled() const
+    {
+        return data != (const T*)inlineStorage;
+    }
+
+    T& operator[](u32 index)
+    {
+        assert(index < count);
+        return data[index];
+    }
+
+    const T& operator[](u32 index) const
+    {
+        assert(index < count);
+        return data[index];
+    }
+
+    T* begin()
+    {
+        return data;
+    }
+
+    T* end()
+    {
+        return data + count;
+    }
+
+    const T* begin() const
+    {
+        return data;
+    }
+
+    const T* end() const
+    {
+        return data + count;
+    }
+
+    u32 size() const
+    {
+        return count;
+    }
+
+    bool empty() const
+    {
+        return count == 0;
+    }
+
+private:
+    T* data;
+    u32 count;
+    u32 capacity;
+    MemoryTag tag;
+    AllocFunc allocFunc;
+    FreeFunc freeFunc;
+    alignas(T) u8 inlineStorage[N * sizeof(T)];
+};
@@ -1,11 +1,14 @@
 #pragma once
 
 #include <cstdint>
+#include <atomic>
 #include "engine/deps/glm/glm.hpp"
 #include "engine/deps/stb_truetype.h"
 //TODO: move this somewhere else when porting
+#ifdef _WIN32
 #define NOMINMAX
 #include <Windows.h>
+#endif
 
 using i8  = int8_t;
 using i16 = int16_t;
@@ -22,6 +25,7 @@ using f64 = double;
 
 using Entity = u32;
 using AnimationId = u32;
+using TileMapId = u32;
 
 #define WINDOWS_SIZE_X 1000
 #define WINDOWS_SIZE_Y 1000
@@ -46,16 +50,68 @@ using AnimationId = u32;
 
 #define KAMSKI_MAX_LIGHT_COUNT 8192
 
-#ifndef KAMSKI_MEMORY_CHUNKS_MAX
-#define KAMSKI_MEMORY_CHUNKS_MAX 1024
-#endif
-
 #ifndef KAMSKI_RECORDING_FRAMERATE
 #define KAMSKI_RECORDING_FRAMERATE 60
 #endif
 
 #define KAMSKI_MAX_PARTICLE_COUNT 8192
 
+// Vertex buffers start at the initial counts and double as frames need more, quad batches
+// flush once they reach KAMSKI_MAX_QUAD_COUNT quads
+#ifndef KAMSKI_INITIAL_QUAD_COUNT
+#define KAMSKI_INITIAL_QUAD_COUNT 4096
+#endif
+
+#ifndef KAMSKI_MAX_QUAD_COUNT
+#define KAMSKI_MAX_QUAD_COUNT 100000
+#endif
+
+#ifndef KAMSKI_INITIAL_LIGHT_VERTEX_COUNT
+#define KAMSKI_INITIAL_LIGHT_VERTEX_COUNT 16384
+#endif
+
+#ifndef KAMSKI_MAX_LIGHT_VERTEX_COUNT
+#define KAMSKI_MAX_LIGHT_VERTEX_COUNT 400000
+#endif
+
+// Sprite and UI vertices stream through persistently mapped buffers split into this many regions,
+// the CPU fills one while the GPU may still be reading the others
+#ifndef KAMSKI_STREAM_REGION_COUNT
+#define KAMSKI_STREAM_REGION_COUNT 3
+#endif
+
+// Renderer calls are recorded into one of two command lists while a render thread replays the other. A list holds
+// the vertex and pixel copies its commands draw from and is handed over early once it runs out of room
+#ifndef KAMSKI_RENDER_LIST_DATA_SIZE
+#define KAMSKI_RENDER_LIST_DATA_SIZE MB(64)
+#endif
+
+#ifndef KAMSKI_RENDER_LIST_COMMAND_SIZE
+#define KAMSKI_RENDER_LIST_COMMAND_SIZE MB(1)
+#endif
+
+// Side of one texture atlas layer, loadTexture packs every image into layers of this size
+#ifndef KAMSKI_ATLAS_SIZE
+#define KAMSKI_ATLAS_SIZE 2048
+#endif
+
+#ifndef KAMSKI_MAX_ATLAS_LAYERS
+#define KAMSKI_MAX_ATLAS_LAYERS 8
+#endif
+
+#ifndef KAMSKI_MAX_TEXTURE_COUNT
+#define KAMSKI_MAX_TEXTURE_COUNT 1024
+#endif
+
+// Tile maps are drawn and rebuilt in square chunks of this many tiles a side
+#ifndef KAMSKI_TILE_CHUNK_SIZE
+#define KAMSKI_TILE_CHUNK_SIZE 32
+#endif
+
+#ifndef KAMSKI_MAX_TILE_MAP_COUNT
+#define KAMSKI_MAX_TILE_MAP_COUNT 8
+#endif
+
 #define KAMSKI_PLAYBACK_FILENAME "playback.hmi"
 
 #if 0 && KAMSKI_DEBUG
@@ -77,6 +133,57 @@ using AnimationId = u32;
 #define GB(x) (1024ull * MB(x))
 #define TB(x) (1024ull * GB(x))
 
+#ifndef KAMSKI_MAX_THREAD_COUNT
+#define KAMSKI_MAX_THREAD_COUNT 8
+#endif
+
+// Frame arena of the main thread, every other thread gets a KAMSKI_WORKER_TEMP_ARENA_SIZE one
+#ifndef KAMSKI_TEMP_ARENA_SIZE
+#define KAMSKI_TEMP_ARENA_SIZE MB(128)
+#endif
+
+#ifndef KAMSKI_WORKER_TEMP_ARENA_SIZE
+#define KAMSKI_WORKER_TEMP_ARENA_SIZE MB(16)
+#endif
+
+// Backs the whole engine block (permanent partitions and the general allocator) with 2 MB pages to cut TLB misses.
+// The block is then committed up front and stays resident; without the privilege it falls back to 4 KB pages.
+#ifndef KAMSKI_LARGE_PAGES
+#define KAMSKI_LARGE_PAGES 0
+#endif
+
+// Transient memory is reserved up front and committed in granules of this size as it gets used
+#ifndef KAMSKI_COMMIT_GRANULE
+#define KAMSKI_COMMIT_GRANULE KB(64)
+#endif
+
+#ifndef KAMSKI_SLAB_REGION_SIZE
+#define KAMSKI_SLAB_REGION_SIZE MB(64)
+#endif
+
+#ifndef KAMSKI_SLAB_PAGE_SIZE
+#define KAMSKI_SLAB_PAGE_SIZE KB(64)
+#endif
+
+// Jobs a thread can have submitted and not yet finished, a power of two
+#ifndef KAMSKI_JOB_POOL_SIZE
+#define KAMSKI_JOB_POOL_SIZE 4096
+#endif
+
+// Jobs queued per thread before submitJob runs them inline, a power of two
+#ifndef KAMSKI_JOB_DEQUE_SIZE
+#define KAMSKI_JOB_DEQUE_SIZE 1024
+#endif
+
+// Fibers jobs run on, a job waiting on a counter keeps its fiber until the counter reaches zero
+#ifndef KAMSKI_FIBER_COUNT
+#define KAMSKI_FIBER_COUNT 128
+#endif
+
+#ifndef KAMSKI_FIBER_STACK_SIZE
+#define KAMSKI_FIBER_STACK_SIZE KB(256)
+#endif
+
 #define FONT_TEX_WIDTH 1920
 #define FONT_TEX_HEIGHT 1080
 #define FONT_HEIGHT 100
@@ -103,54 +210,79 @@ using AnimationId = u32;
 #endif
 
 
-#ifdef KAMSKI_DEBUG
-
-#ifdef KAMSKI_ENGINE
-
-#ifdef _MSC_VER
+// Messages above this level are compiled out: 0 errors, 1 warnings, 2 info, 3 debug (see KamskiLogLevel)
+#ifndef KAMSKI_LOG_LEVEL
+#define KAMSKI_LOG_LEVEL 3
+#endif
 
-#define logDebug(format, ...) kamskiLog(format, __FILE__, __LINE__, __FUNCTION__ , KamskiLogLevel::Debug, __VA_ARGS__)
-#define logInfo(format, ...) kamskiLog(format, __FILE__, __LINE__, __FUNCTION__ , KamskiLogLevel::Info, __VA_ARGS__)
-#define logWarning(format, ...) kamskiLog(format, __FILE__, __LINE__, __FUNCTION__ , KamskiLogLevel::Warning, __VA_ARGS__)
-#define logError(format, ...) kamskiLog(format, __FILE__, __LINE__, __FUNCTION__ , KamskiLogLevel::Error, __VA_ARGS__)
+// Log records queued for the writer thread, a power of two. Producers drop records while it is full
+#ifndef KAMSKI_LOG_RING_SIZE
+#define KAMSKI_LOG_RING_SIZE 1024
+#endif
 
-#else // _MSC_VER
+// Bytes a record keeps for its arguments (strings are copied), bigger messages are formatted on the calling thread
+#ifndef KAMSKI_LOG_ARGS_SIZE
+#define KAMSKI_LOG_ARGS_SIZE 448
+#endif
 
-#define logDebug(format, ...) kamskiLog(format, __FILE__, __LINE__, __FUNCTION__, KamskiLogLevel::Debug __VA_OPT__(,) __VA_ARGS__)
-#define logInfo(format, ...) kamskiLog(format, __FILE__, __LINE__, __FUNCTION__, KamskiLogLevel::Info __VA_OPT__(,) __VA_ARGS__)
-#define logWarning(format, ...) kamskiLog(format, __FILE__, __LINE__, __FUNCTION__, KamskiLogLevel::Warning __VA_OPT__(,) __VA_ARGS__)
-#define logError(format, ...) kamskiLog(format, __FILE__, __LINE__, __FUNCTION__, KamskiLogLevel::Error __VA_OPT__(,) __VA_ARGS__)
+// Define KAMSKI_LOG_FILE as a path to also write the log to that file
 
-#endif //_MSC_VER
+#ifdef KAMSKI_DEBUG
 
+#ifdef KAMSKI_ENGINE
+#define KAMSKI_LOG_FUNCTION kamskiLog
+#define KAMSKI_LOG_EVERY_FUNCTION kamskiLogEvery
 #else // KAMSKI_ENGINE
+#define KAMSKI_LOG_FUNCTION ENGINE.kamskiLog
+#define KAMSKI_LOG_EVERY_FUNCTION ENGINE.kamskiLogEvery
+#endif // KAMSKI_ENGINE
 
 #ifdef _MSC_VER
-
-#define logDebug(format, ...) ENGINE.kamskiLog(format, __FILE__, __LINE__, __FUNCTION__ , KamskiLogLevel::Debug, __VA_ARGS__)
-#define logInfo(format, ...) ENGINE.kamskiLog(format, __FILE__, __LINE__, __FUNCTION__ , KamskiLogLevel::Info, __VA_ARGS__)
-#define logWarning(format, ...) ENGINE.kamskiLog(format, __FILE__, __LINE__, __FUNCTION__ , KamskiLogLevel::Warning, __VA_ARGS__)
-#define logError(format, ...) ENGINE.kamskiLog(format, __FILE__, __LINE__, __FUNCTION__ , KamskiLogLevel::Error, __VA_ARGS__)
-
+#define KAMSKI_LOG(level, format, ...) KAMSKI_LOG_FUNCTION(format, __FILE__, __LINE__, __FUNCTION__, level, __VA_ARGS__)
 #else // _MSC_VER
+#define KAMSKI_LOG(level, format, ...) KAMSKI_LOG_FUNCTION(format, __FILE__, __LINE__, __FUNCTION__, level __VA_OPT__(,) __VA_ARGS__)
+#endif // _MSC_VER
 
-#define logDebug(format, ...) ENGINE.kamskiLog(format, __FILE__, __LINE__, __FUNCTION__, KamskiLogLevel::Debug __VA_OPT__(,) __VA_ARGS__)
-#define logInfo(format, ...) ENGINE.kamskiLog(format, __FILE__, __LINE__, __FUNCTION__, KamskiLogLevel::Info __VA_OPT__(,) __VA_ARGS__)
-#define logWarning(format, ...) ENGINE.kamskiLog(format, __FILE__, __LINE__, __FUNCTION__, KamskiLogLevel::Warning __VA_OPT__(,) __VA_ARGS__)
-#define logError(format, ...) ENGINE.kamskiLog(format, __FILE__, __LINE__, __FUNCTION__, KamskiLogLevel::Error __VA_OPT__(,) __VA_ARGS__)
-
+// Logs at most once every [seconds] from this call site, the rest of the calls are dropped before any formatting
+#ifdef _MSC_VER
+#define KAMSKI_LOG_EVERY(level, seconds, format, ...) do { static f64 kamskiLogSiteTime = -1.0e30; KAMSKI_LOG_EVERY_FUNCTION(seconds, &kamskiLogSiteTime, format, __FILE__, __LINE__, __FUNCTION__, level, __VA_ARGS__); } while (0)
+#else // _MSC_VER
+#define KAMSKI_LOG_EVERY(level, seconds, format, ...) do { static f64 kamskiLogSiteTime = -1.0e30; KAMSKI_LOG_EVERY_FUNCTION(seconds, &kamskiLogSiteTime, format, __FILE__, __LINE__, __FUNCTION__, level __VA_OPT__(,) __VA_ARGS__); } while (0)
 #endif // _MSC_VER
 
-#endif // KAMSKI_ENGINE
+#endif // KAMSKI_DEBUG
+
+#if defined(KAMSKI_DEBUG) && KAMSKI_LOG_LEVEL >= 0
+#define logError(format, ...) KAMSKI_LOG(KamskiLogLevel::Error, format, __VA_ARGS__)
+#define logErrorEvery(seconds, format, ...) KAMSKI_LOG_EVERY(KamskiLogLevel::Error, seconds, format, __VA_ARGS__)
+#else
+#define logError(format, ...)
+#define logErrorEvery(seconds, format, ...)
+#endif
 
-#else // KAMSKI_DEBUG
+#if defined(KAMSKI_DEBUG) && KAMSKI_LOG_LEVEL >= 1
+#define logWarning(format, ...) KAMSKI_LOG(KamskiLogLevel::Warning, format, __VA_ARGS__)
+#define logWarningEvery(seconds, format, ...) KAMSKI_LOG_EVERY(KamskiLogLevel::Warning, seconds, format, __VA_ARGS__)
+#else
+#define logWarning(format, ...)
+#define logWarningEvery(seconds, format, ...)
+#endif
 
-#define logDebug(format, ...)
+#if defined(KAMSKI_DEBUG) && KAMSKI_LOG_LEVEL >= 2
+#define logInfo(format, ...) KAMSKI_LOG(KamskiLogLevel::Info, format, __VA_ARGS__)
+#define logInfoEvery(seconds, format, ...) KAMSKI_LOG_EVERY(KamskiLogLevel::Info, seconds, format, __VA_ARGS__)
+#else
 #define logInfo(format, ...)
-#define logWarning(format, ...)
-#define logError(format, ...)
+#define logInfoEvery(seconds, format, ...)
+#endif
 
-#endif // KAMSKI_DEBUG
+#if defined(KAMSKI_DEBUG) && KAMSKI_LOG_LEVEL >= 3
+#define logDebug(format, ...) KAMSKI_LOG(KamskiLogLevel::Debug, format, __VA_ARGS__)
+#define logDebugEvery(seconds, format, ...) KAMSKI_LOG_EVERY(KamskiLogLevel::Debug, seconds, format, __VA_ARGS__)
+#else
+#define logDebug(format, ...)
+#define logDebugEvery(seconds, format, ...)
+#endif
 
 
 // ######## TYPES ########
@@ -201,38 +333,173 @@ enum class MouseButtonCode
 
 // ######## Memory ########
 
+// Makes [size] bytes at [address] usable, allocators that live in reserved memory call it before touching new bytes
+using CommitFunc = void (*)(void* address, u64 size);
+
+struct MemoryUsage
+{
+    u64 committedBytes;
+    u64 reservedBytes;
+};
+
+// Subsystem an allocation is charged to in the memory summary
+enum class MemoryTag : u8
+{
+    Untagged,
+    Engine,
+    Renderer,
+    Font,
+    Map,
+    Navmesh,
+    Ecs,
+    Game,
+    ENUM_COUNT
+};
+
+struct MemoryTagStats
+{
+    // Bytes held in the slabs and the general allocator, arenas count with their whole capacity
+    u64 liveBytes;
+    u64 peakBytes;
+    u64 allocationCount;
+    // Bytes taken from the frame arenas during the last frame, summed over every thread
+    u64 temporaryBytes;
+    // Warns once live plus temporary bytes go over it, 0 means no budget
+    u64 budgetBytes;
+    bool overBudget;
+};
+
+struct MemorySummary
+{
+    MemoryTagStats tags[(u32)MemoryTag::ENUM_COUNT];
+    u64 heapFreeBytes;
+    u64 heapLargestFreeBlock;
+    // 1 - largest free block / free bytes, 0 while the free space of the general allocator is a single block
+    f32 heapFragmentation;
+    MemoryUsage usage;
+};
+
+// Two-level segregated fit allocator: alloc and free are O(1) and there is no limit on the block count.
+// Blocks carry boundary tags (the previous block is reachable while it is free) so free coalesces in place.
 class GeneralAllocator
 {
     public:
-    GeneralAllocator(u64 capacity);
-    // Allocates [allocSize] bytes with [alignment]-byte alignment
-    void* alloc(u64 allocSize, u8 alignment = 8);
+    // The allocator only commits its own block headers, the caller commits the bytes it hands out
+    GeneralAllocator(u64 capacity, CommitFunc commit = nullptr);
+    // Allocates [allocSize] bytes with [alignment]-byte alignment, [tag] is kept in the block header
+    void* alloc(u64 allocSize, u8 alignment = 8, MemoryTag tag = MemoryTag::Untagged);
     // Frees pointer
     void free(void* ptr);
+    // Usable size of a pointer returned by alloc, at least the size that was asked for
+    u64 allocationSize(const void* ptr) const;
+    MemoryTag allocationTag(const void* ptr) const;
+    // Size of the biggest block alloc could hand out right now
+    u64 largestFreeBlock() const;
 
     ENGINE_OWNED:
     void printAllocations(bool printFreeChunks) const;
-    void splitChunk(u64 index, u64 size);
 
-    struct MemoryChunk
+    // Sizes are multiples of 8, the second level splits every power of two into 32 lists
+    static constexpr u32 ALIGNMENT_LOG2 = 3;
+    static constexpr u64 ALIGNMENT = 1ull << ALIGNMENT_LOG2;
+    static constexpr u32 SECOND_LEVEL_LOG2 = 5;
+    static constexpr u32 SECOND_LEVEL_COUNT = 1u << SECOND_LEVEL_LOG2;
+    static constexpr u32 FIRST_LEVEL_SHIFT = SECOND_LEVEL_LOG2 + ALIGNMENT_LOG2;
+    static constexpr u32 FIRST_LEVEL_MAX = 40;
+    static constexpr u32 FIRST_LEVEL_COUNT = FIRST_LEVEL_MAX - FIRST_LEVEL_SHIFT + 1;
+    static constexpr u64 SMALL_BLOCK_SIZE = 1ull << FIRST_LEVEL_SHIFT;
+
+    struct BlockHeader
+    {
+        // Overlaps the last 8 bytes of the previous block, only valid while that block is free
+        BlockHeader* prevPhysical;
+        // Usable size, bit 0 marks this block free and bit 1 marks the previous block free
+        u64 sizeAndFlags;
+        // Free list links, they overlap the user data so they are only valid while this block is free
+        BlockHeader* nextFree;
+        BlockHeader* prevFree;
+    };
+
+    static constexpr u64 BLOCK_OVERHEAD = sizeof(u64);
+    static constexpr u64 BLOCK_START_OFFSET = sizeof(BlockHeader*) + sizeof(u64);
+    static constexpr u64 BLOCK_SIZE_MIN = sizeof(BlockHeader) - sizeof(BlockHeader*);
+    static constexpr u64 BLOCK_SIZE_MAX = 1ull << FIRST_LEVEL_MAX;
+
+    void insertFreeBlock(BlockHeader* block);
+    void removeFreeBlock(BlockHeader* block);
+    BlockHeader* findFreeBlock(u64 size);
+    BlockHeader* splitBlock(BlockHeader* block, u64 size);
+    void trimFree(BlockHeader* block, u64 size);
+    BlockHeader* trimFreeLeading(BlockHeader* block, u64 size);
+    void* prepareUsed(BlockHeader* block, u64 size, MemoryTag tag);
+
+    u64 capacity;
+    CommitFunc commit;
+    // Sum of the sizes of all free blocks
+    u64 freeBytes;
+    u64 firstLevelBitmap;
+    u32 secondLevelBitmaps[FIRST_LEVEL_COUNT];
+    BlockHeader* freeLists[FIRST_LEVEL_COUNT][SECOND_LEVEL_COUNT];
+    u8 bytes[];
+};
+
+// Fixed size classes of 16, 32, 64, 128 and 256 bytes with an intrusive free list each.
+// Pages of KAMSKI_SLAB_PAGE_SIZE bytes are handed to a class on demand and never given back,
+// a one byte per page table maps a pointer back to its class so free is O(1).
+// Every memory tag carves its own pages, so the page table also knows the tag of a slot.
+class SlabAllocator
+{
+    public:
+    // Pages are committed as they are handed to a size class
+    SlabAllocator(u64 capacity, CommitFunc commit = nullptr);
+    // Allocates [allocSize] bytes aligned to the size class, nullptr when [allocSize] is too big or the slabs are full
+    void* alloc(u64 allocSize, MemoryTag tag = MemoryTag::Untagged);
+    // Frees a pointer returned by alloc
+    void free(void* ptr);
+    // True when [ptr] lies inside the slab pages
+    bool owns(const void* ptr) const;
+    // Size class of a pointer returned by alloc
+    u64 allocationSize(const void* ptr) const;
+    MemoryTag allocationTag(const void* ptr) const;
+
+    static constexpr u32 MIN_CLASS_LOG2 = 4;
+    static constexpr u32 CLASS_COUNT = 5;
+    static constexpr u64 MAX_SIZE = 1ull << (MIN_CLASS_LOG2 + CLASS_COUNT - 1);
+    // A page table entry holds the class in its low bits and the tag above them
+    static constexpr u32 PAGE_CLASS_BITS = 3;
+    static constexpr u32 TAG_COUNT = (u32)MemoryTag::ENUM_COUNT;
+    static_assert(CLASS_COUNT <= (1u << PAGE_CLASS_BITS) && TAG_COUNT <= (1u << (8 - PAGE_CLASS_BITS)));
+
+    ENGINE_OWNED:
+    struct FreeSlot
+    {
+        FreeSlot* next;
+    };
+
+    struct SizeClass
     {
-        void* address;
-        u64 size;
-        bool isOccupied;
+        FreeSlot* freeList;
+        // Unused tail of the page this class carved last
+        u8* cursor;
+        u8* end;
     };
 
     u64 capacity;
-    u64 lastChunkIndex;
-    u64 chunkCount;
-    MemoryChunk chunks[KAMSKI_MEMORY_CHUNKS_MAX];
+    CommitFunc commit;
+    u64 pageCount;
+    u64 usedPageCount;
+    SizeClass classes[TAG_COUNT][CLASS_COUNT];
+    u8* pages;
+    // Size class and tag of every page, followed by the page aligned pages themselves
     u8 bytes[];
 };
 
 class Arena
 {
     public:
-    Arena(const u64 capacity):
-    size(0), capacity(capacity)
+    // With [commit] set the arena lives in reserved memory and commits KAMSKI_COMMIT_GRANULE sized steps as it grows
+    Arena(const u64 capacity, CommitFunc commit = nullptr):
+    size(0), peakSize(0), openScopes(0), capacity(capacity), committedSize(0), commit(commit)
     {
     }
 
@@ -246,6 +513,17 @@ class Arena
         {
             void* address = &bytes[size + alignmentDistance];
             size += allocSize;
+            if (size > peakSize)
+            {
+                peakSize = size;
+            }
+            if (commit && size > committedSize)
+            {
+                u64 newCommittedSize = (size + KAMSKI_COMMIT_GRANULE - 1) / KAMSKI_COMMIT_GRANULE * KAMSKI_COMMIT_GRANULE;
+                newCommittedSize = newCommittedSize < capacity ? newCommittedSize : capacity;
+                commit(&bytes[committedSize], newCommittedSize - committedSize);
+                committedSize = newCommittedSize;
+            }
             return address;
         }
 
@@ -254,11 +532,94 @@ class Arena
 
     // size has no reason to be private since a setter and getter would be implemented anyway
     u64 size;
+    // Highest size reached since the engine last reset it (frame arenas are reset every frame)
+    u64 peakSize;
+    // TempMemoryScopes open on this arena, the job system asserts a frame arena has none when its thread waits
+    u32 openScopes;
     ENGINE_OWNED:
     u64 capacity;
+    u64 committedSize;
+    CommitFunc commit;
     u8 bytes[];
 };
 
+// Rolls [arena] back to its current size when the scope ends, so scratch memory can be released before the frame does
+//     TempMemoryScope scratch(ENGINE.getTemporaryArena());
+// Do not wait on a job counter (waitCounter, parallelFor, recordSpritesParallel) while a scope on a frame arena is open.
+// The thread runs other jobs that allocate from its arena meanwhile, and the waiting job may resume on another thread,
+// so the rollback would free their memory or another thread's
+class TempMemoryScope
+{
+    public:
+    TempMemoryScope(Arena* arena):
+    arena(arena), size(arena->size)
+    {
+        arena->openScopes++;
+    }
+
+    ~TempMemoryScope()
+    {
+        arena->openScopes--;
+        arena->size = size;
+    }
+
+    TempMemoryScope(const TempMemoryScope&) = delete;
+    TempMemoryScope& operator=(const TempMemoryScope&) = delete;
+
+    private:
+    Arena* arena;
+    u64 size;
+};
+
+// ######## Jobs ########
+
+using JobFunc = void (*)(void* data);
+// Runs the items [begin, end) of a parallelFor
+using ParallelForFunc = void (*)(void* data, u32 begin, u32 end);
+
+struct Job;
+struct JobFiber;
+
+// Counts the unfinished jobs submitted against it, zero-initialize it and keep it alive until waitCounter returns
+struct JobCounter
+{
+    std::atomic<i32> value{0};
+    // Guards continuations against the last job finishing while submitJobAfter links a new one
+    std::atomic<bool> locked{false};
+    Job* continuations = nullptr;
+    JobFiber* waitingFibers = nullptr;
+};
+
+// ######## Renderer ########
+
+struct RendererUsage
+{
+    // Most vertices a single draw used since startup
+    u64 quadVertexHighWater;
+    u64 uiVertexHighWater;
+    u64 lightVertexHighWater;
+    // Most world sprites a single draw instanced since startup
+    u64 spriteHighWater;
+    // Vertex memory the renderer holds right now
+    u64 cpuBytes;
+    u64 gpuBytes;
+    // Times the CPU came back to a stream region the GPU was still reading and had to wait
+    u64 streamStalls;
+};
+
+// Averages over the last KAMSKI_FRAME_COUNT frames, in seconds
+struct RenderThreadStats
+{
+    // From swapClear on the game thread to SwapBuffers returning on the render thread
+    f64 latency;
+    // Render thread time spent replaying a frame's commands, SwapBuffers included
+    f64 renderTime;
+    // Game thread time spent waiting for the render thread to hand back a command list
+    f64 submitWait;
+    f64 framesPerSecond;
+    u64 framesPresented;
+};
+
 // UI
 
 enum class AnchorPoint
@@ -268,11 +629,15 @@ enum class AnchorPoint
 
 #ifdef KAMSKI_ENGINE
 
-inline constexpr u64 MAX_QUAD_COUNT = 100000;
+inline constexpr u64 MAX_QUAD_COUNT = KAMSKI_MAX_QUAD_COUNT;
 inline constexpr u64 MAX_VERTEX_COUNT = MAX_QUAD_COUNT * 4;
 inline constexpr u64 MAX_INDEX_COUNT = MAX_QUAD_COUNT * 6;
+inline constexpr u64 MAX_LIGHT_VERTEX_COUNT = KAMSKI_MAX_LIGHT_VERTEX_COUNT;
 inline constexpr u64 FONT_CHARACTER_COUNT = 96;
-inline constexpr u64 TEXTURE_SLOT_COUNT = 32;
+inline constexpr u64 ATLAS_SIZE = KAMSKI_ATLAS_SIZE;
+inline constexpr u32 STREAM_REGION_COUNT = KAMSKI_STREAM_REGION_COUNT;
+inline constexpr u64 TILE_CHUNK_SIZE = KAMSKI_TILE_CHUNK_SIZE;
+inline constexpr u64 TILE_CHUNK_TILE_COUNT = TILE_CHUNK_SIZE * TILE_CHUNK_SIZE;
 
 // ######## FUNCTIONS ########
 // ######## Renderer ########
@@ -291,14 +656,31 @@ void addLight(glm::vec2 position, f32 radius, const glm::vec4& color);
 void addLightBlocker(glm::vec2 position, glm::vec2 size);
 void flush();
 void flushUI();
+// Ends the frame, the render thread presents it while the game thread records the next one
 void swapClear();
-void drawTexturedQuad(glm::vec2 position, glm::vec2 size, const u32 texId, f32 rotation);
-void drawColoredQuad(glm::vec2 position, glm::vec2 size, const glm::vec4& color, f32 rotation);
-void drawQuad(glm::vec2 position, glm::vec2 size, f32 texId, const glm::vec4& color, f32 rotation);
+RendererUsage getRendererUsage();
+RenderThreadStats getRenderThreadStats();
+// Larger [depth] is drawn behind and equal depths keep their call order. Sprites with an opaque color are depth
+// tested and cut at half alpha, translucent ones are sorted and blended over them
+void drawTexturedQuad(glm::vec2 position, glm::vec2 size, const u32 texId, f32 rotation, f32 depth);
+void drawColoredQuad(glm::vec2 position, glm::vec2 size, const glm::vec4& color, f32 rotation, f32 depth);
+void drawQuad(glm::vec2 position, glm::vec2 size, f32 texId, const glm::vec4& color, f32 rotation, f32 depth);
 void loadFont(const char* path, u32 &fontTexId, stbtt_bakedchar* chars);
-void drawCharacter(glm::vec2 position, const f32 scale, const char character);
-void drawText(glm::vec2 position, const f32 scale, const char* text);
-void drawTextInsideBox(glm::vec2 position1, glm::vec2 position2, const f32 scale, const char* text);
+// Tiles that rarely change, [origin] is the bottom left corner of tile (0, 0). Every tile starts empty
+TileMapId createTileMap(glm::uvec2 size, glm::vec2 tileSize, glm::vec2 origin);
+void destroyTileMap(TileMapId id);
+// [texId] 0 empties the tile, the chunk holding it is rebuilt the next time it is drawn
+void setTile(TileMapId id, glm::uvec2 tile, u32 texId);
+// Draws every chunk in view with one call each, on top of the sprites drawn so far
+void drawTileMap(TileMapId id);
+// parallelFor for recording world sprites: each batch records into its thread's own queue and the batches are
+// appended in order afterwards, so the frame draws exactly as if [func] ran serially. [func] may only call the
+// world sprite draws (drawTexturedQuad, drawColoredQuad, drawQuad) and must not wait on counters
+void recordSpritesParallel(u32 count, u32 batchSize, ParallelForFunc func, void* data);
+// World text is depth tested with the opaque sprites, [depth] works like theirs (the game passes position.y)
+void drawCharacter(glm::vec2 position, const f32 scale, const char character, f32 depth);
+void drawText(glm::vec2 position, const f32 scale, const char* text, f32 depth);
+void drawTextInsideBox(glm::vec2 position1, glm::vec2 position2, const f32 scale, const char* text, f32 depth);
 glm::vec2 getScreenSize();
 
 // ######## Random ########
@@ -323,6 +705,15 @@ void kamskiLog(const char* format,
                const char* funcName,
                KamskiLogLevel logLevel,
                ...);
+// Logs only when [interval] seconds passed since [lastTime], which the caller keeps per call site
+void kamskiLogEvery(f64 interval,
+                    f64* lastTime,
+                    const char* format,
+                    const char* fileName,
+                    int lineNumber,
+                    const char* funcName,
+                    KamskiLogLevel logLevel,
+                    ...);
 
 // ######## IO ########
 
@@ -341,16 +732,42 @@ u64 getFileSize(const char* filePath);
 
 // ######## Memory ########
 
-void*  temporaryAlloc(u64 allocSize, const u64 alignment);
-void*  temporaryAlloc(u64 allocSize);
+void*  temporaryAlloc(u64 allocSize, const u64 alignment, MemoryTag tag = MemoryTag::Untagged);
+void*  temporaryAlloc(u64 allocSize, MemoryTag tag = MemoryTag::Untagged);
+MemoryUsage getMemoryUsage();
+MemorySummary getMemorySummary();
+void   setMemoryBudget(MemoryTag tag, u64 budgetBytes);
+void   printMemorySummary();
+Arena* getTemporaryArena();
+u64    getTemporaryPeak(u32 threadIndex);
 void*  getPermanentMemory();
-void*  globalAlloc(u64 allocSize);
-void*  globalAlignedAlloc(u64 allocSize, u8 alignment);
+void*  globalAlloc(u64 allocSize, MemoryTag tag = MemoryTag::Untagged);
+void*  globalAlignedAlloc(u64 allocSize, u8 alignment, MemoryTag tag = MemoryTag::Untagged);
 void   globalFree(void* ptr);
+void*  slabAlloc(u64 allocSize, MemoryTag tag = MemoryTag::Untagged);
+void   slabFree(void* ptr);
 void   printGlobalAllocations(bool printFreeChunks = true);
-Arena* allocArena(u64 arenaSize);
+Arena* allocArena(u64 arenaSize, MemoryTag tag = MemoryTag::Untagged);
 void   freeArena(Arena* arena);
 
+// ######## Jobs ########
+
+// Starts [workerCount] workers (0 picks one per spare core), [threadInit] runs first on each with its thread index
+void initJobSystem(u32 workerCount, void (*threadInit)(u32 threadIndex));
+void shutdownJobSystem();
+u32  getWorkerCount();
+// Only the thread local engine state (temporaryAlloc) is safe to use from a job
+void submitJob(JobFunc func, void* data, JobCounter* counter);
+// Queues the job once [dependency] reaches zero
+void submitJobAfter(JobCounter* dependency, JobFunc func, void* data, JobCounter* counter);
+// Parks the calling fiber until [counter] reaches zero, the thread runs other jobs meanwhile.
+// The job may resume on another thread, do not keep thread local state (a TempMemoryScope) across the wait
+void waitCounter(JobCounter* counter);
+// Runs [func] on a fiber pinned to the calling thread, so it can wait on counters without blocking the thread
+void runOnFiber(JobFunc func, void* data);
+// Splits [0, count) into batches of [batchSize] items across the workers and returns once all ran
+void parallelFor(u32 count, u32 batchSize, ParallelForFunc func, void* data);
+
 // ######## Particles ########
 
 void emitParticles(u32 particleCount,
@@ -382,6 +799,13 @@ void kamskiPlatformReadWholeFile(void* buffer, u64 bufferSize, const char* fileP
 void kamskiPlatformWriteFile(const void* const buffer, u64 bufferSize, const char* filePath);
 u64 kamskiPlatformGetFileSize(const char* filePath);
 f64 kamskiPlatformGetTime();
+void* kamskiPlatformReserveMemory(void* baseAddress, u64 size, bool largePages);
+void kamskiPlatformCommitMemory(void* address, u64 size);
+MemoryUsage kamskiPlatformGetMemoryUsage();
+// Starts the thread that writes queued log records, before it runs kamskiLog writes on the calling thread
+void kamskiPlatformStartLogger();
+// Blocks until every queued log record is written, call it before unloading code whose strings are queued
+void kamskiPlatformFlushLog();
 
 // ######## UI ########
 
@@ -410,28 +834,56 @@ struct API
                       const char* funcName,
                       KamskiLogLevel logLevel,
                       ...);
+    void (*kamskiLogEvery)(f64 interval,
+                           f64* lastTime,
+                           const char* format,
+                           const char* fileName,
+                           int lineNumber,
+                           const char* funcName,
+                           KamskiLogLevel logLevel,
+                           ...);
     void (*beginBatch)(glm::vec3 camera);
     void (*endBatch)();
     void (*swapClear)();
-    void (*drawTexturedQuad)(glm::vec2 position, glm::vec2 size, u32 texId, f32 rotation);
-    void (*drawColoredQuad)(glm::vec2 position, glm::vec2 size, const glm::vec4& color, f32 rotation);
-    void (*drawQuad)(glm::vec2 position, glm::vec2 size, u32 texId, const glm::vec4& color, f32 rotation);
-    void (*drawCharacter)(glm::vec2 position, const f32 scale, const char character);
-    void (*drawText)(glm::vec2 position, const f32 scale, const char* text);
-    void (*drawTextInsideBox)(glm::vec2 position1, glm::vec2 position2, const f32 scale, const char* text);
+    RendererUsage (*getRendererUsage)();
+    RenderThreadStats (*getRenderThreadStats)();
+    void (*drawTexturedQuad)(glm::vec2 position, glm::vec2 size, u32 texId, f32 rotation, f32 depth);
+    void (*drawColoredQuad)(glm::vec2 position, glm::vec2 size, const glm::vec4& color, f32 rotation, f32 depth);
+    void (*drawQuad)(glm::vec2 position, glm::vec2 size, u32 texId, const glm::vec4& color, f32 rotation, f32 depth);
+    void (*drawCharacter)(glm::vec2 position, const f32 scale, const char character, f32 depth);
+    void (*drawText)(glm::vec2 position, const f32 scale, const char* text, f32 depth);
+    void (*drawTextInsideBox)(glm::vec2 position1, glm::vec2 position2, const f32 scale, const char* text, f32 depth);
     void (*addLight)(glm::vec2 position, f32 radius, const glm::vec4& color);
     void (*addLightBlocker)(glm::vec2 position, glm::vec2 size);
     u32  (*loadTexture)(const char* textureFilePath);
+    TileMapId (*createTileMap)(glm::uvec2 size, glm::vec2 tileSize, glm::vec2 origin);
+    void (*destroyTileMap)(TileMapId id);
+    void (*setTile)(TileMapId id, glm::uvec2 tile, u32 texId);
+    void (*drawTileMap)(TileMapId id);
+    void (*recordSpritesParallel)(u32 count, u32 batchSize, ParallelForFunc func, void* data);
     glm::vec2 (*getScreenSize)();
-    void*  (*temporaryAlignedAlloc)(u64 allocSize, const u64 alignment);
-    void*  (*temporaryAlloc)(u64 allocSize);
+    void*  (*temporaryAlignedAlloc)(u64 allocSize, const u64 alignment, MemoryTag tag);
+    void*  (*temporaryAlloc)(u64 allocSize, MemoryTag tag);
+    MemoryUsage (*getMemoryUsage)();
+    MemorySummary (*getMemorySummary)();
+    void   (*setMemoryBudget)(MemoryTag tag, u64 budgetBytes);
+    void   (*printMemorySummary)();
+    Arena* (*getTemporaryArena)();
+    u64    (*getTemporaryPeak)(u32 threadIndex);
     void*  (*getPermanentMemory)();
-    void*  (*globalAlloc)(u64 allocSize);
-    void*  (*globalAlignedAlloc)(u64 allocSize, u8 alignment);
+    void*  (*globalAlloc)(u64 allocSize, MemoryTag tag);
+    void*  (*globalAlignedAlloc)(u64 allocSize, u8 alignment, MemoryTag tag);
     void   (*globalFree)(void* ptr);
-    Arena* (*allocArena)(u64 arenaCapacity);
+    void*  (*slabAlloc)(u64 allocSize, MemoryTag tag);
+    void   (*slabFree)(void* ptr);
+    Arena* (*allocArena)(u64 arenaCapacity, MemoryTag tag);
     void   (*freeArena)(Arena* arena);
     void   (*printGlobalAllocations)(bool printFreeChunks);
+    u32  (*getWorkerCount)();
+    void (*submitJob)(JobFunc func, void* data, JobCounter* counter);
+    void (*submitJobAfter)(JobCounter* dependency, JobFunc func, void* data, JobCounter* counter);
+    void (*waitCounter)(JobCounter* counter);
+    void (*parallelFor)(u32 count, u32 batchSize, ParallelForFunc func, void* data);
     void (*readWholeFile)(void* const buffer, const u64 bufferCapacity, const char* filePath);
     void (*writeFile)(const void* const buffer, const u64 bufferSize, const char* filePath);
     u64 (*getFileSize)(const char* filePath);
@@ -0,0 +1,602 @@
+// Microbenchmarks for KamskiContainers.h: ComponentVector, EntityRegistry, FlatHashMap and SmallVector,
+// the latter two against std::unordered_map and std::vector.
+//
+// Build and run from KamskiEngine/bench:
+//     g++ -O2 -std=c++20 ContainersBench.cpp -o ContainersBench && ./ContainersBench [--json] [--reps N]
+//     cl /O2 /std:c++20 /EHsc ContainersBench.cpp
+//
+// Cache, L1d and dTLB miss columns come from perf_event_open and only show up on Linux
+// when perf events are permitted (kernel.perf_event_paranoid <= 2).
+
+#define KAMSKI_MAX_ENTITY_COUNT (1 << 17)
+
+#include "../KamskiContainers.h"
+#include "KamskiBench.h"
+#include <new>
+#include <algorithm>
+#include <unordered_map>
+#include <vector>
+
+inline constexpr u32 BENCH_ENTITY_COUNT = KAMSKI_MAX_ENTITY_COUNT;
+
+template<u32 Index>
+struct BenchComponent
+{
+    f32 values[8];
+};
+
+using C0 = BenchComponent<0>;
+using C1 = BenchComponent<1>;
+using C2 = BenchComponent<2>;
+using C3 = BenchComponent<3>;
+using C4 = BenchComponent<4>;
+using C5 = BenchComponent<5>;
+using C6 = BenchComponent<6>;
+using C7 = BenchComponent<7>;
+
+using BenchRegistry = EntityRegistry<ComponentList<C0, C1, C2, C3, C4, C5, C6, C7>>;
+
+static BenchRegistry* registry;
+static u64 randomState = 0x853c49e6748fea9bull;
+
+static u64 nextRandom()
+{
+    // splitmix64
+    u64 z = (randomState += 0x9E3779B97F4A7C15ull);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+}
+
+static bool chance(u32 percent)
+{
+    return nextRandom() % 100 < percent;
+}
+
+static void shuffle(Entity* entities, u32 count)
+{
+    for (u32 i = count - 1; i > 0; i--)
+    {
+        const u32 j = (u32)(nextRandom() % (i + 1));
+        const Entity aux = entities[i];
+        entities[i] = entities[j];
+        entities[j] = aux;
+    }
+}
+
+static void resetRegistry()
+{
+    memset((void*)registry, 0, sizeof(BenchRegistry));
+    new (registry) BenchRegistry();
+    randomState = 0x853c49e6748fea9bull;
+}
+
+template<typename Component>
+static void addWithDensity(Entity eId, u32 percent)
+{
+    if (chance(percent))
+    {
+        registry->addComponent<Component>(eId, Component{ { (f32)eId } });
+    }
+}
+
+// C0 on every entity, every other component with [percent] probability
+static void populate(u32 percent)
+{
+    resetRegistry();
+    for (u32 i = 0; i < BENCH_ENTITY_COUNT; i++)
+    {
+        const Entity eId = registry->createEntity();
+        registry->addComponent<C0>(eId, C0{ { (f32)eId } });
+        addWithDensity<C1>(eId, percent);
+        addWithDensity<C2>(eId, percent);
+        addWithDensity<C3>(eId, percent);
+        addWithDensity<C4>(eId, percent);
+        addWithDensity<C5>(eId, percent);
+        addWithDensity<C6>(eId, percent);
+        addWithDensity<C7>(eId, percent);
+    }
+}
+
+template<typename ... Components>
+static u64 join()
+{
+    f32 sum = 0.0f;
+    u64 matches = 0;
+    for (Entity eId : registry->iterateEntities<Components ...>())
+    {
+        sum += (registry->getComponent<Components>(eId).values[0] + ...);
+        matches++;
+    }
+    benchKeep(sum);
+    benchKeep(matches);
+    return BENCH_ENTITY_COUNT;
+}
+
+static void benchLifetime()
+{
+    benchRun("create/destroy churn", 2 * BENCH_ENTITY_COUNT, resetRegistry, []()
+             {
+                 // Second round reuses the ids freed by the first one
+                 for (u32 round = 0; round < 2; round++)
+                 {
+                     for (u32 i = 0; i < BENCH_ENTITY_COUNT; i++)
+                     {
+                         registry->createEntity();
+                     }
+                     for (Entity eId = 0; eId < BENCH_ENTITY_COUNT; eId++)
+                     {
+                         registry->markEntityForDeletion(eId);
+                     }
+                     registry->removeMarkedEntities();
+                 }
+                 return (u64)2 * BENCH_ENTITY_COUNT;
+             });
+
+    benchRun("addComponent", BENCH_ENTITY_COUNT, []()
+             {
+                 resetRegistry();
+                 for (u32 i = 0; i < BENCH_ENTITY_COUNT; i++)
+                 {
+                     registry->createEntity();
+                 }
+             }, []()
+             {
+                 for (Entity eId = 0; eId < BENCH_ENTITY_COUNT; eId++)
+                 {
+                     registry->addComponent<C1>(eId, C1{ { (f32)eId } });
+                 }
+                 return (u64)BENCH_ENTITY_COUNT;
+             });
+
+    static Entity order[BENCH_ENTITY_COUNT];
+    benchRun("removeComponent (random order)", BENCH_ENTITY_COUNT, []()
+             {
+                 populate(100);
+                 for (u32 i = 0; i < BENCH_ENTITY_COUNT; i++)
+                 {
+                     order[i] = i;
+                 }
+                 shuffle(order, BENCH_ENTITY_COUNT);
+             }, []()
+             {
+                 for (u32 i = 0; i < BENCH_ENTITY_COUNT; i++)
+                 {
+                     registry->removeComponent<C1>(order[i]);
+                 }
+                 return (u64)BENCH_ENTITY_COUNT;
+             });
+
+    for (u32 percent : { 90, 50, 10 })
+    {
+        benchRun(benchName("removeMarkedEntities (%u%% marked)", percent), BENCH_ENTITY_COUNT, [percent]()
+                 {
+                     populate(50);
+                     for (Entity eId = 0; eId < BENCH_ENTITY_COUNT; eId++)
+                     {
+                         if (chance(percent))
+                         {
+                             registry->markEntityForDeletion(eId);
+                         }
+                     }
+                 }, []()
+                 {
+                     registry->removeMarkedEntities();
+                     return (u64)BENCH_ENTITY_COUNT;
+                 });
+    }
+}
+
+static void benchLookups()
+{
+    static Entity order[BENCH_ENTITY_COUNT];
+    for (u32 i = 0; i < BENCH_ENTITY_COUNT; i++)
+    {
+        order[i] = i;
+    }
+    shuffle(order, BENCH_ENTITY_COUNT);
+
+    populate(50);
+
+    benchRun("EntityRegistry::hasComponent (random)", BENCH_ENTITY_COUNT, []() {}, []()
+             {
+                 u64 count = 0;
+                 for (u32 i = 0; i < BENCH_ENTITY_COUNT; i++)
+                 {
+                     count += registry->hasComponent<C3>(order[i]);
+                 }
+                 benchKeep(count);
+                 return (u64)BENCH_ENTITY_COUNT;
+             });
+
+    benchRun("ComponentVector::hasComponent (random)", BENCH_ENTITY_COUNT, []() {}, []()
+             {
+                 const auto& vec = registry->getComponentVector<C3>();
+                 u64 count = 0;
+                 for (u32 i = 0; i < BENCH_ENTITY_COUNT; i++)
+                 {
+                     count += vec.hasComponent(order[i]);
+                 }
+                 benchKeep(count);
+                 return (u64)BENCH_ENTITY_COUNT;
+             });
+
+    benchRun("getComponent (random)", BENCH_ENTITY_COUNT, []() {}, []()
+             {
+                 f32 sum = 0.0f;
+                 for (u32 i = 0; i < BENCH_ENTITY_COUNT; i++)
+                 {
+                     sum += registry->getComponent<C0>(order[i]).values[0];
+                 }
+                 benchKeep(sum);
+                 return (u64)BENCH_ENTITY_COUNT;
+             });
+
+    benchRun("iterateComponents (single)", BENCH_ENTITY_COUNT, []() {}, []()
+             {
+                 f32 sum = 0.0f;
+                 for (const C0& component : registry->iterateComponents<C0>())
+                 {
+                     sum += component.values[0];
+                 }
+                 benchKeep(sum);
+                 return (u64)BENCH_ENTITY_COUNT;
+             });
+}
+
+static void benchJoins()
+{
+    for (u32 percent : { 100, 50, 10 })
+    {
+        populate(percent);
+        benchRun(benchName("iterateEntities 2-way (%u%%)", percent), BENCH_ENTITY_COUNT, []() {}, join<C0, C1>);
+        benchRun(benchName("iterateEntities 4-way (%u%%)", percent), BENCH_ENTITY_COUNT, []() {}, join<C0, C1, C2, C3>);
+        benchRun(benchName("iterateEntities 8-way (%u%%)", percent), BENCH_ENTITY_COUNT, []() {}, join<C0, C1, C2, C3, C4, C5, C6, C7>);
+    }
+}
+
+// Walks C0's dense array and reads the matching C1, the access pattern sortComponentsLike targets
+static u64 leadJoin()
+{
+    const auto& lead = registry->getComponentVector<C0>();
+    const auto& other = registry->getComponentVector<C1>();
+    f32 sum = 0.0f;
+    for (Entity eId : lead.iterateEntities())
+    {
+        sum += other.getComponent(eId).values[0];
+    }
+    benchKeep(sum);
+    return BENCH_ENTITY_COUNT;
+}
+
+// Removes and re-adds C1 on [percent] of the entities in random order, which is what gameplay churn
+// does to a dense array: swap-and-pop fills the holes from the back and re-adds append
+static void churnC1(u32 percent)
+{
+    static Entity order[BENCH_ENTITY_COUNT];
+    for (u32 i = 0; i < BENCH_ENTITY_COUNT; i++)
+    {
+        order[i] = i;
+    }
+    shuffle(order, BENCH_ENTITY_COUNT);
+
+    const u32 count = (u32)((u64)BENCH_ENTITY_COUNT * percent / 100);
+    for (u32 i = 0; i < count; i++)
+    {
+        registry->removeComponent<C1>(order[i]);
+    }
+    for (u32 i = 0; i < count; i++)
+    {
+        registry->addComponent<C1>(order[i], C1{ { (f32)order[i] } });
+    }
+}
+
+static u64 positionKey(const C0& component, Entity)
+{
+    return mortonKey(glm::vec2{ component.values[1], component.values[2] }, 16.0f);
+}
+
+static void benchLocality()
+{
+    for (u32 percent : { 100, 10 })
+    {
+        benchRun(benchName("lead join, %u%% churned", percent), BENCH_ENTITY_COUNT, [percent]()
+                 {
+                     populate(100);
+                     churnC1(percent);
+                 }, leadJoin);
+
+        benchRun(benchName("sortComponentsLike from %u%% churn (per lead entry)", percent), BENCH_ENTITY_COUNT, [percent]()
+                 {
+                     populate(100);
+                     churnC1(percent);
+                 }, []()
+                 {
+                     constexpr u32 budget = 4096;
+                     u64 steps = 0;
+                     while (!registry->sortComponentsLike<C1, C0>(budget))
+                     {
+                         steps++;
+                     }
+                     return steps * budget;
+                 });
+
+        benchRun(benchName("lead join, sorted after %u%% churn", percent), BENCH_ENTITY_COUNT, []() {}, leadJoin);
+    }
+
+    benchRun("sortComponentsLike (budget 512, already sorted)", 512, []() {}, []()
+             {
+                 registry->sortComponentsLike<C1, C0>(512);
+                 return (u64)512;
+             });
+
+    // Morton order: entities created in order, then 1% of them teleport
+    auto moved = []()
+    {
+        populate(0);
+        static glm::vec2 positions[BENCH_ENTITY_COUNT];
+        for (u32 i = 0; i < BENCH_ENTITY_COUNT; i++)
+        {
+            positions[i] = glm::vec2{ (f32)(nextRandom() % 4096), (f32)(nextRandom() % 4096) };
+        }
+        std::sort(positions, positions + BENCH_ENTITY_COUNT, [](glm::vec2 a, glm::vec2 b)
+                  {
+                      return mortonKey(a, 16.0f) < mortonKey(b, 16.0f);
+                  });
+
+        auto& transforms = registry->getComponentVector<C0>();
+        u32 index = 0;
+        for (C0& component : transforms.iterateComponents())
+        {
+            component.values[1] = positions[index].x;
+            component.values[2] = positions[index].y;
+            index++;
+        }
+        for (u32 i = 0; i < BENCH_ENTITY_COUNT / 100; i++)
+        {
+            C0& component = registry->getComponent<C0>((Entity)(nextRandom() % BENCH_ENTITY_COUNT));
+            component.values[1] = (f32)(nextRandom() % 4096);
+            component.values[2] = (f32)(nextRandom() % 4096);
+        }
+    };
+
+    // Every compare evaluates the key of both entries
+    static u64 keyCalls;
+    auto countedKey = [](const C0& component, Entity eId)
+    {
+        keyCalls++;
+        return positionKey(component, eId);
+    };
+
+    benchRun("sortComponents morton, 1% moved (per compare)", 0, moved, [countedKey]()
+             {
+                 keyCalls = 0;
+                 while (!registry->sortComponents<C0>(countedKey, 1 << 16))
+                 {
+                 }
+                 return keyCalls / 2;
+             });
+
+    benchRun("sortComponents morton, 1% moved (to converge)", BENCH_ENTITY_COUNT, moved, []()
+             {
+                 while (!registry->sortComponents<C0>(positionKey, 1 << 16))
+                 {
+                 }
+                 return (u64)1;
+             });
+
+    benchRun("sortComponents morton (budget 512, sorted)", 512, []() {}, []()
+             {
+                 registry->sortComponents<C0>(positionKey, 512);
+                 return (u64)512;
+             });
+}
+
+static Arena* newArena(u64 capacity)
+{
+    void* memory = malloc(sizeof(Arena) + capacity);
+    if (!memory)
+    {
+        fprintf(stderr, "could not allocate a %llu byte arena\n", (unsigned long long)capacity);
+        exit(EXIT_FAILURE);
+    }
+    return new (memory) Arena(capacity);
+}
+
+static void benchHashMaps()
+{
+    static Arena* arena = newArena(MB(256));
+    static u64 keys[1 << 20];
+    static u64 missKeys[1 << 20];
+
+    for (u32 count : { 1u << 10, 1u << 16, 1u << 20 })
+    {
+        for (u32 i = 0; i < count; i++)
+        {
+            keys[i] = nextRandom();
+            missKeys[i] = nextRandom();
+        }
+
+        static FlatHashMap<u64, u64> flat;
+        static std::unordered_map<u64, u64>* unordered;
+
+        benchRun(benchName("FlatHashMap insert (%u)", count), count, [count]()
+                 {
+                     arena->size = 0;
+                     flat = FlatHashMap<u64, u64>(arena, count);
+                 }, [count]()
+                 {
+                     for (u32 i = 0; i < count; i++)
+                     {
+                         flat.insert(keys[i], i);
+                     }
+                     return (u64)count;
+                 });
+
+        benchRun(benchName("std::unordered_map insert (%u)", count), count, [count]()
+                 {
+                     delete unordered;
+                     unordered = new std::unordered_map<u64, u64>();
+                     unordered->reserve(count);
+                 }, [count]()
+                 {
+                     for (u32 i = 0; i < count; i++)
+                     {
+                         (*unordered)[keys[i]] = i;
+                     }
+                     return (u64)count;
+                 });
+
+        benchRun(benchName("FlatHashMap find hit (%u)", count), count, []() {}, [count]()
+                 {
+                     u64 sum = 0;
+                     for (u32 i = 0; i < count; i++)
+                     {
+                         sum += *flat.find(keys[(i * 7919u) & (count - 1)]);
+                     }
+                     benchKeep(sum);
+                     return (u64)count;
+                 });
+
+        benchRun(benchName("std::unordered_map find hit (%u)", count), count, []() {}, [count]()
+                 {
+                     u64 sum = 0;
+                     for (u32 i = 0; i < count; i++)
+                     {
+                         sum += unordered->find(keys[(i * 7919u) & (count - 1)])->second;
+                     }
+                     benchKeep(sum);
+                     return (u64)count;
+                 });
+
+        benchRun(benchName("FlatHashMap find miss (%u)", count), count, []() {}, [count]()
+                 {
+                     u64 found = 0;
+                     for (u32 i = 0; i < count; i++)
+                     {
+                         found += flat.find(missKeys[i]) != nullptr;
+                     }
+                     benchKeep(found);
+                     return (u64)count;
+                 });
+
+        benchRun(benchName("std::unordered_map find miss (%u)", count), count, []() {}, [count]()
+                 {
+                     u64 found = 0;
+                     for (u32 i = 0; i < count; i++)
+                     {
+                         found += unordered->find(missKeys[i]) != unordered->end();
+                     }
+                     benchKeep(found);
+                     return (u64)count;
+                 });
+
+        benchRun(benchName("FlatHashMap remove (%u)", count), count, [count]()
+                 {
+                     arena->size = 0;
+                     flat = FlatHashMap<u64, u64>(arena, count);
+                     for (u32 i = 0; i < count; i++)
+                     {
+                         flat.insert(keys[i], i);
+                     }
+                 }, [count]()
+                 {
+                     for (u32 i = 0; i < count; i++)
+                     {
+                         flat.remove(keys[i]);
+                     }
+                     return (u64)count;
+                 });
+
+        benchRun(benchName("std::unordered_map erase (%u)", count), count, [count]()
+                 {
+                     for (u32 i = 0; i < count; i++)
+                     {
+                         (*unordered)[keys[i]] = i;
+                     }
+                 }, [count]()
+                 {
+                     for (u32 i = 0; i < count; i++)
+                     {
+                         unordered->erase(keys[i]);
+                     }
+                     return (u64)count;
+                 });
+
+        delete unordered;
+        unordered = nullptr;
+    }
+    free(arena);
+}
+
+static void benchSmallVectors()
+{
+    constexpr u32 vectorCount = 1 << 16;
+    auto mallocAlloc = [](u64 size, MemoryTag) { return malloc(size); };
+    auto mallocFree = [](void* ptr) { free(ptr); };
+
+    // Builds vectorCount short lists and sums them, the shape of per-entity scratch lists
+    for (u32 length : { 4u, 8u, 32u })
+    {
+        benchRun(benchName("SmallVector<u32, 8> fill+sum (len %u)", length), (u64)vectorCount * length, []() {}, [=]()
+                 {
+                     u64 sum = 0;
+                     for (u32 v = 0; v < vectorCount; v++)
+                     {
+                         SmallVector<u32, 8> vec(mallocAlloc, mallocFree);
+                         for (u32 i = 0; i < length; i++)
+                         {
+                             vec.push(v + i);
+                         }
+                         for (u32 value : vec)
+                         {
+                             sum += value;
+                         }
+                     }
+                     benchKeep(sum);
+                     return (u64)vectorCount * length;
+                 });
+
+        benchRun(benchName("std::vector<u32> fill+sum (len %u)", length), (u64)vectorCount * length, []() {}, [=]()
+                 {
+                     u64 sum = 0;
+                     for (u32 v = 0; v < vectorCount; v++)
+                     {
+                         std::vector<u32> vec;
+                         for (u32 i = 0; i < length; i++)
+                         {
+                             vec.push_back(v + i);
+                         }
+                         for (u32 value : vec)
+                         {
+                             sum += value;
+                         }
+                     }
+                     benchKeep(sum);
+                     return (u64)vectorCount * length;
+                 });
+    }
+}
+
+int main(int argc, char** argv)
+{
+    benchParseArgs(argc, argv);
+
+    registry = (BenchRegistry*)calloc(1, sizeof(BenchRegistry));
+    if (!registry)
+    {
+        fprintf(stderr, "could not allocate %llu bytes for the registry\n", (unsigned long long)sizeof(BenchRegistry));
+        return EXIT_FAILURE;
+    }
+
+    benchLifetime();
+    benchLookups();
+    benchJoins();
+    benchLocality();
+    benchHashMaps();
+    benchSmallVectors();
+
+    benchFinish();
+    free(registry);
+    return 0;
+}
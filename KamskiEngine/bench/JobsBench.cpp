@@ -0,0 +1,246 @@
+// Scheduler benchmark for the job system (engine/KamskiJobs.cpp), runs headless.
+// Reports empty job throughput, dependency chains, parallelFor against a serial loop over the same work,
+// and p50 / p99 latency from submitJob until a worker starts the job.
+// For the fibers it reports the raw switch cost, a runOnFiber round trip and a job tree where every
+// inner job waits on its children.
+//
+// Build and run from KamskiEngine/bench:
+//     g++ -O2 -std=c++20 -pthread JobsBench.cpp -o JobsBench && ./JobsBench [--json] [--reps N]
+//     cl /O2 /std:c++20 /EHsc JobsBench.cpp
+//
+// Latencies are timed with steady_clock on both threads, the main thread spins on the counter meanwhile.
+
+#define KAMSKI_ENGINE
+
+#include "../engine/KamskiJobs.cpp"
+#include "KamskiBench.h"
+#include <cmath>
+#include <vector>
+
+inline constexpr u32 EMPTY_JOB_COUNT = 1 << 20;
+inline constexpr u32 CHAIN_LENGTH = 1 << 14;
+inline constexpr u32 ITEM_COUNT = 1 << 22;
+inline constexpr u32 LATENCY_SAMPLE_COUNT = 20000;
+inline constexpr u32 SWITCH_COUNT = 1 << 20;
+inline constexpr u32 ROUND_TRIP_COUNT = 1 << 16;
+inline constexpr u32 TREE_BRANCHING = 8;
+inline constexpr u32 TREE_DEPTH = 4;
+// Every level of the tree, leaves included
+inline constexpr u32 TREE_JOB_COUNT = 1 + 8 + 8 * 8 + 8 * 8 * 8 + 8 * 8 * 8 * 8;
+static_assert(TREE_BRANCHING == 8 && TREE_DEPTH == 4, "update TREE_JOB_COUNT");
+
+static void emptyJob(void* data)
+{
+    benchKeep(data);
+}
+
+// Submits in waves so the job pool never wraps onto jobs that are still queued
+static u64 benchEmptyJobs()
+{
+    JobCounter counter = {};
+    for (u32 submitted = 0; submitted != EMPTY_JOB_COUNT; submitted += KAMSKI_JOB_POOL_SIZE)
+    {
+        for (u32 i = 0; i != KAMSKI_JOB_POOL_SIZE; i++)
+        {
+            submitJob(emptyJob, nullptr, &counter);
+        }
+        waitCounter(&counter);
+    }
+    return EMPTY_JOB_COUNT;
+}
+
+// Every link waits on the previous one through submitJobAfter, so the chain is fully serial
+static u64 benchChain()
+{
+    static JobCounter counters[KAMSKI_JOB_POOL_SIZE / 2];
+    for (u32 done = 0; done != CHAIN_LENGTH; done += ARRAY_COUNT(counters))
+    {
+        for (JobCounter& counter : counters)
+        {
+            counter.value.store(0, std::memory_order_relaxed);
+        }
+        submitJob(emptyJob, nullptr, &counters[0]);
+        for (u32 i = 1; i != ARRAY_COUNT(counters); i++)
+        {
+            submitJobAfter(&counters[i - 1], emptyJob, nullptr, &counters[i]);
+        }
+        waitCounter(&counters[ARRAY_COUNT(counters) - 1]);
+    }
+    return CHAIN_LENGTH;
+}
+
+struct ParticleItems
+{
+    f32* positions;
+    f32* velocities;
+};
+
+// Stand-in for a particle step, a few flops per item so the loop is not purely bandwidth bound
+static void stepItems(void* data, u32 begin, u32 end)
+{
+    ParticleItems* items = (ParticleItems*)data;
+    for (u32 i = begin; i != end; i++)
+    {
+        f32 velocity = items->velocities[i];
+        velocity = velocity * 0.99f + std::sin(items->positions[i]) * 0.01f;
+        items->velocities[i] = velocity;
+        items->positions[i] += velocity * (1.0f / 60.0f);
+    }
+}
+
+struct LatencySample
+{
+    f64 submitTime;
+    f64 startTime;
+};
+
+static void stampJob(void* data)
+{
+    ((LatencySample*)data)->startTime = benchNow();
+}
+
+static f64 percentile(std::vector<f64>& samples, f64 fraction)
+{
+    const u64 index = (u64)(fraction * (f64)(samples.size() - 1));
+    std::nth_element(samples.begin(), samples.begin() + index, samples.end());
+    return samples[index];
+}
+
+// One job at a time so the worker that picks it up may be asleep, spinning or busy stealing
+static void benchLatency()
+{
+    std::vector<f64> samples;
+    samples.reserve(LATENCY_SAMPLE_COUNT);
+    for (u32 i = 0; i != LATENCY_SAMPLE_COUNT; i++)
+    {
+        LatencySample sample = {};
+        JobCounter counter = {};
+        // Pushed to the own deque and stolen, waitCounter is not used since it would run the job itself
+        sample.submitTime = benchNow();
+        submitJob(stampJob, &sample, &counter);
+        while (!isCounterDone(&counter))
+        {
+            std::this_thread::yield();
+        }
+        samples.push_back(sample.startTime - sample.submitTime);
+    }
+
+    benchRecordLatency(benchName("submit to start p50, %u workers", getWorkerCount()), percentile(samples, 0.50) * 1e9);
+    benchRecordLatency(benchName("submit to start p99, %u workers", getWorkerCount()), percentile(samples, 0.99) * 1e9);
+}
+
+// ######## Fibers ########
+
+JobFiber switchBaseFiber;
+JobFiber switchFiber;
+
+static void pingPongEntry()
+{
+    for (;;)
+    {
+        platformSwitchFiber(&switchFiber, &switchBaseFiber);
+    }
+}
+
+// Two fibers switching back and forth without the scheduler, the floor under every park and resume
+static void benchFiberSwitch()
+{
+    platformConvertThreadToFiber(&switchBaseFiber);
+    platformCreateFiber(&switchFiber, pingPongEntry);
+    benchRun("fiber switch", SWITCH_COUNT * 2, []() {}, []()
+    {
+        for (u32 i = 0; i != SWITCH_COUNT; i++)
+        {
+            platformSwitchFiber(&switchBaseFiber, &switchFiber);
+        }
+        return (u64)SWITCH_COUNT * 2;
+    });
+    platformDestroyFiber(&switchFiber);
+    platformConvertFiberToThread();
+}
+
+// The path the game callbacks take every frame: park the base fiber, run on a pool fiber, switch back
+static u64 benchRoundTrips()
+{
+    for (u32 i = 0; i != ROUND_TRIP_COUNT; i++)
+    {
+        runOnFiber(emptyJob, nullptr);
+    }
+    return ROUND_TRIP_COUNT;
+}
+
+static void treeJob(void* data)
+{
+    const u64 depth = (u64)data;
+    if (depth == 0)
+    {
+        return;
+    }
+    JobCounter counter = {};
+    for (u32 i = 0; i != TREE_BRANCHING; i++)
+    {
+        submitJob(treeJob, (void*)(depth - 1), &counter);
+    }
+    waitCounter(&counter);
+}
+
+static u64 benchNestedWaits()
+{
+    JobCounter counter = {};
+    submitJob(treeJob, (void*)(u64)TREE_DEPTH, &counter);
+    waitCounter(&counter);
+    return TREE_JOB_COUNT;
+}
+
+int main(int argc, char** argv)
+{
+    benchParseArgs(argc, argv);
+
+    std::vector<f32> positions(ITEM_COUNT);
+    std::vector<f32> velocities(ITEM_COUNT);
+    ParticleItems items = {positions.data(), velocities.data()};
+    auto resetItems = [&]()
+    {
+        for (u32 i = 0; i != ITEM_COUNT; i++)
+        {
+            positions[i] = (f32)i;
+            velocities[i] = 1.0f;
+        }
+    };
+
+    benchRun("parallelFor step, serial", ITEM_COUNT, resetItems, [&]()
+    {
+        stepItems(&items, 0, ITEM_COUNT);
+        benchKeep(positions[ITEM_COUNT - 1]);
+        return (u64)ITEM_COUNT;
+    });
+    benchFiberSwitch();
+
+    u32 workerCounts[] = {1, 3, KAMSKI_MAX_THREAD_COUNT - 1};
+    for (u32 workerCount : workerCounts)
+    {
+        initJobSystem(workerCount, nullptr);
+        if (getWorkerCount() != workerCount)
+        {
+            shutdownJobSystem();
+            continue;
+        }
+
+        benchRun(benchName("empty jobs, %u workers", workerCount), EMPTY_JOB_COUNT, []() {}, benchEmptyJobs);
+        benchRun(benchName("dependency chain, %u workers", workerCount), CHAIN_LENGTH, []() {}, benchChain);
+        benchRun(benchName("parallelFor step, %u workers", workerCount), ITEM_COUNT, resetItems, [&]()
+        {
+            parallelFor(ITEM_COUNT, 4096, stepItems, &items);
+            benchKeep(positions[ITEM_COUNT - 1]);
+            return (u64)ITEM_COUNT;
+        });
+        benchLatency();
+        benchRun(benchName("runOnFiber round trip, %u workers", workerCount), ROUND_TRIP_COUNT, []() {}, benchRoundTrips);
+        benchRun(benchName("nested waits, %u workers", workerCount), TREE_JOB_COUNT, []() {}, benchNestedWaits);
+
+        shutdownJobSystem();
+    }
+
+    benchFinish();
+    return 0;
+}
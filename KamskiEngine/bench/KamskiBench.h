@@ -0,0 +1,286 @@
+#pragma once
+// Minimal harness shared by the standalone benchmarks in this folder.
+// Each benchmark is a single translation unit, see the build line at the top of each one.
+
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <chrono>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+struct BenchResult
+{
+    const char* name;
+    // Operations timed, ns/op is reported per operation
+    uint64_t ops;
+    // Entities (or elements) touched, entities/sec is reported per entity
+    uint64_t entities;
+    double seconds;
+    // -1 when the counter is not available
+    int64_t cacheMisses;
+    int64_t l1Misses;
+    int64_t tlbMisses;
+};
+
+#ifndef KAMSKI_BENCH_MAX_RESULTS
+#define KAMSKI_BENCH_MAX_RESULTS 256
+#endif
+
+struct BenchState
+{
+    bool json;
+    uint32_t repetitions;
+    uint32_t resultCount;
+    BenchResult results[KAMSKI_BENCH_MAX_RESULTS];
+};
+
+inline BenchState benchState = { false, 5, 0, {} };
+
+inline void benchParseArgs(int argc, char** argv)
+{
+    for (int i = 1; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "--json"))
+        {
+            benchState.json = true;
+        }
+        else if (!strcmp(argv[i], "--reps") && i + 1 < argc)
+        {
+            benchState.repetitions = (uint32_t)atoi(argv[++i]);
+        }
+        else
+        {
+            fprintf(stderr, "usage: %s [--json] [--reps N]\n", argv[0]);
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (benchState.repetitions == 0)
+    {
+        benchState.repetitions = 1;
+    }
+}
+
+inline double benchNow()
+{
+    using namespace std::chrono;
+    return duration<double>(steady_clock::now().time_since_epoch()).count();
+}
+
+// Keeps the optimizer from deleting work whose result is otherwise unused
+template<typename T>
+inline void benchKeep(const T& value)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    asm volatile("" : : "r,m"(value) : "memory");
+#else
+    static volatile const void* sink;
+    sink = &value;
+#endif
+}
+
+class PerfCounter
+{
+public:
+#ifdef __linux__
+    PerfCounter(uint32_t type, uint64_t config)
+    {
+        perf_event_attr attr = {};
+        attr.type = type;
+        attr.size = sizeof(attr);
+        attr.config = config;
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        fd = (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+    }
+
+    ~PerfCounter()
+    {
+        if (fd >= 0)
+        {
+            close(fd);
+        }
+    }
+
+    void start()
+    {
+        if (fd >= 0)
+        {
+            ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+            ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+        }
+    }
+
+    int64_t stop()
+    {
+        if (fd < 0)
+        {
+            return -1;
+        }
+        ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+        int64_t count = 0;
+        if (read(fd, &count, sizeof(count)) != sizeof(count))
+        {
+            return -1;
+        }
+        return count;
+    }
+
+private:
+    int fd;
+#else
+    PerfCounter(uint32_t, uint64_t)
+    {
+    }
+
+    void start()
+    {
+    }
+
+    int64_t stop()
+    {
+        return -1;
+    }
+#endif
+};
+
+struct BenchCounters
+{
+#ifdef __linux__
+    PerfCounter cache{PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES};
+    PerfCounter l1{PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)};
+    PerfCounter tlb{PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)};
+#else
+    PerfCounter cache{0, 0};
+    PerfCounter l1{0, 0};
+    PerfCounter tlb{0, 0};
+#endif
+};
+
+// printf-style name for results whose label is built at runtime, kept alive until exit
+inline const char* benchName(const char* format, ...)
+{
+    static char pool[KAMSKI_BENCH_MAX_RESULTS * 64];
+    static uint32_t used = 0;
+
+    char* name = pool + used;
+    va_list args;
+    va_start(args, format);
+    const int length = vsnprintf(name, sizeof(pool) - used, format, args);
+    va_end(args);
+    used += length > 0 ? (uint32_t)length + 1 : 0;
+    if (used > sizeof(pool))
+    {
+        used = sizeof(pool);
+    }
+    return name;
+}
+
+inline void benchRecord(const BenchResult& result)
+{
+    if (benchState.resultCount == KAMSKI_BENCH_MAX_RESULTS)
+    {
+        fprintf(stderr, "too many benchmark results, raise KAMSKI_BENCH_MAX_RESULTS\n");
+        exit(EXIT_FAILURE);
+    }
+    benchState.results[benchState.resultCount++] = result;
+
+    if (!benchState.json)
+    {
+        const double nsPerOp = result.seconds * 1e9 / (double)(result.ops ? result.ops : 1);
+        const double entitiesPerSec = (double)result.entities / (result.seconds > 0.0 ? result.seconds : 1e-12);
+        printf("%-48s %12.2f ns/op %14.0f entities/s", result.name, nsPerOp, entitiesPerSec);
+        if (result.cacheMisses >= 0)
+        {
+            printf("  %10lld cache-miss", (long long)result.cacheMisses);
+        }
+        if (result.l1Misses >= 0)
+        {
+            printf("  %10lld L1d-miss", (long long)result.l1Misses);
+        }
+        if (result.tlbMisses >= 0)
+        {
+            printf("  %10lld dTLB-miss", (long long)result.tlbMisses);
+        }
+        printf("\n");
+    }
+}
+
+// Runs setup + body [repetitions] times and keeps the fastest body run.
+// setup() is untimed, body() returns the number of operations it did. An [entitiesPerRun] of 0 reports
+// those operations per second, for bodies whose amount of work is only known once they ran
+template<typename Setup, typename Body>
+inline void benchRun(const char* name, uint64_t entitiesPerRun, Setup&& setup, Body&& body)
+{
+    BenchResult best = { name, 0, entitiesPerRun, 1e30, -1, -1, -1 };
+    BenchCounters counters;
+
+    for (uint32_t rep = 0; rep < benchState.repetitions; rep++)
+    {
+        setup();
+
+        counters.cache.start();
+        counters.l1.start();
+        counters.tlb.start();
+        const double begin = benchNow();
+        const uint64_t ops = body();
+        const double seconds = benchNow() - begin;
+        const int64_t tlbMisses = counters.tlb.stop();
+        const int64_t l1Misses = counters.l1.stop();
+        const int64_t cacheMisses = counters.cache.stop();
+
+        if (seconds < best.seconds)
+        {
+            best.seconds = seconds;
+            best.ops = ops;
+            best.entities = entitiesPerRun ? entitiesPerRun : ops;
+            best.cacheMisses = cacheMisses;
+            best.l1Misses = l1Misses;
+            best.tlbMisses = tlbMisses;
+        }
+    }
+
+    benchRecord(best);
+}
+
+// Records an already measured value, e.g. a latency percentile. [nanoseconds] is reported as ns/op.
+inline void benchRecordLatency(const char* name, double nanoseconds)
+{
+    benchRecord({ name, 1, 1, nanoseconds * 1e-9, -1, -1, -1 });
+}
+
+inline void benchFinish()
+{
+    if (!benchState.json)
+    {
+        return;
+    }
+
+    printf("[\n");
+    for (uint32_t i = 0; i < benchState.resultCount; i++)
+    {
+        const BenchResult& result = benchState.results[i];
+        const double nsPerOp = result.seconds * 1e9 / (double)(result.ops ? result.ops : 1);
+        const double entitiesPerSec = (double)result.entities / (result.seconds > 0.0 ? result.seconds : 1e-12);
+        printf("  {\"name\": \"%s\", \"ops\": %llu, \"seconds\": %.9f, \"ns_per_op\": %.3f, \"entities_per_sec\": %.1f, "
+               "\"cache_misses\": %lld, \"l1d_misses\": %lld, \"dtlb_misses\": %lld}%s\n",
+               result.name,
+               (unsigned long long)result.ops,
+               result.seconds,
+               nsPerOp,
+               entitiesPerSec,
+               (long long)result.cacheMisses,
+               (long long)result.l1Misses,
+               (long long)result.tlbMisses,
+               i + 1 == benchState.resultCount ? "" : ",");
+    }
+    printf("]\n");
+}
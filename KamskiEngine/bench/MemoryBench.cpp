@@ -0,0 +1,462 @@
+// Allocation churn benchmark for GeneralAllocator (engine/KamskiMemory.cpp) against the chunk array
+// allocator it replaced, and for SlabAllocator against both on tiny allocations.
+// Reports throughput and p50 / p99 alloc and free latency, then random read cost and dTLB misses
+// with 4 KB against 2 MB pages (the KAMSKI_LARGE_PAGES option).
+//
+// Build and run from KamskiEngine/bench:
+//     g++ -O2 -std=c++20 MemoryBench.cpp -o MemoryBench && ./MemoryBench [--json] [--reps N]
+//     cl /O2 /std:c++20 /EHsc MemoryBench.cpp
+//
+// Latencies are single operations timed with steady_clock, the "timer overhead" row is the cost
+// of an empty measurement and is included in every percentile.
+
+// Engine side build so the allocator internals are visible
+#define KAMSKI_ENGINE
+
+#include "../engine/KamskiMemory.cpp"
+#include "KamskiBench.h"
+#include <new>
+#include <algorithm>
+#include <vector>
+
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
+
+// The allocator GeneralAllocator used to be: a sorted chunk array scanned linearly on alloc and free,
+// capped at 1024 chunks. Kept verbatim (minus logging) as the baseline.
+class ChunkAllocator
+{
+    public:
+    static constexpr u64 CHUNKS_MAX = 1024;
+
+    ChunkAllocator(u64 capacity):
+    capacity(capacity),
+    lastChunkIndex(0),
+    chunkCount(1)
+    {
+        chunks[0].size = capacity;
+        chunks[0].address = bytes;
+        chunks[0].isOccupied = false;
+    }
+
+    void splitChunk(const u64 index, const u64 size)
+    {
+        for (u64 i = chunkCount; i > index + 1; i--)
+        {
+            chunks[i] = chunks[i - 1];
+        }
+
+        chunks[index + 1].address = (u8*)chunks[index].address + size;
+        chunks[index + 1].size = chunks[index].size - size;
+        chunks[index + 1].isOccupied = false;
+        chunks[index].size = size;
+        chunkCount++;
+    }
+
+    void* alloc(u64 allocSize, u8 alignment = 8)
+    {
+        void* retval = nullptr;
+        for (u64 index = 0; index != chunkCount; index++)
+        {
+            const u64 i = (lastChunkIndex + index) % chunkCount;
+            const u64 alignmentDistance = (alignment - ((u64)chunks[i].address % alignment)) % alignment;
+            const u64 size = allocSize + alignmentDistance;
+
+            if (chunks[i].size >= size && !chunks[i].isOccupied)
+            {
+                retval = (u8*)chunks[i].address + alignmentDistance;
+
+                if (chunks[i].size != size)
+                {
+                    if (chunkCount == CHUNKS_MAX)
+                    {
+                        fprintf(stderr, "chunk allocator ran out of chunks\n");
+                        exit(EXIT_FAILURE);
+                    }
+                    lastChunkIndex = i + 1;
+                    splitChunk(i, size);
+                }
+                else
+                {
+                    lastChunkIndex = i;
+                }
+                chunks[i].isOccupied = true;
+                break;
+            }
+        }
+        return retval;
+    }
+
+    void free(void* ptr)
+    {
+        if (!ptr)
+            return;
+        for (u64 i = 0; i < chunkCount; i++)
+        {
+            if (chunks[i].address == ptr)
+            {
+                chunks[i].isOccupied = false;
+
+                if (i != 0 && !chunks[i - 1].isOccupied)
+                {
+                    if (i != chunkCount - 1 && !chunks[i + 1].isOccupied)
+                    {
+                        chunks[i-1].size += chunks[i].size + chunks[i+1].size;
+                        for (u64 j = i; j < chunkCount - 2; j++)
+                        {
+                            chunks[j] = chunks[j + 2];
+                        }
+                        chunkCount -= 2;
+                    } else
+                    {
+                        chunks[i-1].size += chunks[i].size;
+                        for (u64 j = i; j < chunkCount - 1; j++)
+                        {
+                            chunks[j] = chunks[j + 1];
+                        }
+                        chunkCount--;
+                    }
+                    lastChunkIndex = i-1;
+                } else if (i < chunkCount - 2 && !chunks[i + 1].isOccupied)
+                {
+                    chunks[i].size += chunks[i + 1].size;
+                    for (u64 j = i + 1; j < chunkCount - 1; j++)
+                    {
+                        chunks[j] = chunks[j + 1];
+                    }
+                    chunkCount--;
+                    lastChunkIndex = i;
+                }
+                break;
+            }
+        }
+    }
+
+    struct MemoryChunk
+    {
+        void* address;
+        u64 size;
+        bool isOccupied;
+    };
+
+    u64 capacity;
+    u64 lastChunkIndex;
+    u64 chunkCount;
+    MemoryChunk chunks[CHUNKS_MAX];
+    u8 bytes[];
+};
+
+inline constexpr u64 BENCH_POOL_SIZE = MB(256);
+inline constexpr u32 BENCH_OP_COUNT = 200000;
+
+// Frees whatever lives in [slot] or allocates [size] bytes into it
+struct ChurnOp
+{
+    u32 slot;
+    u32 size;
+};
+
+struct ChurnWorkload
+{
+    const char* name;
+    u32 liveSlots;
+    std::vector<ChurnOp> ops;
+};
+
+static u64 randomState = 0x853c49e6748fea9bull;
+
+static u64 nextRandom()
+{
+    // splitmix64
+    u64 z = (randomState += 0x9E3779B97F4A7C15ull);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+}
+
+// Log-uniform sizes in [minSize, maxSize), so small requests dominate like they do in the game
+static ChurnWorkload makeWorkload(const char* name, u32 liveSlots, u32 minSize, u32 maxSize)
+{
+    ChurnWorkload workload = { name, liveSlots, {} };
+    workload.ops.resize(BENCH_OP_COUNT);
+
+    const u32 minLog = highestSetBit(minSize);
+    const u32 maxLog = highestSetBit(maxSize);
+    for (ChurnOp& op : workload.ops)
+    {
+        op.slot = (u32)(nextRandom() % liveSlots);
+        const u32 log = minLog + (u32)(nextRandom() % (maxLog - minLog));
+        // Multiples of 8: the chunk allocator returns a padded pointer for anything else and then never finds it on free
+        op.size = ((1u << log) + (u32)(nextRandom() % (1u << log)) + 7) & ~7u;
+    }
+    return workload;
+}
+
+template<typename Allocator>
+static Allocator* resetAllocator(void* memory)
+{
+    return new (memory) Allocator(BENCH_POOL_SIZE - sizeof(Allocator));
+}
+
+template<typename Allocator>
+static u64 runChurn(Allocator* allocator, const ChurnWorkload& workload, std::vector<void*>& slots)
+{
+    std::fill(slots.begin(), slots.end(), nullptr);
+    for (const ChurnOp& op : workload.ops)
+    {
+        void*& slot = slots[op.slot];
+        if (slot)
+        {
+            allocator->free(slot);
+            slot = nullptr;
+        }
+        else
+        {
+            slot = allocator->alloc(op.size);
+            if (!slot)
+            {
+                fprintf(stderr, "%s ran out of memory\n", workload.name);
+                exit(EXIT_FAILURE);
+            }
+            *(volatile u8*)slot = 1;
+        }
+    }
+    return workload.ops.size();
+}
+
+static f64 percentile(std::vector<f64>& samples, f64 fraction)
+{
+    const u64 index = (u64)(fraction * (f64)(samples.size() - 1));
+    std::nth_element(samples.begin(), samples.begin() + index, samples.end());
+    return samples[index];
+}
+
+template<typename Allocator>
+static void benchChurn(const char* allocatorName, void* memory, const ChurnWorkload& workload)
+{
+    std::vector<void*> slots(workload.liveSlots);
+
+    benchRun(benchName("%s churn, %s", allocatorName, workload.name), workload.ops.size(),
+             [&]() {},
+             [&]()
+             {
+                 return runChurn(resetAllocator<Allocator>(memory), workload, slots);
+             });
+
+    std::vector<f64> allocSamples;
+    std::vector<f64> freeSamples;
+    allocSamples.reserve(workload.ops.size());
+    freeSamples.reserve(workload.ops.size());
+
+    Allocator* allocator = resetAllocator<Allocator>(memory);
+    std::fill(slots.begin(), slots.end(), nullptr);
+    for (const ChurnOp& op : workload.ops)
+    {
+        void*& slot = slots[op.slot];
+        if (slot)
+        {
+            const f64 begin = benchNow();
+            allocator->free(slot);
+            freeSamples.push_back(benchNow() - begin);
+            slot = nullptr;
+        }
+        else
+        {
+            const f64 begin = benchNow();
+            slot = allocator->alloc(op.size);
+            allocSamples.push_back(benchNow() - begin);
+            benchKeep(slot);
+        }
+    }
+
+    benchRecordLatency(benchName("%s alloc p50, %s", allocatorName, workload.name), percentile(allocSamples, 0.50) * 1e9);
+    benchRecordLatency(benchName("%s alloc p99, %s", allocatorName, workload.name), percentile(allocSamples, 0.99) * 1e9);
+    benchRecordLatency(benchName("%s free p50, %s", allocatorName, workload.name), percentile(freeSamples, 0.50) * 1e9);
+    benchRecordLatency(benchName("%s free p99, %s", allocatorName, workload.name), percentile(freeSamples, 0.99) * 1e9);
+}
+
+// ######## Page sizes ########
+
+// Random reads over a region much larger than the TLB reach of 4 KB pages (1536 entries * 4 KB = 6 MB on
+// a typical L2 TLB), once per page kind. Kinds the machine can not provide are skipped.
+inline constexpr u64 PAGE_BENCH_REGION_SIZE = MB(512);
+inline constexpr u64 PAGE_BENCH_HUGE_PAGE_SIZE = MB(2);
+inline constexpr u32 PAGE_BENCH_READ_COUNT = 1 << 24;
+
+enum class PageKind
+{
+    Regular,
+    // Linux transparent huge pages (madvise), the kernel may still hand out 4 KB pages
+    Transparent,
+    // MAP_HUGETLB on Linux, MEM_LARGE_PAGES on Windows
+    Huge,
+};
+
+#ifdef _WIN32
+static bool enableLockMemoryPrivilege()
+{
+    HANDLE token;
+    if (!OpenProcessToken(GetCurrentProcess(), TOKEN_ADJUST_PRIVILEGES | TOKEN_QUERY, &token))
+    {
+        return false;
+    }
+    TOKEN_PRIVILEGES privileges = {};
+    privileges.PrivilegeCount = 1;
+    privileges.Privileges[0].Attributes = SE_PRIVILEGE_ENABLED;
+    const bool enabled = LookupPrivilegeValueA(nullptr, "SeLockMemoryPrivilege", &privileges.Privileges[0].Luid) &&
+                         AdjustTokenPrivileges(token, FALSE, &privileges, 0, nullptr, nullptr) &&
+                         GetLastError() == ERROR_SUCCESS;
+    CloseHandle(token);
+    return enabled;
+}
+#endif
+
+static void* mapRegion(PageKind kind)
+{
+#if defined(_WIN32)
+    switch (kind)
+    {
+        case PageKind::Regular:
+            return VirtualAlloc(nullptr, PAGE_BENCH_REGION_SIZE, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+        case PageKind::Huge:
+            return enableLockMemoryPrivilege() ? VirtualAlloc(nullptr, PAGE_BENCH_REGION_SIZE, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE) : nullptr;
+        default:
+            return nullptr;
+    }
+#elif defined(__linux__)
+    switch (kind)
+    {
+        case PageKind::Regular:
+        {
+            void* region = mmap(nullptr, PAGE_BENCH_REGION_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (region == MAP_FAILED)
+            {
+                return nullptr;
+            }
+            madvise(region, PAGE_BENCH_REGION_SIZE, MADV_NOHUGEPAGE);
+            return region;
+        }
+        case PageKind::Transparent:
+        {
+            // Over-map so the region can start on a huge page boundary, the slack is never touched
+            u8* region = (u8*)mmap(nullptr, PAGE_BENCH_REGION_SIZE + PAGE_BENCH_HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (region == MAP_FAILED)
+            {
+                return nullptr;
+            }
+            u8* aligned = (u8*)(((u64)region + PAGE_BENCH_HUGE_PAGE_SIZE - 1) & ~(PAGE_BENCH_HUGE_PAGE_SIZE - 1));
+            return madvise(aligned, PAGE_BENCH_REGION_SIZE, MADV_HUGEPAGE) == 0 ? aligned : nullptr;
+        }
+        case PageKind::Huge:
+        {
+            void* region = mmap(nullptr, PAGE_BENCH_REGION_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+            return region == MAP_FAILED ? nullptr : region;
+        }
+    }
+    return nullptr;
+#else
+    return kind == PageKind::Regular ? malloc(PAGE_BENCH_REGION_SIZE) : nullptr;
+#endif
+}
+
+// The Linux regions are left mapped, the process exits right after the benchmark
+static void unmapRegion(void* region)
+{
+#if defined(_WIN32)
+    VirtualFree(region, 0, MEM_RELEASE);
+#elif !defined(__linux__)
+    free(region);
+#else
+    (void)region;
+#endif
+}
+
+static void benchPageKind(const char* name, PageKind kind)
+{
+    u64* region = (u64*)mapRegion(kind);
+    if (!region)
+    {
+        if (!benchState.json)
+        {
+            printf("%-48s skipped, not available\n", name);
+        }
+        return;
+    }
+
+    const u64 count = PAGE_BENCH_REGION_SIZE / sizeof(u64);
+    for (u64 i = 0; i < count; i++)
+    {
+        region[i] = i;
+    }
+
+    benchRun(name, PAGE_BENCH_READ_COUNT, []() {}, [region, count]()
+             {
+                 u64 sum = 0;
+                 u64 state = 0x9E3779B97F4A7C15ull;
+                 for (u32 i = 0; i < PAGE_BENCH_READ_COUNT; i++)
+                 {
+                     state = state * 6364136223846793005ull + 1442695040888963407ull;
+                     sum += region[(state >> 20) & (count - 1)];
+                 }
+                 benchKeep(sum);
+                 return (u64)PAGE_BENCH_READ_COUNT;
+             });
+
+    unmapRegion(region);
+}
+
+static void benchPageSizes()
+{
+    benchPageKind("random reads, 4 KB pages", PageKind::Regular);
+#ifdef __linux__
+    benchPageKind("random reads, transparent huge pages", PageKind::Transparent);
+#endif
+    benchPageKind("random reads, 2 MB pages", PageKind::Huge);
+}
+
+static void benchTimerOverhead()
+{
+    std::vector<f64> samples(BENCH_OP_COUNT);
+    for (f64& sample : samples)
+    {
+        const f64 begin = benchNow();
+        sample = benchNow() - begin;
+    }
+    benchRecordLatency("timer overhead p50", percentile(samples, 0.50) * 1e9);
+}
+
+int main(int argc, char** argv)
+{
+    benchParseArgs(argc, argv);
+
+    void* memory = malloc(BENCH_POOL_SIZE);
+    if (!memory)
+    {
+        fprintf(stderr, "could not allocate %llu bytes for the pool\n", (unsigned long long)BENCH_POOL_SIZE);
+        return EXIT_FAILURE;
+    }
+
+    benchTimerOverhead();
+
+    // The chunk allocator needs about two chunks per live allocation, so its workloads keep 200 live slots
+    const ChurnWorkload small = makeWorkload("16B-256B x200 live", 200, 16, 256);
+    const ChurnWorkload mixed = makeWorkload("16B-64KB x200 live", 200, 16, KB(64));
+    const ChurnWorkload large = makeWorkload("16B-4KB x50000 live", 50000, 16, KB(4));
+    const ChurnWorkload tiny = makeWorkload("16B-256B x50000 live", 50000, 16, 256);
+
+    benchChurn<ChunkAllocator>("chunk array", memory, small);
+    benchChurn<GeneralAllocator>("TLSF", memory, small);
+    benchChurn<ChunkAllocator>("chunk array", memory, mixed);
+    benchChurn<GeneralAllocator>("TLSF", memory, mixed);
+    benchChurn<GeneralAllocator>("TLSF", memory, tiny);
+    benchChurn<GeneralAllocator>("TLSF", memory, large);
+    benchChurn<SlabAllocator>("slab", memory, small);
+    benchChurn<SlabAllocator>("slab", memory, tiny);
+
+    benchPageSizes();
+
+    benchFinish();
+    free(memory);
+    return 0;
+}
@@ -0,0 +1,164 @@
+// Quad vertex generation benchmark for writeQuadVertices (engine/KamskiQuads.cpp), the kernel behind the UI quads.
+// Reports quads/sec for unrotated and rotated quads against the per corner rotateVec2 and worldPosToOpenGLPos
+// path it replaced, which is kept below as the baseline together with the 40 byte vertex it wrote.
+//
+// Build and run from KamskiEngine/bench:
+//     g++ -O2 -std=c++20 QuadsBench.cpp -o QuadsBench && ./QuadsBench [--json] [--reps N]
+//     cl /O2 /std:c++20 /EHsc QuadsBench.cpp
+// Adding -U__SSE2__ to the g++ line measures the scalar fallback instead.
+//
+// The "entities/s" column is quads per second, a quad is 80 bytes written (160 for the baseline).
+
+#define KAMSKI_ENGINE
+
+#include "../engine/KamskiQuads.cpp"
+#include "KamskiBench.h"
+#include <vector>
+
+inline constexpr u32 QUAD_COUNT = 1 << 16;
+inline constexpr f32 ASPECT_RATIO = 16.0f / 9.0f;
+
+struct QuadInput
+{
+    glm::vec2 position;
+    glm::vec2 size;
+    f32 rotation;
+};
+
+// ######## Baseline ########
+
+struct VertexBaseline
+{
+    glm::vec3 position;
+    glm::vec4 color;
+    glm::vec2 texture;
+    f32 texIndex;
+};
+
+static glm::vec2 rotateVec2Baseline(const glm::vec2 v, f32 radians)
+{
+    glm::vec2 retval;
+    const f32 cosVal = cosf(radians);
+    const f32 sinVal = sinf(radians);
+
+    retval.x = v.x * cosVal - v.y * sinVal;
+    retval.y = v.x * sinVal + v.y * cosVal;
+
+    return retval;
+}
+
+static void worldPosToOpenGLPosBaseline(f32& x, f32& y)
+{
+    const f32 screenWorldSizeY = SCREEN_SIZE_WORLD_COORDS;
+    const f32 screenWorldSizeX = screenWorldSizeY * ASPECT_RATIO;
+
+    x /= screenWorldSizeX;
+    y /= screenWorldSizeY;
+}
+
+static void writeQuadVerticesBaseline(VertexBaseline* out, glm::vec2 position, glm::vec2 size, f32 rotation, const glm::vec4& color,
+                                      const glm::vec4& uvRect, f32 texIndex)
+{
+    glm::vec2 pos[4] = {glm::vec2{-size.x, -size.y} / 2.0f, glm::vec2{size.x, -size.y} / 2.0f,
+                        glm::vec2{size.x, size.y} / 2.0f, glm::vec2{-size.x, size.y} / 2.0f};
+    const glm::vec2 uvs[4] = {{uvRect.x, uvRect.y}, {uvRect.z, uvRect.y}, {uvRect.z, uvRect.w}, {uvRect.x, uvRect.w}};
+    for (u32 i = 0; i < 4; i++)
+    {
+        pos[i] = rotateVec2Baseline(pos[i], rotation) + position;
+        worldPosToOpenGLPosBaseline(pos[i].x, pos[i].y);
+        out[i].position = {pos[i], 0.0f};
+        out[i].texture = uvs[i];
+        out[i].color = color;
+        out[i].texIndex = texIndex;
+    }
+}
+
+// Both paths have to agree before their speed means anything
+static bool verify(const std::vector<QuadInput>& quads, glm::vec2 worldToClip)
+{
+    for (const QuadInput& quad : quads)
+    {
+        const glm::vec4 color = {0.1f, 0.2f, 0.3f, 0.4f};
+        const glm::vec4 uvRect = {0.25f, 0.5f, 0.75f, 1.0f};
+        VertexBaseline expected[4];
+        Vertex actual[4];
+        writeQuadVerticesBaseline(expected, quad.position, quad.size, quad.rotation, color, uvRect, 3.0f);
+        writeQuadVertices(actual, quad.position, quad.size, quad.rotation, packColor(color), packUVRect(uvRect), 3, worldToClip);
+        for (u32 i = 0; i < 4; i++)
+        {
+            const glm::vec2 delta = glm::abs(glm::vec2(expected[i].position) - actual[i].position);
+            if (delta.x > 1e-4f || delta.y > 1e-4f || packColor(expected[i].color) != actual[i].color ||
+                packUnorm16(expected[i].texture.x) != actual[i].uv[0] || packUnorm16(expected[i].texture.y) != actual[i].uv[1] ||
+                expected[i].texIndex != (f32)actual[i].texIndex)
+            {
+                fprintf(stderr, "vertex %u differs from the baseline\n", i);
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+int main(int argc, char** argv)
+{
+    benchParseArgs(argc, argv);
+
+    std::vector<QuadInput> flatQuads(QUAD_COUNT);
+    std::vector<QuadInput> rotatedQuads(QUAD_COUNT);
+    u32 seed = 1;
+    auto random = [&seed]()
+    {
+        seed = seed * 1664525u + 1013904223u;
+        return (f32)(seed >> 8) / (f32)(1 << 24);
+    };
+    for (u32 i = 0; i < QUAD_COUNT; i++)
+    {
+        flatQuads[i] = {{random() * 2000.0f - 1000.0f, random() * 2000.0f - 1000.0f}, {random() * 100.0f, random() * 100.0f}, 0.0f};
+        rotatedQuads[i] = flatQuads[i];
+        rotatedQuads[i].rotation = random() * 6.28f;
+    }
+
+    const glm::vec2 worldToClip = {1.0f / (SCREEN_SIZE_WORLD_COORDS * ASPECT_RATIO), 1.0f / SCREEN_SIZE_WORLD_COORDS};
+    if (!verify(flatQuads, worldToClip) || !verify(rotatedQuads, worldToClip))
+    {
+        return 1;
+    }
+
+    std::vector<VertexBaseline> baselineVertices(QUAD_COUNT * 4);
+    std::vector<Vertex> vertices(QUAD_COUNT * 4);
+    const glm::vec4 color = {1.0f, 1.0f, 1.0f, 1.0f};
+    const glm::vec4 uvRect = {0.0f, 0.0f, 1.0f, 1.0f};
+    auto runBaseline = [&](const std::vector<QuadInput>& quads)
+    {
+        for (u32 i = 0; i < QUAD_COUNT; i++)
+        {
+            writeQuadVerticesBaseline(&baselineVertices[i * 4], quads[i].position, quads[i].size, quads[i].rotation, color, uvRect,
+                                      1.0f);
+        }
+        benchKeep(baselineVertices[QUAD_COUNT * 4 - 1]);
+        return (u64)QUAD_COUNT;
+    };
+    // Packed once like the call sites do, UI colors are packed per call and atlas uvs when the texture is loaded
+    const u32 packedColor = packColor(color);
+    const PackedUVRect packedUVs = packUVRect(uvRect);
+    auto runKernel = [&](const std::vector<QuadInput>& quads)
+    {
+        for (u32 i = 0; i < QUAD_COUNT; i++)
+        {
+            writeQuadVertices(&vertices[i * 4], quads[i].position, quads[i].size, quads[i].rotation, packedColor, packedUVs, 1,
+                              worldToClip);
+        }
+        benchKeep(vertices[QUAD_COUNT * 4 - 1]);
+        return (u64)QUAD_COUNT;
+    };
+
+    benchRun("unrotated quads, baseline", QUAD_COUNT, []() {}, [&]() { return runBaseline(flatQuads); });
+    benchRun(benchName("unrotated quads, %s", KAMSKI_SSE2 ? "sse2" : "scalar"), QUAD_COUNT, []() {},
+             [&]() { return runKernel(flatQuads); });
+    benchRun("rotated quads, baseline", QUAD_COUNT, []() {}, [&]() { return runBaseline(rotatedQuads); });
+    benchRun(benchName("rotated quads, %s", KAMSKI_SSE2 ? "sse2" : "scalar"), QUAD_COUNT, []() {},
+             [&]() { return runKernel(rotatedQuads); });
+
+    benchFinish();
+    return 0;
+}
@@ -19,6 +19,24 @@ struct Game
     GameRenderFunc* render;
 };
 
+struct GameFiberCall
+{
+    Game* funcs;
+    f64 dt;
+};
+
+void gameUpdateFiber(void* data)
+{
+    GameFiberCall* call = (GameFiberCall*)data;
+    call->funcs->update(call->dt);
+}
+
+void gameRenderFiber(void* data)
+{
+    GameFiberCall* call = (GameFiberCall*)data;
+    call->funcs->render(call->dt);
+}
+
 LRESULT CALLBACK winProc(HWND window, UINT message, WPARAM wParam, LPARAM lParam)
 {
     switch (message)
@@ -64,6 +82,8 @@ void loadGameCode(const char* dllPath, HMODULE& gameLib, Game& gameFuncs)
 {
     if (gameLib)
     {
+        // Queued log records may still point at strings inside the old library
+        kamskiPlatformFlushLog();
         FreeLibrary(gameLib);
     }
 
@@ -121,6 +141,45 @@ void recordInput(RecordingState& recordingState, const PlayerInputInternal& inpu
     WriteFile(recordingState.fileHandle, &input, sizeof(input), &bytesWritten, 0);
 }
 
+// A snapshot is the committed granule bitmap followed by the contents of every committed granule
+void writeMemorySnapshot(RecordingState& recordingState)
+{
+    DWORD bytesWritten;
+    const u64 bitmapSize = (win32VirtualMemory.granuleCount + 63) / 64 * sizeof(LONG64);
+    WriteFile(recordingState.fileHandle, (const void*)win32VirtualMemory.committedGranules, (DWORD)bitmapSize, &bytesWritten, 0);
+
+    for (u64 granule = 0; granule < win32VirtualMemory.granuleCount; granule++)
+    {
+        if (isGranuleCommitted(granule))
+        {
+            WriteFile(recordingState.fileHandle, win32VirtualMemory.base + granule * KAMSKI_COMMIT_GRANULE, KAMSKI_COMMIT_GRANULE, &bytesWritten, 0);
+        }
+    }
+}
+
+// Granules the snapshot did not have are decommitted so they read back as zero like they did when it was taken
+void readMemorySnapshot(RecordingState& recordingState)
+{
+    DWORD bytesRead;
+    const u64 bitmapSize = (win32VirtualMemory.granuleCount + 63) / 64 * sizeof(LONG64);
+    LONG64* snapshotGranules = new LONG64[bitmapSize / sizeof(LONG64)];
+    ReadFile(recordingState.fileHandle, snapshotGranules, (DWORD)bitmapSize, &bytesRead, 0);
+
+    for (u64 granule = 0; granule < win32VirtualMemory.granuleCount; granule++)
+    {
+        if (snapshotGranules[granule / 64] & (1ll << (granule % 64)))
+        {
+            commitGranule(granule);
+            ReadFile(recordingState.fileHandle, win32VirtualMemory.base + granule * KAMSKI_COMMIT_GRANULE, KAMSKI_COMMIT_GRANULE, &bytesRead, 0);
+        }
+        else
+        {
+            decommitGranule(granule);
+        }
+    }
+    delete[] snapshotGranules;
+}
+
 bool playbackInput(RecordingState& recordingState, PlayerInputInternal& input)
 {
     bool retval = false;
@@ -144,9 +203,12 @@ void initAPI(API& api)
     api = {};
 
     api.kamskiLog = kamskiLog;
+    api.kamskiLogEvery = kamskiLogEvery;
     api.beginBatch = beginBatch;
     api.endBatch = endBatch;
     api.swapClear = swapClear;
+    api.getRendererUsage = getRendererUsage;
+    api.getRenderThreadStats = getRenderThreadStats;
     api.drawTexturedQuad = drawTexturedQuad ;
     api.drawColoredQuad = drawColoredQuad ;
     api.drawQuad = drawQuad;
@@ -156,16 +218,34 @@ void initAPI(API& api)
     api.addLight = addLight;
     api.addLightBlocker = addLightBlocker;
     api.loadTexture = loadTexture;
+    api.createTileMap = createTileMap;
+    api.destroyTileMap = destroyTileMap;
+    api.setTile = setTile;
+    api.drawTileMap = drawTileMap;
+    api.recordSpritesParallel = recordSpritesParallel;
     api.getScreenSize = getScreenSize;
     api.temporaryAlignedAlloc = temporaryAlloc;
     api.temporaryAlloc = temporaryAlloc;
+    api.getMemoryUsage = getMemoryUsage;
+    api.getMemorySummary = getMemorySummary;
+    api.setMemoryBudget = setMemoryBudget;
+    api.printMemorySummary = printMemorySummary;
+    api.getTemporaryArena = getTemporaryArena;
+    api.getTemporaryPeak = getTemporaryPeak;
     api.getPermanentMemory = getPermanentMemory;
     api.globalAlloc = globalAlloc;
     api.globalAlignedAlloc = globalAlignedAlloc;
     api.globalFree = globalFree;
+    api.slabAlloc = slabAlloc;
+    api.slabFree = slabFree;
     api.allocArena = allocArena;
     api.freeArena = freeArena;
     api.printGlobalAllocations = printGlobalAllocations;
+    api.getWorkerCount = getWorkerCount;
+    api.submitJob = submitJob;
+    api.submitJobAfter = submitJobAfter;
+    api.waitCounter = waitCounter;
+    api.parallelFor = parallelFor;
     api.readWholeFile = readWholeFile;
     api.writeFile = writeFile;
     api.getFileSize = getFileSize;
@@ -243,6 +323,7 @@ int CALLBACK WinMain(HINSTANCE instance,
     // Log Test
 #ifdef KAMSKI_DEBUG
     AllocConsole();
+    kamskiPlatformStartLogger();
 #endif
 
     memorySystemState.permanentEngineMemorySize = sizeof(PermanentEngineMemoryPartition) + KAMSKI_ANIMATION_ARENA_SIZE;
@@ -251,10 +332,9 @@ int CALLBACK WinMain(HINSTANCE instance,
     memorySystemState.transientMemorySize = GB(2);
     memorySystemState.totalSize = memorySystemState.permanentEngineMemorySize + memorySystemState.permanentMemorySize + memorySystemState.transientMemorySize;
 
-    memorySystemState.permanentEngineMemory = VirtualAlloc(KAMSKI_BASE_ADDRESS,
-                                                           memorySystemState.permanentEngineMemorySize + memorySystemState.permanentMemorySize + memorySystemState.transientMemorySize,
-                                                           MEM_COMMIT | MEM_RESERVE,
-                                                           PAGE_READWRITE);
+    // Everything is reserved, only the permanent partitions are committed up front since they are touched directly
+    memorySystemState.permanentEngineMemory = kamskiPlatformReserveMemory(KAMSKI_BASE_ADDRESS, memorySystemState.totalSize, KAMSKI_LARGE_PAGES);
+    kamskiPlatformCommitMemory(memorySystemState.permanentEngineMemory, memorySystemState.permanentEngineMemorySize + memorySystemState.permanentMemorySize);
 
     if (KAMSKI_BASE_ADDRESS && memorySystemState.permanentEngineMemory != KAMSKI_BASE_ADDRESS)
     {
@@ -272,8 +352,23 @@ int CALLBACK WinMain(HINSTANCE instance,
 
     memorySystemState.permanentMemory = (u8*)memorySystemState.permanentEngineMemory + memorySystemState.permanentEngineMemorySize;
     memorySystemState.transientMemory = ((u8*)memorySystemState.permanentMemory) + memorySystemState.permanentMemorySize;
-    memorySystemState.tempAlloc = new(memorySystemState.transientMemory) Arena(MB(128));
-    memorySystemState.globalAlloc = new (((u8*)memorySystemState.transientMemory) + MB(128) + sizeof(Arena)) GeneralAllocator(memorySystemState.transientMemorySize - MB(128) + sizeof(Arena));
+    // Transient memory is committed lazily: the allocators commit their own headers, everything else on use
+    kamskiPlatformCommitMemory(memorySystemState.transientMemory, sizeof(Arena));
+    memorySystemState.tempAllocs[0] = new(memorySystemState.transientMemory) Arena(KAMSKI_TEMP_ARENA_SIZE, kamskiPlatformCommitMemory);
+    u8* slabMemory = ((u8*)memorySystemState.transientMemory) + KAMSKI_TEMP_ARENA_SIZE + sizeof(Arena);
+    kamskiPlatformCommitMemory(slabMemory, sizeof(SlabAllocator));
+    memorySystemState.slabAlloc = new (slabMemory) SlabAllocator(KAMSKI_SLAB_REGION_SIZE, kamskiPlatformCommitMemory);
+    // The allocator writes a sentinel block at the very end of its capacity, so it must not overhang the reservation
+    const u64 generalOffset = KAMSKI_TEMP_ARENA_SIZE + sizeof(Arena) + sizeof(SlabAllocator) + KAMSKI_SLAB_REGION_SIZE;
+    u8* generalMemory = ((u8*)memorySystemState.transientMemory) + generalOffset;
+    kamskiPlatformCommitMemory(generalMemory, sizeof(GeneralAllocator));
+    memorySystemState.globalAlloc = new (generalMemory) GeneralAllocator(memorySystemState.transientMemorySize - generalOffset - sizeof(GeneralAllocator), kamskiPlatformCommitMemory);
+    for (u32 i = 1; i < KAMSKI_MAX_THREAD_COUNT; i++)
+    {
+        memorySystemState.tempAllocs[i] = allocArena(KAMSKI_WORKER_TEMP_ARENA_SIZE, MemoryTag::Engine);
+    }
+    // Workers allocate from their own frame arena, every job has to be waited on before resetTemporaryArenas
+    initJobSystem(0, setThreadIndex);
 
     void* gameState = memorySystemState.permanentMemory;
 
@@ -358,6 +453,8 @@ int CALLBACK WinMain(HINSTANCE instance,
     ShowCursor(false);
     ShowWindow(win32State->window, showWindow);
     initRenderer(win32State->window);
+    // The GL context moves to the render thread, the renderer API only records from here on
+    startRenderThread();
 
     gameFuncs.load(api);
     gameFuncs.init();
@@ -478,8 +575,8 @@ int CALLBACK WinMain(HINSTANCE instance,
                         if (recordingState.option == RecordingState::NONE)
                         {
                             startRecording(recordingState);
-                            DWORD bytesWritten;
-                            WriteFile(recordingState.fileHandle, memorySystemState.permanentEngineMemory, memorySystemState.totalSize, &bytesWritten, 0);
+                            finishRendering();
+                            writeMemorySnapshot(recordingState);
                             lastFrameTime = kamskiPlatformGetTime();
                         }
                         else
@@ -491,12 +588,13 @@ int CALLBACK WinMain(HINSTANCE instance,
                         if (recordingState.option == RecordingState::NONE)
                         {
                             startPlayback(recordingState);
-                            DWORD bytesRead;
+                            finishRendering();
                             RendererData* temp = new RendererData;
                             *temp = partition->rendererMemory;
-                            ReadFile(recordingState.fileHandle, memorySystemState.permanentEngineMemory, memorySystemState.totalSize, &bytesRead, 0);
+                            readMemorySnapshot(recordingState);
                             partition->rendererMemory = *temp;
                             delete temp;
+                            resetRenderLists();
                         }
                         else
                         {
@@ -571,12 +669,13 @@ int CALLBACK WinMain(HINSTANCE instance,
         {
             if (playbackInput(recordingState, *playerInputSystemState))
             {
-                DWORD bytesRead;
+                finishRendering();
                 RendererData* temp = new RendererData;
                 *temp = partition->rendererMemory;
-                ReadFile(recordingState.fileHandle, memorySystemState.permanentEngineMemory, memorySystemState.totalSize, &bytesRead, 0);
+                readMemorySnapshot(recordingState);
                 partition->rendererMemory = *temp;
                 delete temp;
+                resetRenderLists();
             }
         }
 #endif
@@ -584,15 +683,18 @@ int CALLBACK WinMain(HINSTANCE instance,
         f64 gameDt = dt;
         // Input
         gameFuncs.input();
+        // Update and render run on fibers pinned to this thread, waiting on jobs there runs other jobs meanwhile
+        GameFiberCall gameCall = {&gameFuncs, gameDt};
         // Update
-        gameFuncs.update(gameDt);
+        runOnFiber(gameUpdateFiber, &gameCall);
+        gameDt = gameCall.dt;
         // Render
-        gameFuncs.render(gameDt);
+        runOnFiber(gameRenderFiber, &gameCall);
 
         inputPass();
         stepTime(gameDt);
 
-        memorySystemState.tempAlloc->size = 0;
+        resetTemporaryArenas();
 #ifdef KAMSKI_DEBUG
         if (recordingState.option != RecordingState::NONE)
         {
@@ -611,11 +713,17 @@ int CALLBACK WinMain(HINSTANCE instance,
 
         avg = avg / (f64)KAMSKI_FRAME_COUNT;
 
-        char title[64];
-        sprintf(title, "frameTime:%fms, FPS:%f", avg, 1.0 / avg);
+        const RenderThreadStats renderStats = getRenderThreadStats();
+        char title[160];
+        sprintf(title, "frameTime:%fms, FPS:%f, latency:%fms, render:%fms, submitWait:%fms, renderFPS:%f", avg, 1.0 / avg,
+                renderStats.latency * 1000.0, renderStats.renderTime * 1000.0, renderStats.submitWait * 1000.0,
+                renderStats.framesPerSecond);
         SetWindowTextA(win32State->window, title);
 #endif
     }
 
+    stopRenderThread();
+    shutdownJobSystem();
+    kamskiPlatformFlushLog();
     return 0;
 }
@@ -8,15 +8,136 @@
 #include "deps/stb_truetype.h"
 #include <gl/GL.h>
 #include <cstring>
+#include <cfloat>
 #include <algorithm>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include "KamskiMemory.cpp"
+#include "KamskiJobs.cpp"
+#include "KamskiQuads.cpp"
 
 // ######## RESERVED_TYPES ########
-struct Vertex
+// A world sprite, the sprite vertex shader expands it into a quad
+struct SpriteInstance
 {
-    glm::vec3 position;
-    glm::vec4 color;
-    glm::vec2 texture;
-    f32 texIndex;
+    glm::vec2 position;
+    glm::vec2 size;
+    f32 rotation;
+    // RGBA8
+    u32 color;
+    // u0, v0, u1, v1 as 16 bit normalized, (u0, v0) maps to the bottom left corner
+    u16 uvRect[4];
+    // Atlas layer, -1 for an untextured sprite
+    i32 texIndex;
+    // Larger is further back, the sprite vertex shader maps it to clip space z
+    f32 depth;
+};
+
+static_assert(sizeof(SpriteInstance) == 40, "SpriteInstance layout is mirrored by the sprite vertex array");
+
+// Depths past the visible area clamp to the near and far planes
+inline constexpr f32 NEAREST_SPRITE_DEPTH = -FLT_MAX;
+inline constexpr f32 FARTHEST_SPRITE_DEPTH = FLT_MAX;
+// Opaque sprites discard texels below this alpha instead of blending them
+inline constexpr f32 SPRITE_ALPHA_CUTOFF = 0.5f;
+
+// World sprites are queued and sorted by layer first, so every particle lands on top of every world sprite.
+// The UI is its own pass after the lights and always ends up on top of both
+enum class RenderLayer : u8
+{
+    World,
+    Particles
+};
+
+// World sprites recorded since the last flush. Opaque ones are depth tested in any order, translucent ones
+// carry a sort key each (see makeSpriteKey). The arenas commit as the queues grow up to MAX_QUAD_COUNT sprites
+struct SpriteRecorder
+{
+    Arena* opaqueArena;
+    Arena* translucentArena;
+    Arena* keyArena;
+    SpriteInstance* opaqueSprites;
+    SpriteInstance* translucentSprites;
+    u64* keys;
+    u32 opaqueCount;
+    u32 translucentCount;
+    RenderLayer layer;
+};
+
+// What one batch of recordSpritesParallel recorded, as ranges of the queues of the thread that ran it
+struct SpriteRun
+{
+    u32 threadIndex;
+    u32 opaqueBegin;
+    u32 opaqueEnd;
+    u32 translucentBegin;
+    u32 translucentEnd;
+};
+
+// Where a loaded texture lives in the atlas
+struct AtlasRegion
+{
+    // u0, v0, u1, v1, (u0, v0) is the first texel row of the image as it was loaded
+    glm::vec4 uvRect;
+    // uvRect as the UI vertices store it
+    PackedUVRect packedUVs;
+    u32 layer;
+};
+
+// Top of the packed area over [x, x + width), the nodes of a layer cover its whole width from left to right
+struct SkylineNode
+{
+    u16 x;
+    u16 y;
+    u16 width;
+};
+
+static_assert(KAMSKI_ATLAS_SIZE < 65536, "Skyline nodes store atlas coordinates in 16 bits");
+
+struct AtlasLayer
+{
+    // One spare node, packing inserts before it removes the nodes it covers
+    SkylineNode nodes[KAMSKI_ATLAS_SIZE + 1];
+    u32 nodeCount;
+};
+
+struct TileChunk
+{
+    u32 instanceCount;
+    bool dirty;
+};
+
+// A grid of tiles cut into TILE_CHUNK_SIZE square chunks. Every chunk owns a fixed slot of TILE_CHUNK_TILE_COUNT
+// sprite instances in one static buffer, its slot is rewritten only once one of its tiles changed
+struct TileMap
+{
+    // Texture id of every tile row by row, 0 for an empty tile
+    u32* tiles;
+    TileChunk* chunks;
+    Arena* arena;
+    glm::uvec2 size;
+    glm::uvec2 chunkCount;
+    glm::vec2 tileSize;
+    glm::vec2 origin;
+};
+
+// The GL side of a tile map, only the render thread touches it
+struct TileMapBuffers
+{
+    u32 instanceBuffer;
+    u32 vertexArray;
+};
+
+// A persistently mapped buffer split into STREAM_REGION_COUNT regions. Draws read straight from the region
+// they were written to, a region is fenced when the writer leaves it and waited on before it is written again
+struct StreamRing
+{
+    u32 buffer;
+    u8* mapped;
+    u64 regionSize;
+    u32 region;
+    GLsync fences[STREAM_REGION_COUNT];
 };
 
 struct LightVertex
@@ -46,20 +167,225 @@ struct LightBlocker
     glm::vec2 size;
 };
 
+// ########Render commands########
+
+// The game thread records every renderer call that reaches GL as one of these, the render thread replays them
+// in order. Pointers in the payloads point into the data arena of the list the command was recorded in
+enum class RenderCommandType : u8
+{
+    Resize,
+    AddAtlasLayer,
+    UploadAtlasImage,
+    CreateTileMap,
+    DestroyTileMap,
+    UploadTileChunk,
+    DrawTileMap,
+    BeginBatch,
+    DrawSprites,
+    DrawLights,
+    MergeFramebuffers,
+    SetBlur,
+    DrawUI,
+    DrawTriangleFan,
+    EndBatch,
+    Present,
+};
+
+// Header of a recorded command, its payload follows right after and [size] covers both
+struct RenderCommand
+{
+    RenderCommandType type;
+    u32 size;
+};
+
+struct ResizeCommand
+{
+    static constexpr RenderCommandType TYPE = RenderCommandType::Resize;
+    u32 x;
+    u32 y;
+};
+
+struct AddAtlasLayerCommand
+{
+    static constexpr RenderCommandType TYPE = RenderCommandType::AddAtlasLayer;
+    u32 layerCount;
+};
+
+// [pixels] is the padded image, gutter included
+struct UploadAtlasImageCommand
+{
+    static constexpr RenderCommandType TYPE = RenderCommandType::UploadAtlasImage;
+    const u32* pixels;
+    u32 x;
+    u32 y;
+    u32 layer;
+    u32 width;
+    u32 height;
+};
+
+struct CreateTileMapCommand
+{
+    static constexpr RenderCommandType TYPE = RenderCommandType::CreateTileMap;
+    TileMapId id;
+    u64 instanceCount;
+};
+
+struct DestroyTileMapCommand
+{
+    static constexpr RenderCommandType TYPE = RenderCommandType::DestroyTileMap;
+    TileMapId id;
+};
+
+struct UploadTileChunkCommand
+{
+    static constexpr RenderCommandType TYPE = RenderCommandType::UploadTileChunk;
+    const SpriteInstance* instances;
+    TileMapId id;
+    u32 chunkIndex;
+    u32 instanceCount;
+};
+
+struct TileChunkDraw
+{
+    u32 firstInstance;
+    u32 instanceCount;
+};
+
+struct DrawTileMapCommand
+{
+    static constexpr RenderCommandType TYPE = RenderCommandType::DrawTileMap;
+    const TileChunkDraw* chunks;
+    TileMapId id;
+    u32 chunkCount;
+};
+
+// [camera] is already in OpenGL coordinates
+struct BeginBatchCommand
+{
+    static constexpr RenderCommandType TYPE = RenderCommandType::BeginBatch;
+    glm::vec3 camera;
+    glm::vec2 worldToClip;
+};
+
+// Opaque sprites first, then the translucent ones in draw order
+struct DrawSpritesCommand
+{
+    static constexpr RenderCommandType TYPE = RenderCommandType::DrawSprites;
+    const SpriteInstance* sprites;
+    u32 opaqueCount;
+    u32 translucentCount;
+};
+
+struct DrawLightsCommand
+{
+    static constexpr RenderCommandType TYPE = RenderCommandType::DrawLights;
+    const LightVertex* vertices;
+    u32 vertexCount;
+};
+
+struct MergeFramebuffersCommand
+{
+    static constexpr RenderCommandType TYPE = RenderCommandType::MergeFramebuffers;
+};
+
+struct SetBlurCommand
+{
+    static constexpr RenderCommandType TYPE = RenderCommandType::SetBlur;
+    bool blurWholeScreen;
+};
+
+// Four vertices a quad
+struct DrawUICommand
+{
+    static constexpr RenderCommandType TYPE = RenderCommandType::DrawUI;
+    const Vertex* vertices;
+    u32 vertexCount;
+};
+
+struct DrawTriangleFanCommand
+{
+    static constexpr RenderCommandType TYPE = RenderCommandType::DrawTriangleFan;
+    const Vertex* vertices;
+    glm::vec3 camera;
+    u32 vertexCount;
+};
+
+struct EndBatchCommand
+{
+    static constexpr RenderCommandType TYPE = RenderCommandType::EndBatch;
+};
+
+// [recordedTime] is when swapClear ran on the game thread
+struct PresentCommand
+{
+    static constexpr RenderCommandType TYPE = RenderCommandType::Present;
+    f64 recordedTime;
+};
+
+struct RenderCommandList
+{
+    // RenderCommand headers each followed by its payload
+    Arena* commands;
+    // Vertices and pixels the payloads point at
+    Arena* data;
+    // Set by the game thread once the list is recorded, cleared by the render thread once it replayed it
+    bool submitted;
+};
+
+// The game thread records into one list while the render thread replays the other, so a frame renders while the
+// next one simulates and neither side gets more than one list ahead of the other
+struct RenderThreadInternal
+{
+    std::thread thread;
+    std::mutex mutex;
+    // Signalled when a list is submitted or replayed and when the thread has to quit
+    std::condition_variable condition;
+    RenderCommandList lists[2];
+    // List the game thread records into
+    u32 recordIndex;
+    bool quit;
+
+    // Rings of the last KAMSKI_FRAME_COUNT samples, guarded by [mutex]
+    f64 latencies[KAMSKI_FRAME_COUNT];
+    f64 renderTimes[KAMSKI_FRAME_COUNT];
+    f64 presentIntervals[KAMSKI_FRAME_COUNT];
+    f64 submitWaits[KAMSKI_FRAME_COUNT];
+    u64 framesPresented;
+    u64 framesSubmitted;
+    // rData->usage as of the last present, the live one belongs to the render thread
+    RendererUsage usage;
+
+    // Game thread only, waited in submitRenderList since the last swapClear
+    f64 frameSubmitWait;
+    // Render thread only
+    f64 lastPresentTime;
+    f64 replayStart;
+    f64 frameRenderTime;
+};
+
+// The GL handles and the fields marked render thread only belong to the render thread once it runs
 struct RendererData
 {
     HDC deviceContext;
+    HGLRC glContext;
     Vertex* quadBufferPtr;
     Vertex* quadBufferUIPtr;
     Light* lightBufferPtr;
     LightBlocker* lightBlockerBufferPtr;
     LightVertex* lightVertexPtr;
     stbtt_bakedchar chars[FONT_CHARACTER_COUNT];
+    // Glyph uvs for drawCharacterUI, packed once the font is baked
+    PackedUVRect charUVs[FONT_CHARACTER_COUNT];
     
     u32 quadVertexArray;
     u32 quadVertexBuffer;
     u32 quadVertexIndicesBuffer;
     u32 quadShaderPtr;
+    u32 spriteVertexArray;
+    u32 spriteShader;
+    u32 uiVertexArray;
+    StreamRing spriteRing;
+    StreamRing uiRing;
     
     u32 lightVertexBuffer;
     u32 lightShader;
@@ -67,27 +393,60 @@ struct RendererData
     u32 mergeVertexArray;
     u32 albedoFramebuffer;
     u32 albedoTexture;
+    u32 albedoDepthBuffer;
     u32 lightVertexArray;
     u32 lightFramebuffer;
     u32 lightTexture;
     
-    u32 indexCount;
-    u32 indexCountUI;
+    // Vertex storage lives in arenas that commit as they grow, the buffers below point at their bytes
+    Arena* quadArena;
+    Arena* lightVertexArena;
+    Arena* uiArena;
+    Vertex* quadBuffer;
+    LightVertex* lightVertices;
+    // UI vertices recorded since the last flushUI
+    Vertex* quadBufferUI;
+    // The frame's sprites, flush draws them
+    SpriteRecorder spriteQueue;
+    // Only used inside recordSpritesParallel, indexed by thread and merged into spriteQueue once the batches ran
+    SpriteRecorder threadRecorders[KAMSKI_MAX_THREAD_COUNT];
+    bool recordingInParallel;
+    // Render thread only. Sprites and UI vertices are copied into the current ring region, from the end of the
+    // last batch up to the end of the region
+    SpriteInstance* spritePtr;
+    SpriteInstance* spriteEnd;
+    Vertex* uiRingPtr;
+    Vertex* uiRingEnd;
+    // Render thread only. Sizes of the GPU buffers, they only grow
+    u64 quadVertexBufferSize;
+    u64 lightVertexBufferSize;
+    u32 indexBufferQuadCount;
+    // Scratch for the index pattern, the render thread has no frame arena
+    Arena* indexScratchArena;
+    // Render thread only, getRendererUsage reads the copy published with every present
+    RendererUsage usage;
     
-    u32 texSlots[TEXTURE_SLOT_COUNT];
-    u32 texSlotsUi[TEXTURE_SLOT_COUNT];
-    u32 texSlotIndex;
-    u32 texSlotUiIndex;
+    // Every texture is packed into the layers of one array texture, so batches never split on texture changes.
+    // The texture itself is render thread only
+    u32 atlasTexture;
+    u32 atlasLayerCount;
+    u32 textureCount;
     u32 fontTexId;
+    AtlasLayer atlasLayers[KAMSKI_MAX_ATLAS_LAYERS];
+    // Indexed by the ids loadTexture returns, 0 is never handed out
+    AtlasRegion textures[KAMSKI_MAX_TEXTURE_COUNT];
+    // Indexed by TileMapId, a slot is free while its arena is null. Slot 0 is never used
+    TileMap tileMaps[KAMSKI_MAX_TILE_MAP_COUNT];
+    // Render thread only, indexed like tileMaps
+    TileMapBuffers tileMapBuffers[KAMSKI_MAX_TILE_MAP_COUNT];
     
     u32 resolutionX;
     u32 resolutionY;
     
     f32 aspectRatio;
+    // Inverse of the screen size in world units, set by beginBatch
+    glm::vec2 worldToClip;
     
-    Vertex quadBuffer[MAX_VERTEX_COUNT];
-    Vertex quadBufferUI[MAX_VERTEX_COUNT];
-    LightVertex lightVertices[MAX_VERTEX_COUNT];
     Light lightBuffer[KAMSKI_MAX_LIGHT_COUNT];
     LightBlocker lightBlockerBuffer[KAMSKI_MAX_LIGHT_COUNT];
     
@@ -120,9 +479,16 @@ struct GameMemoryInternal
     
     u64 totalSize;
     
-    //TODO (phillip): maybe have an array of these, owned by each thread or at leas synced
-    Arena* tempAlloc;
+    // One frame arena per thread, indexed by kamskiThreadIndex (0 is the main thread)
+    Arena* tempAllocs[KAMSKI_MAX_THREAD_COUNT];
+    // High-water mark of every frame arena during the last frame
+    u64 tempPeakSizes[KAMSKI_MAX_THREAD_COUNT];
+    SlabAllocator* slabAlloc;
     GeneralAllocator* globalAlloc;
+
+    MemoryTagStats tagStats[(u32)MemoryTag::ENUM_COUNT];
+    // Frame arena bytes every thread took this frame, folded into tagStats by resetTemporaryArenas
+    u64 tempTagBytes[KAMSKI_MAX_THREAD_COUNT][(u32)MemoryTag::ENUM_COUNT];
 };
 
 struct PlayerInputInternal
@@ -305,202 +671,257 @@ void readWholeFile(void* buffer, const u64 bufferCapacity, const char* filePath)
 
 GameMemoryInternal memorySystemState = {};
 
-void* temporaryAlloc(u64 allocSize, const u64 alignment)
+// Index of the calling thread into the per-thread engine state, set once by every thread the engine starts
+thread_local u32 kamskiThreadIndex = 0;
+
+void setThreadIndex(u32 threadIndex)
 {
-    return memorySystemState.tempAlloc->alloc(allocSize, alignment);
+    assert(threadIndex < KAMSKI_MAX_THREAD_COUNT);
+    kamskiThreadIndex = threadIndex;
 }
 
-void* temporaryAlloc(u64 allocSize)
+const char* memoryTagNames[] = {"untagged", "engine", "renderer", "font", "map", "navmesh", "ecs", "game"};
+static_assert(ARRAY_COUNT(memoryTagNames) == (u32)MemoryTag::ENUM_COUNT);
+
+// Warns when [tag] goes over its budget, once per crossing rather than on every allocation
+void checkMemoryBudget(MemoryTag tag)
 {
-    return temporaryAlloc(allocSize, 8);
+    MemoryTagStats& stats = memorySystemState.tagStats[(u32)tag];
+    const bool overBudget = stats.budgetBytes && stats.liveBytes + stats.temporaryBytes > stats.budgetBytes;
+    if (overBudget && !stats.overBudget)
+    {
+        logWarning("Memory tag %s is over its budget: %llu KB live + %llu KB temporary > %llu KB",
+                   memoryTagNames[(u32)tag], stats.liveBytes / KB(1), stats.temporaryBytes / KB(1), stats.budgetBytes / KB(1));
+    }
+    stats.overBudget = overBudget;
 }
 
-void* getPermanentMemory()
+void trackAlloc(MemoryTag tag, u64 size)
 {
-    return memorySystemState.permanentMemory;
+    MemoryTagStats& stats = memorySystemState.tagStats[(u32)tag];
+    stats.liveBytes += size;
+    stats.allocationCount++;
+    if (stats.liveBytes > stats.peakBytes)
+    {
+        stats.peakBytes = stats.liveBytes;
+    }
+    checkMemoryBudget(tag);
 }
 
-void* globalAlloc(u64 allocSize)
+void trackFree(MemoryTag tag, u64 size)
 {
-    return memorySystemState.globalAlloc->alloc(allocSize);
+    MemoryTagStats& stats = memorySystemState.tagStats[(u32)tag];
+    assert(stats.liveBytes >= size && stats.allocationCount);
+    stats.liveBytes -= size;
+    stats.allocationCount--;
+    checkMemoryBudget(tag);
 }
 
-void* globalAlignedAlloc(u64 allocSize, u8 alignment)
+void* temporaryAlloc(u64 allocSize, const u64 alignment, MemoryTag tag)
 {
-    return memorySystemState.globalAlloc->alloc(allocSize, alignment);
+    void* retval = memorySystemState.tempAllocs[kamskiThreadIndex]->alloc(allocSize, alignment);
+    if (retval)
+    {
+        memorySystemState.tempTagBytes[kamskiThreadIndex][(u32)tag] += allocSize;
+    }
+    return retval;
 }
 
-void globalFree(void* ptr)
+void* temporaryAlloc(u64 allocSize, MemoryTag tag)
 {
-    memorySystemState.globalAlloc->free(ptr);
+    return temporaryAlloc(allocSize, 8, tag);
 }
 
-void printGlobalAllocations(bool printFreeChunks)
+Arena* getTemporaryArena()
 {
-    memorySystemState.globalAlloc->printAllocations(printFreeChunks);
+    return memorySystemState.tempAllocs[kamskiThreadIndex];
 }
 
-Arena* allocArena(u64 arenaCapacity)
+u64 getTemporaryPeak(u32 threadIndex)
 {
-    Arena* retval = (Arena*)globalAlloc(sizeof(Arena) + arenaCapacity);
-    new(retval) Arena(arenaCapacity);
-    return retval;
+    assert(threadIndex < KAMSKI_MAX_THREAD_COUNT);
+    return memorySystemState.tempPeakSizes[threadIndex];
 }
 
-void freeArena(Arena* arena)
+// Called at frame end when no other thread is allocating
+void resetTemporaryArenas()
 {
-    globalFree(arena);
+    for (u32 i = 0; i < KAMSKI_MAX_THREAD_COUNT; i++)
+    {
+        Arena* arena = memorySystemState.tempAllocs[i];
+        memorySystemState.tempPeakSizes[i] = arena->peakSize;
+        arena->size = 0;
+        arena->peakSize = 0;
+    }
+
+    for (u32 tag = 0; tag < (u32)MemoryTag::ENUM_COUNT; tag++)
+    {
+        u64 temporaryBytes = 0;
+        for (u32 i = 0; i < KAMSKI_MAX_THREAD_COUNT; i++)
+        {
+            temporaryBytes += memorySystemState.tempTagBytes[i][tag];
+            memorySystemState.tempTagBytes[i][tag] = 0;
+        }
+        memorySystemState.tagStats[tag].temporaryBytes = temporaryBytes;
+        checkMemoryBudget((MemoryTag)tag);
+    }
 }
 
-GeneralAllocator::GeneralAllocator(u64 capacity):
-capacity(capacity),
-chunkCount(1)
+void* getPermanentMemory()
 {
-    chunks[0].size = capacity;
-    chunks[0].address = bytes;
+    return memorySystemState.permanentMemory;
 }
 
-void GeneralAllocator::splitChunk(const u64 index, const u64 size)
+MemoryUsage getMemoryUsage()
 {
-    for (u64 i = chunkCount; i > index + 1; i--)
-    {
-        chunks[i] = chunks[i - 1];
-    }
+    return kamskiPlatformGetMemoryUsage();
+}
 
-    chunks[index + 1].address = (u8*)chunks[index].address + size;
-    chunks[index + 1].size = chunks[index].size - size;
-    chunks[index + 1].isOccupied = false;
-    chunks[index].size = size;
-    chunkCount++;
+MemorySummary getMemorySummary()
+{
+    MemorySummary retval;
+    memcpy(retval.tags, memorySystemState.tagStats, sizeof(retval.tags));
+    retval.heapFreeBytes = memorySystemState.globalAlloc->freeBytes;
+    retval.heapLargestFreeBlock = memorySystemState.globalAlloc->largestFreeBlock();
+    retval.heapFragmentation = retval.heapFreeBytes ? 1.0f - (f32)((f64)retval.heapLargestFreeBlock / (f64)retval.heapFreeBytes) : 0.0f;
+    retval.usage = getMemoryUsage();
+    return retval;
 }
 
-void* GeneralAllocator::alloc(u64 allocSize, u8 alignment)
+void setMemoryBudget(MemoryTag tag, u64 budgetBytes)
 {
-    void* retval = nullptr;
+    memorySystemState.tagStats[(u32)tag].budgetBytes = budgetBytes;
+    checkMemoryBudget(tag);
+}
 
-    if (allocSize == 0)
-    {
-        logDebug("0 byte allocation");
-    }
-    else
+void printMemorySummary()
+{
+    const MemorySummary summary = getMemorySummary();
+    for (u32 tag = 0; tag < (u32)MemoryTag::ENUM_COUNT; tag++)
     {
-        for (u64 index = 0; index != chunkCount; index++)
+        const MemoryTagStats& stats = summary.tags[tag];
+        if (!stats.peakBytes && !stats.temporaryBytes)
         {
-            const u64 i = (lastChunkIndex + index) % chunkCount;
-            const u64 alignmentDistance = (alignment - ((u64)chunks[i].address % alignment)) % alignment;
-            const u64 size = allocSize + alignmentDistance;
-
-            if (chunks[i].size >= size && !chunks[i].isOccupied)
-            {
-                retval = (u8*)chunks[i].address + alignmentDistance;
-
-                if (chunks[i].size != size)
-                {
-                    assert(chunkCount != KAMSKI_MEMORY_CHUNKS_MAX);
-                    lastChunkIndex = i + 1;
-                    splitChunk(i, size);
-                }
-                else
-                {
-                    lastChunkIndex = i;
-                }
-                chunks[i].isOccupied = true;
-                break;
-            }
+            continue;
         }
+        logInfo("%-8s %9.2f MB live in %6llu allocations, %9.2f MB peak, %8.2f MB temporary%s",
+                memoryTagNames[tag], (f64)stats.liveBytes / MB(1), stats.allocationCount, (f64)stats.peakBytes / MB(1),
+                (f64)stats.temporaryBytes / MB(1), stats.overBudget ? ", over budget" : "");
     }
+    logInfo("Heap: %.2f MB free, largest block %.2f MB, %.1f%% fragmented",
+            (f64)summary.heapFreeBytes / MB(1), (f64)summary.heapLargestFreeBlock / MB(1), summary.heapFragmentation * 100.0f);
+    logInfo("%llu MB committed out of %llu MB reserved", summary.usage.committedBytes / MB(1), summary.usage.reservedBytes / MB(1));
+}
 
+// The general allocator only commits its headers, the bytes handed out are committed here
+void* generalAlloc(u64 allocSize, u8 alignment, MemoryTag tag)
+{
+    void* retval = memorySystemState.globalAlloc->alloc(allocSize, alignment, tag);
+    if (retval)
+    {
+        kamskiPlatformCommitMemory(retval, allocSize);
+        trackAlloc(tag, memorySystemState.globalAlloc->allocationSize(retval));
+    }
     return retval;
 }
 
+void* slabTryAlloc(u64 allocSize, MemoryTag tag)
+{
+    void* retval = memorySystemState.slabAlloc->alloc(allocSize, tag);
+    if (retval)
+    {
+        trackAlloc(tag, memorySystemState.slabAlloc->allocationSize(retval));
+    }
+    return retval;
+}
 
-void GeneralAllocator::free(void* ptr)
+// Tiny allocations go to the slabs and only fall back to the general allocator once those are full
+void* globalAlloc(u64 allocSize, MemoryTag tag)
 {
-    if (!ptr)
-        return;
-    for (u64 i = 0; i < chunkCount; i++)
+    if (allocSize && allocSize <= SlabAllocator::MAX_SIZE)
     {
-        if (chunks[i].address == ptr)
+        void* retval = slabTryAlloc(allocSize, tag);
+        if (retval)
         {
-            assert(chunks[i].isOccupied);
-            chunks[i].isOccupied = false;
-
-            if (i != 0 && !chunks[i - 1].isOccupied)
-            {
-                if (i != chunkCount - 1 && !chunks[i + 1].isOccupied)
-                {
-                    chunks[i-1].size += chunks[i].size + chunks[i+1].size;
-                    for (u64 j = i; j < chunkCount - 2; j++)
-                    {
-                        chunks[j] = chunks[j + 2];
-                    }
-                    chunkCount -= 2;
-                } else
-                {
-                    chunks[i-1].size += chunks[i].size;
-                    for (u64 j = i; j < chunkCount - 1; j++)
-                    {
-                        chunks[j] = chunks[j + 1];
-                    }
-                    chunkCount--;
-                }
-                lastChunkIndex = i-1;
-            } else if (i < chunkCount - 2 && !chunks[i + 1].isOccupied)
-            {
-                chunks[i].size += chunks[i + 1].size;
-                for (u64 j = i + 1; j < chunkCount - 1; j++)
-                {
-                    chunks[j] = chunks[j + 1];
-                }
-                chunkCount--;
-                lastChunkIndex = i;
-            }
-            break;
+            return retval;
         }
     }
+    return generalAlloc(allocSize, 8, tag);
 }
 
-void GeneralAllocator::printAllocations(bool printFreeChunks) const
+void* globalAlignedAlloc(u64 allocSize, u8 alignment, MemoryTag tag)
 {
-    const char* suffixes[] = {"B", "KB", "MB", "GB"};
-    if (printFreeChunks)
+    // Slots are aligned to their size class, so asking for at least [alignment] bytes is enough
+    const u64 slabSize = allocSize > alignment ? allocSize : alignment;
+    if (allocSize && slabSize <= SlabAllocator::MAX_SIZE)
     {
-        for (u64 i = 0; i < chunkCount; i++)
+        void* retval = slabTryAlloc(slabSize, tag);
+        if (retval)
         {
-            u64 suffixIndex = 0;
-            f64 size = chunks[i].size;
-            while (size >= 1024.0f)
-            {
-                size /= 1024.0f;
-                suffixIndex ++;
-            }
-            if (chunks[i].isOccupied)
-            {
-                logInfo("%f%s allocated at %p", size, suffixes[suffixIndex], chunks[i].address);
-            }
-            else
-            {
-                logInfo("%f%s free at %p", size, suffixes[suffixIndex], chunks[i].address);
-            }
+            return retval;
         }
     }
+    return generalAlloc(allocSize, alignment, tag);
+}
+
+void globalFree(void* ptr)
+{
+    if (!ptr)
+    {
+        return;
+    }
+
+    if (memorySystemState.slabAlloc->owns(ptr))
+    {
+        trackFree(memorySystemState.slabAlloc->allocationTag(ptr), memorySystemState.slabAlloc->allocationSize(ptr));
+        memorySystemState.slabAlloc->free(ptr);
+    }
     else
     {
-        for (u64 i = 0; i < chunkCount; i++)
-        {
-            u64 suffixIndex = 0;
-            f64 size = chunks[i].size;
-            while (size >= 1024.0f)
-            {
-                size /= 1024.0f;
-                suffixIndex ++;
-            }
-            if (chunks[i].isOccupied)
-            {
-                logInfo("%f%s allocated at %p", size, suffixes[suffixIndex], chunks[i].address);
-            }
-        }
+        trackFree(memorySystemState.globalAlloc->allocationTag(ptr), memorySystemState.globalAlloc->allocationSize(ptr));
+        memorySystemState.globalAlloc->free(ptr);
+    }
+}
+
+void* slabAlloc(u64 allocSize, MemoryTag tag)
+{
+    void* retval = slabTryAlloc(allocSize, tag);
+    if (!retval)
+    {
+        logWarning("Slab allocation of %llu bytes fell back to the general allocator", allocSize);
+        retval = generalAlloc(allocSize, 8, tag);
+    }
+    return retval;
+}
+
+void slabFree(void* ptr)
+{
+    globalFree(ptr);
+}
+
+void printGlobalAllocations(bool printFreeChunks)
+{
+    memorySystemState.globalAlloc->printAllocations(printFreeChunks);
+    logInfo("%llu of %llu slab pages used", memorySystemState.slabAlloc->usedPageCount, memorySystemState.slabAlloc->pageCount);
+    printMemorySummary();
+}
+
+// Only the header is committed here, the arena commits the rest as it grows
+Arena* allocArena(u64 arenaCapacity, MemoryTag tag)
+{
+    Arena* retval = (Arena*)memorySystemState.globalAlloc->alloc(sizeof(Arena) + arenaCapacity, 8, tag);
+    if (retval)
+    {
+        kamskiPlatformCommitMemory(retval, sizeof(Arena));
+        trackAlloc(tag, memorySystemState.globalAlloc->allocationSize(retval));
+        new(retval) Arena(arenaCapacity, kamskiPlatformCommitMemory);
     }
+    return retval;
+}
+
+void freeArena(Arena* arena)
+{
+    globalFree(arena);
 }
 
 // ########Particles########
@@ -557,37 +978,35 @@ void emitParticles(u32 particleCount,
 
 // ########Particles########
 
+void setRenderLayer(RenderLayer layer);
+
+static void renderParticleBatch(void* data, u32 begin, u32 end);
+
 void renderParticle(Particle p)
 {
     f32 t = (p.dieTime - getGameTime()) / p.lifeTime;
     glm::vec4 color = p.colorStart * t + p.colorEnd * (1.0f - t);
-    drawColoredQuad(p.pos, p.size, color, 0);
+    drawColoredQuad(p.pos, p.size, color, 0, NEAREST_SPRITE_DEPTH);
    // logDebug("%f, %f", p.size.x, p.size.y);
 }
 
-void drawParticles()
+// [begin, end) counts from the oldest live particle
+static void renderParticleBatch(void* data, u32 begin, u32 end)
 {
-    if (particleSystemState->front > particleSystemState->back)
-    {
-        for (u32 i = particleSystemState->front; i != KAMSKI_MAX_PARTICLE_COUNT; i++)
-        {
-            renderParticle(particleSystemState->particles[i]);
-        }
-
-        for (u32 i = 0; i != particleSystemState->back; i++)
-        {
-            renderParticle(particleSystemState->particles[i]);
-        }
-    }
-    else
+    for (u32 i = begin; i != end; i++)
     {
-        for (u32 i = particleSystemState->front; i != particleSystemState->back; i++)
-        {
-            renderParticle(particleSystemState->particles[i]);
-        }
+        renderParticle(particleSystemState->particles[(particleSystemState->front + i) % KAMSKI_MAX_PARTICLE_COUNT]);
     }
 }
 
+void drawParticles()
+{
+    const u32 liveCount = (particleSystemState->back + KAMSKI_MAX_PARTICLE_COUNT - particleSystemState->front) % KAMSKI_MAX_PARTICLE_COUNT;
+    setRenderLayer(RenderLayer::Particles);
+    recordSpritesParallel(liveCount, 1024, renderParticleBatch, nullptr);
+    setRenderLayer(RenderLayer::World);
+}
+
 static void simulateParticle(Particle& p, f32 dt)
 {
     f32 t = (p.dieTime - getGameTime()) / p.lifeTime;
@@ -705,33 +1124,215 @@ DECLARE_WGL_EXT_FUNC(BOOL, wglSwapIntervalEXT, i32 interval);
 RendererData* rData = nullptr;
 bool rendererInitialized = false;
 
-//TODO: move into math library when it exists
-glm::vec2 rotateVec2(const glm::vec2 v, f32 radians)
-{
-    glm::vec2 retval;
-    const f32 cosVal = cosf(radians);
-    const f32 sinVal = sinf(radians);
+// ########Render thread########
 
-    retval.x = v.x * cosVal - v.y * sinVal;
-    retval.y = v.x * sinVal + v.y * cosVal;
+RenderThreadInternal renderThreadState;
 
-    return retval;
-}
+void executeRenderList(const RenderCommandList& list);
 
-void worldPosToOpenGLPos(f32& x, f32& y)
+void initRenderLists()
 {
-    const f32 screenWorldSizeY = SCREEN_SIZE_WORLD_COORDS;
-    const f32 screenWorldSizeX = screenWorldSizeY * rData->aspectRatio;
-
-    x /= screenWorldSizeX;
-    y /= screenWorldSizeY;
+    for (RenderCommandList& list : renderThreadState.lists)
+    {
+        list.commands = allocArena(KAMSKI_RENDER_LIST_COMMAND_SIZE, MemoryTag::Renderer);
+        list.data = allocArena(KAMSKI_RENDER_LIST_DATA_SIZE, MemoryTag::Renderer);
+        list.submitted = false;
+    }
+    renderThreadState.recordIndex = 0;
 }
 
-void openGLPosToWorldPos(f32& x, f32& y)
+// Hands the list being recorded to the render thread and records into the other one once it was replayed.
+// [endsFrame] is set for the swapClear submit, the others come from lists that ran out of room
+void submitRenderList(bool endsFrame)
 {
-    const f32 screenWorldSizeY = SCREEN_SIZE_WORLD_COORDS;
-    const f32 screenWorldSizeX = screenWorldSizeY * rData->aspectRatio;
-
+    RenderThreadInternal& state = renderThreadState;
+    const f64 waitStart = kamskiPlatformGetTime();
+    {
+        std::unique_lock<std::mutex> lock(state.mutex);
+        state.lists[state.recordIndex].submitted = true;
+        state.condition.notify_all();
+        state.recordIndex ^= 1;
+        state.condition.wait(lock, [&state]() { return !state.lists[state.recordIndex].submitted; });
+        state.frameSubmitWait += kamskiPlatformGetTime() - waitStart;
+        if (endsFrame)
+        {
+            state.submitWaits[state.framesSubmitted++ % KAMSKI_FRAME_COUNT] = state.frameSubmitWait;
+            state.frameSubmitWait = 0.0;
+        }
+    }
+    RenderCommandList& list = state.lists[state.recordIndex];
+    list.commands->size = 0;
+    list.data->size = 0;
+}
+
+// Records a [T] command, [dataSize] bytes for it to point at go to [data] in the same list. A list without room
+// for both is submitted first, so the result is only null when [dataSize] does not fit an empty list
+template<typename T>
+T* recordRenderCommand(u64 dataSize = 0, void** data = nullptr)
+{
+    constexpr u32 commandSize = (sizeof(RenderCommand) + sizeof(T) + 7) / 8 * 8;
+    if (dataSize > KAMSKI_RENDER_LIST_DATA_SIZE)
+    {
+        logError("%llu bytes of render command data do not fit a command list", (unsigned long long)dataSize);
+        return nullptr;
+    }
+
+    for (;;)
+    {
+        RenderCommandList& list = renderThreadState.lists[renderThreadState.recordIndex];
+        const u64 commandsSize = list.commands->size;
+        const u64 dataSizeBefore = list.data->size;
+        u8* command = (u8*)list.commands->alloc(commandSize, 8);
+        void* bytes = dataSize ? list.data->alloc(dataSize, 16) : nullptr;
+        if (command && (bytes || !dataSize))
+        {
+            ((RenderCommand*)command)->type = T::TYPE;
+            ((RenderCommand*)command)->size = commandSize;
+            if (data)
+            {
+                *data = bytes;
+            }
+            return new (command + sizeof(RenderCommand)) T();
+        }
+        list.commands->size = commandsSize;
+        list.data->size = dataSizeBefore;
+        submitRenderList(false);
+    }
+}
+
+void renderThreadMain()
+{
+    RenderThreadInternal& state = renderThreadState;
+    wglMakeCurrent(rData->deviceContext, rData->glContext);
+    state.lastPresentTime = kamskiPlatformGetTime();
+    u32 replayIndex = 0;
+    for (;;)
+    {
+        {
+            std::unique_lock<std::mutex> lock(state.mutex);
+            state.condition.wait(lock, [&state, replayIndex]() { return state.lists[replayIndex].submitted || state.quit; });
+            // Lists submitted before quit are still replayed
+            if (!state.lists[replayIndex].submitted)
+            {
+                break;
+            }
+        }
+
+        state.replayStart = kamskiPlatformGetTime();
+        executeRenderList(state.lists[replayIndex]);
+        state.frameRenderTime += kamskiPlatformGetTime() - state.replayStart;
+        {
+            std::lock_guard<std::mutex> lock(state.mutex);
+            state.lists[replayIndex].submitted = false;
+        }
+        state.condition.notify_all();
+        replayIndex ^= 1;
+    }
+    wglMakeCurrent(nullptr, nullptr);
+}
+
+// initRenderer leaves the context current on the calling thread, from here on only the render thread uses it
+void startRenderThread()
+{
+    wglMakeCurrent(nullptr, nullptr);
+    renderThreadState.quit = false;
+    renderThreadState.thread = std::thread(renderThreadMain);
+}
+
+void stopRenderThread()
+{
+    {
+        std::lock_guard<std::mutex> lock(renderThreadState.mutex);
+        renderThreadState.quit = true;
+    }
+    renderThreadState.condition.notify_all();
+    renderThreadState.thread.join();
+}
+
+// Waits until every submitted list was replayed, the render thread leaves rData alone until the next submit
+void finishRendering()
+{
+    std::unique_lock<std::mutex> lock(renderThreadState.mutex);
+    renderThreadState.condition.wait(lock, []()
+                                     {
+                                         return !renderThreadState.lists[0].submitted && !renderThreadState.lists[1].submitted;
+                                     });
+}
+
+// The list arenas live in transient memory, so a memory snapshot restore brings back whatever they held when it
+// was taken. Both lists were already replayed (finishRendering), this empties them again
+void resetRenderLists()
+{
+    std::lock_guard<std::mutex> lock(renderThreadState.mutex);
+    for (RenderCommandList& list : renderThreadState.lists)
+    {
+        assert(!list.submitted);
+        list.commands->size = 0;
+        list.data->size = 0;
+    }
+}
+
+RenderThreadStats getRenderThreadStats()
+{
+    RenderThreadInternal& state = renderThreadState;
+    std::lock_guard<std::mutex> lock(state.mutex);
+    RenderThreadStats retval = {};
+    retval.framesPresented = state.framesPresented;
+
+    const u64 presentCount = std::min(state.framesPresented, (u64)KAMSKI_FRAME_COUNT);
+    f64 presentTime = 0.0;
+    for (u64 i = 0; i < presentCount; i++)
+    {
+        retval.latency += state.latencies[i];
+        retval.renderTime += state.renderTimes[i];
+        presentTime += state.presentIntervals[i];
+    }
+    if (presentCount)
+    {
+        retval.latency /= (f64)presentCount;
+        retval.renderTime /= (f64)presentCount;
+        retval.framesPerSecond = presentTime > 0.0 ? (f64)presentCount / presentTime : 0.0;
+    }
+
+    const u64 submitCount = std::min(state.framesSubmitted, (u64)KAMSKI_FRAME_COUNT);
+    for (u64 i = 0; i < submitCount; i++)
+    {
+        retval.submitWait += state.submitWaits[i];
+    }
+    if (submitCount)
+    {
+        retval.submitWait /= (f64)submitCount;
+    }
+    return retval;
+}
+
+//TODO: move into math library when it exists
+glm::vec2 rotateVec2(const glm::vec2 v, f32 radians)
+{
+    glm::vec2 retval;
+    const f32 cosVal = cosf(radians);
+    const f32 sinVal = sinf(radians);
+
+    retval.x = v.x * cosVal - v.y * sinVal;
+    retval.y = v.x * sinVal + v.y * cosVal;
+
+    return retval;
+}
+
+void worldPosToOpenGLPos(f32& x, f32& y)
+{
+    const f32 screenWorldSizeY = SCREEN_SIZE_WORLD_COORDS;
+    const f32 screenWorldSizeX = screenWorldSizeY * rData->aspectRatio;
+
+    x /= screenWorldSizeX;
+    y /= screenWorldSizeY;
+}
+
+void openGLPosToWorldPos(f32& x, f32& y)
+{
+    const f32 screenWorldSizeY = SCREEN_SIZE_WORLD_COORDS;
+    const f32 screenWorldSizeX = screenWorldSizeY * rData->aspectRatio;
+
     x *= screenWorldSizeX;
     y *= screenWorldSizeY;
 }
@@ -747,39 +1348,538 @@ glm::vec2 getScreenSize()
     return 2.0f * glm::vec2{SCREEN_SIZE_WORLD_COORDS * rData->aspectRatio, SCREEN_SIZE_WORLD_COORDS};
 }
 
+// Makes room for [count] more elements at [cursor] in an arena that holds a single vertex buffer,
+// at least doubling what the arena handed out. False once the arena is at its capacity
+template<typename T>
+bool reserveVertices(Arena* arena, T* cursor, u64 count)
+{
+    const u64 needed = (u64)((u8*)cursor - arena->bytes) + count * sizeof(T);
+    if (needed <= arena->size)
+    {
+        return true;
+    }
+    if (needed > arena->capacity)
+    {
+        return false;
+    }
+
+    u64 newSize = arena->size * 2;
+    newSize = newSize > needed ? newSize : needed;
+    newSize = newSize < arena->capacity ? newSize : arena->capacity;
+    arena->alloc(newSize - arena->size, 1);
+    return true;
+}
+
+// Orphans [buffer] so the upload does not wait on draws still reading it, growing it geometrically when [size] does not fit
+void uploadStreamBuffer(u32 buffer, u64& bufferSize, const void* data, u64 size)
+{
+    glBindBuffer(GL_ARRAY_BUFFER, buffer);
+    while (bufferSize < size)
+    {
+        bufferSize *= 2;
+    }
+    glBufferData(GL_ARRAY_BUFFER, bufferSize, nullptr, GL_DYNAMIC_DRAW);
+    glBufferSubData(GL_ARRAY_BUFFER, 0, size, data);
+}
+
+// The index pattern is the same for every quad, the buffer only has to cover the biggest draw so far
+void reserveQuadIndices(u64 quadCount)
+{
+    if (quadCount <= rData->indexBufferQuadCount)
+    {
+        return;
+    }
+
+    u64 newQuadCount = rData->indexBufferQuadCount ? rData->indexBufferQuadCount : KAMSKI_INITIAL_QUAD_COUNT;
+    while (newQuadCount < quadCount)
+    {
+        newQuadCount *= 2;
+    }
+    newQuadCount = newQuadCount < MAX_QUAD_COUNT ? newQuadCount : MAX_QUAD_COUNT;
+
+    TempMemoryScope scratch(rData->indexScratchArena);
+    u32* indices = (u32*)rData->indexScratchArena->alloc(newQuadCount * 6 * sizeof(u32), alignof(u32));
+    u32 offset = 0;
+
+    for (u64 i = 0; i < newQuadCount * 6; i+=6)
+    {
+        indices[i] = 0 + offset;
+        indices[i+1] = 1 + offset;
+        indices[i+2] = 2 + offset;
+
+        indices[i+3] = 2 + offset;
+        indices[i+4] = 3 + offset;
+        indices[i+5] = 0 + offset;
+
+        offset += 4;
+    }
+
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, rData->quadVertexIndicesBuffer);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, newQuadCount * 6 * sizeof(u32), indices, GL_STATIC_DRAW);
+    rData->indexBufferQuadCount = newQuadCount;
+}
+
+// Creates the buffer with [regionSize] bytes per region, it stays mapped until it is deleted
+void createStreamRing(StreamRing& ring, u64 regionSize)
+{
+    const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+    glCreateBuffers(1, &ring.buffer);
+    glNamedBufferStorage(ring.buffer, regionSize * STREAM_REGION_COUNT, nullptr, flags);
+    ring.mapped = (u8*)glMapNamedBufferRange(ring.buffer, 0, regionSize * STREAM_REGION_COUNT, flags);
+    ring.regionSize = regionSize;
+    ring.region = 0;
+    for (GLsync& fence : ring.fences)
+    {
+        fence = nullptr;
+    }
+}
+
+u8* getStreamRegion(const StreamRing& ring)
+{
+    return ring.mapped + ring.region * ring.regionSize;
+}
+
+void waitStreamFence(GLsync& fence)
+{
+    if (!fence)
+    {
+        return;
+    }
+    if (glClientWaitSync(fence, 0, 0) == GL_TIMEOUT_EXPIRED)
+    {
+        rData->usage.streamStalls++;
+        // Flushing on the first wait makes sure the fence reaches the GPU at all
+        GLbitfield flags = GL_SYNC_FLUSH_COMMANDS_BIT;
+        while (glClientWaitSync(fence, flags, 1000000) == GL_TIMEOUT_EXPIRED)
+        {
+            flags = 0;
+        }
+    }
+    glDeleteSync(fence);
+    fence = nullptr;
+}
+
+// Fences the draws issued from the current region and moves to the next one once the GPU is done with it
+void advanceStreamRing(StreamRing& ring)
+{
+    ring.fences[ring.region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    ring.region = (ring.region + 1) % STREAM_REGION_COUNT;
+    waitStreamFence(ring.fences[ring.region]);
+}
+
+// Only called with no batch pending. The old buffer is deleted right away, GL keeps it alive for the draws still reading it
+void growStreamRing(StreamRing& ring, u64 regionSize)
+{
+    for (GLsync& fence : ring.fences)
+    {
+        if (fence)
+        {
+            glDeleteSync(fence);
+        }
+    }
+    glUnmapNamedBuffer(ring.buffer);
+    glDeleteBuffers(1, &ring.buffer);
+    createStreamRing(ring, regionSize);
+}
+
+void resetSpriteRegion()
+{
+    rData->spritePtr = (SpriteInstance*)getStreamRegion(rData->spriteRing);
+    rData->spriteEnd = rData->spritePtr + rData->spriteRing.regionSize / sizeof(SpriteInstance);
+}
+
+void resetUIRegion()
+{
+    rData->uiRingPtr = (Vertex*)getStreamRegion(rData->uiRing);
+    rData->uiRingEnd = rData->uiRingPtr + rData->uiRing.regionSize / sizeof(Vertex);
+}
+
+void setSpriteAttributes(u32 vertexArray, u32 buffer);
+void setupUIVertexArray();
+
+// Makes room for [count] sorted sprites in the current region. Only called with every earlier batch drawn,
+// the ring doubles until it reaches MAX_QUAD_COUNT sprites a region and moves on to its next region after that
+void reserveSpriteRing(u64 count)
+{
+    const u64 capacity = rData->spriteRing.regionSize / sizeof(SpriteInstance);
+    if (count > capacity)
+    {
+        u64 newCapacity = capacity;
+        while (newCapacity < count)
+        {
+            newCapacity *= 2;
+        }
+        growStreamRing(rData->spriteRing, std::min(newCapacity, MAX_QUAD_COUNT) * sizeof(SpriteInstance));
+        setSpriteAttributes(rData->spriteVertexArray, rData->spriteRing.buffer);
+        resetSpriteRegion();
+    }
+    else if (rData->spritePtr + count > rData->spriteEnd)
+    {
+        advanceStreamRing(rData->spriteRing);
+        resetSpriteRegion();
+    }
+}
+
+// Sprites pushed from here on are sorted into [layer]
+void setRenderLayer(RenderLayer layer)
+{
+    assert(!rData->recordingInParallel);
+    rData->spriteQueue.layer = layer;
+}
+
+// Layer in the top byte, then the depth mapped to bits that sort like the float but flipped so larger depths
+// come first. The low half indexes the queued payload
+u64 makeSpriteKey(RenderLayer layer, f32 depth, u32 index)
+{
+    u32 depthBits;
+    memcpy(&depthBits, &depth, sizeof(depthBits));
+    depthBits = (depthBits & 0x80000000u) ? ~depthBits : depthBits | 0x80000000u;
+    depthBits = ~depthBits;
+    return (u64)layer << 56 | (u64)(depthBits >> 8) << 32 | index;
+}
+
+// Stable LSD radix sort of [keys] on their upper half, a byte per pass. Queue order is the low half, so the
+// stable passes keep equal keys in submission order without sorting it. Returns [keys] or [scratch], whichever
+// holds the result
+u64* radixSortSpriteKeys(u64* keys, u64* scratch, u32 count)
+{
+    for (u32 shift = 32; shift < 64; shift += 8)
+    {
+        u32 offsets[256] = {};
+        for (u32 i = 0; i < count; i++)
+        {
+            offsets[(keys[i] >> shift) & 0xff]++;
+        }
+        // Every key has the same byte, the pass would not move anything
+        if (offsets[(keys[0] >> shift) & 0xff] == count)
+        {
+            continue;
+        }
+
+        u32 total = 0;
+        for (u32& offset : offsets)
+        {
+            const u32 bucketCount = offset;
+            offset = total;
+            total += bucketCount;
+        }
+        for (u32 i = 0; i < count; i++)
+        {
+            scratch[offsets[(keys[i] >> shift) & 0xff]++] = keys[i];
+        }
+        std::swap(keys, scratch);
+    }
+    return keys;
+}
+
+const AtlasRegion& getTextureRegion(u32 texId)
+{
+    assert(texId != 0 && texId < rData->textureCount);
+    return rData->textures[texId];
+}
+
+// Atlas UVs of a baked font character as u0, v0, u1, v1, v0 is the top row since the bake runs top down
+glm::vec4 getCharacterUvs(const stbtt_bakedchar& bakedChar)
+{
+    const glm::vec4& font = rData->textures[rData->fontTexId].uvRect;
+    return glm::vec4{font.x, font.y, font.x, font.y} +
+           glm::vec4{bakedChar.x0, bakedChar.y0, bakedChar.x1, bakedChar.y1} / (f32)ATLAS_SIZE;
+}
+
+bool isSpriteCulled(glm::vec2 position, glm::vec2 size)
+{
+    glm::vec2 cullSize = glm::abs(size);
+    return ( position.x + cullSize.x / 2.0f - rData->camera.x) * rData->camera.z < -SCREEN_SIZE_WORLD_COORDS * rData->aspectRatio ||
+           ( position.x - cullSize.x / 2.0f - rData->camera.x) * rData->camera.z >  SCREEN_SIZE_WORLD_COORDS * rData->aspectRatio ||
+           ( position.y + cullSize.y / 2.0f - rData->camera.y) * rData->camera.z < -SCREEN_SIZE_WORLD_COORDS ||
+           ( position.y - cullSize.y / 2.0f - rData->camera.y) * rData->camera.z >  SCREEN_SIZE_WORLD_COORDS;
+}
+
+void writeSprite(SpriteInstance* sprite, glm::vec2 position, glm::vec2 size, f32 rotation, u32 color, const glm::vec4& uvRect,
+                 i32 texIndex, f32 depth)
+{
+    sprite->position = position;
+    sprite->size = size;
+    sprite->rotation = rotation;
+    sprite->color = color;
+    sprite->uvRect[0] = packUnorm16(uvRect.x);
+    sprite->uvRect[1] = packUnorm16(uvRect.y);
+    sprite->uvRect[2] = packUnorm16(uvRect.z);
+    sprite->uvRect[3] = packUnorm16(uvRect.w);
+    sprite->texIndex = texIndex;
+    sprite->depth = depth;
+}
+
+void initSpriteRecorder(SpriteRecorder& recorder)
+{
+    recorder.opaqueArena = allocArena(MAX_QUAD_COUNT * sizeof(SpriteInstance), MemoryTag::Renderer);
+    recorder.translucentArena = allocArena(MAX_QUAD_COUNT * sizeof(SpriteInstance), MemoryTag::Renderer);
+    recorder.keyArena = allocArena(MAX_QUAD_COUNT * sizeof(u64), MemoryTag::Renderer);
+    recorder.opaqueSprites = (SpriteInstance*)recorder.opaqueArena->alloc(KAMSKI_INITIAL_QUAD_COUNT * sizeof(SpriteInstance), 1);
+    recorder.translucentSprites = (SpriteInstance*)recorder.translucentArena->alloc(KAMSKI_INITIAL_QUAD_COUNT * sizeof(SpriteInstance), 1);
+    recorder.keys = (u64*)recorder.keyArena->alloc(KAMSKI_INITIAL_QUAD_COUNT * sizeof(u64), 1);
+    recorder.opaqueCount = 0;
+    recorder.translucentCount = 0;
+    recorder.layer = RenderLayer::World;
+}
+
+u64 getSpriteRecorderBytes(const SpriteRecorder& recorder)
+{
+    return recorder.opaqueArena->size + recorder.translucentArena->size + recorder.keyArena->size;
+}
+
+// The recorder the calling thread's draws go to
+SpriteRecorder& getSpriteRecorder()
+{
+    return rData->recordingInParallel ? rData->threadRecorders[kamskiThreadIndex] : rData->spriteQueue;
+}
+
+// A full frame queue is drawn to make room. Only the main thread can draw, so a full thread recorder drops the sprite
+bool makeRoomForSprites()
+{
+    if (rData->recordingInParallel)
+    {
+        logWarningEvery(1.0, "A thread recorded over %llu sprites in one recordSpritesParallel, the rest is dropped",
+                        (unsigned long long)MAX_QUAD_COUNT);
+        return false;
+    }
+    flush();
+    return true;
+}
+
+// Records a world sprite in the current render layer
+void pushSprite(glm::vec2 position, glm::vec2 size, f32 rotation, u32 color, const glm::vec4& uvRect, i32 texIndex, f32 depth)
+{
+    SpriteRecorder& recorder = getSpriteRecorder();
+    // Fully opaque world sprites are alpha tested against the depth buffer, so their order does not matter
+    if (recorder.layer == RenderLayer::World && (color >> 24) == 0xff)
+    {
+        if (!reserveVertices(recorder.opaqueArena, recorder.opaqueSprites + recorder.opaqueCount, 1) && !makeRoomForSprites())
+        {
+            return;
+        }
+        writeSprite(&recorder.opaqueSprites[recorder.opaqueCount++], position, size, rotation, color, uvRect, texIndex, depth);
+        return;
+    }
+
+    if ((!reserveVertices(recorder.translucentArena, recorder.translucentSprites + recorder.translucentCount, 1) ||
+         !reserveVertices(recorder.keyArena, recorder.keys + recorder.translucentCount, 1)) && !makeRoomForSprites())
+    {
+        return;
+    }
+    const u32 index = recorder.translucentCount++;
+    writeSprite(&recorder.translucentSprites[index], position, size, rotation, color, uvRect, texIndex, depth);
+    recorder.keys[index] = makeSpriteKey(recorder.layer, depth, index);
+}
+
+// Appends what one batch recorded to the frame queue. Translucent keys are reindexed to their new slots,
+// so the sort sees the sprites exactly as if they were drawn one after another on the main thread
+void appendSpriteRun(const SpriteRecorder& from, const SpriteRun& run)
+{
+    SpriteRecorder& to = rData->spriteQueue;
+    const u32 opaqueCount = run.opaqueEnd - run.opaqueBegin;
+    if (!reserveVertices(to.opaqueArena, to.opaqueSprites + to.opaqueCount, opaqueCount))
+    {
+        flush();
+        reserveVertices(to.opaqueArena, to.opaqueSprites, opaqueCount);
+    }
+    memcpy(to.opaqueSprites + to.opaqueCount, from.opaqueSprites + run.opaqueBegin, opaqueCount * sizeof(SpriteInstance));
+    to.opaqueCount += opaqueCount;
+
+    const u32 translucentCount = run.translucentEnd - run.translucentBegin;
+    if (!reserveVertices(to.translucentArena, to.translucentSprites + to.translucentCount, translucentCount) ||
+        !reserveVertices(to.keyArena, to.keys + to.translucentCount, translucentCount))
+    {
+        flush();
+        reserveVertices(to.translucentArena, to.translucentSprites, translucentCount);
+        reserveVertices(to.keyArena, to.keys, translucentCount);
+    }
+    memcpy(to.translucentSprites + to.translucentCount, from.translucentSprites + run.translucentBegin,
+           translucentCount * sizeof(SpriteInstance));
+    for (u32 i = 0; i < translucentCount; i++)
+    {
+        to.keys[to.translucentCount] = (from.keys[run.translucentBegin + i] & ~0xffffffffull) | to.translucentCount;
+        to.translucentCount++;
+    }
+}
+
+struct SpriteRecordingState
+{
+    ParallelForFunc func;
+    void* data;
+    u32 batchSize;
+    SpriteRun* runs;
+};
+
+static void recordSpriteBatch(void* data, u32 begin, u32 end)
+{
+    SpriteRecordingState* state = (SpriteRecordingState*)data;
+    SpriteRecorder& recorder = getSpriteRecorder();
+    SpriteRun& run = state->runs[begin / state->batchSize];
+    run.threadIndex = kamskiThreadIndex;
+    run.opaqueBegin = recorder.opaqueCount;
+    run.translucentBegin = recorder.translucentCount;
+    state->func(state->data, begin, end);
+    run.opaqueEnd = recorder.opaqueCount;
+    run.translucentEnd = recorder.translucentCount;
+}
+
+void recordSpritesParallel(u32 count, u32 batchSize, ParallelForFunc func, void* data)
+{
+    assert(!rData->recordingInParallel);
+    if (count == 0)
+    {
+        return;
+    }
+    if (batchSize == 0)
+    {
+        batchSize = 1;
+    }
+    const u32 batchCount = (count - 1) / batchSize + 1;
+    if (batchCount == 1 || getWorkerCount() == 0)
+    {
+        func(data, 0, count);
+        return;
+    }
+
+    // Not scoped, parallelFor waits and the jobs this thread runs meanwhile allocate from the same frame arena
+    SpriteRun* runs = (SpriteRun*)temporaryAlloc(batchCount * sizeof(SpriteRun), MemoryTag::Renderer);
+    memset(runs, 0, batchCount * sizeof(SpriteRun));
+    for (SpriteRecorder& recorder : rData->threadRecorders)
+    {
+        recorder.layer = rData->spriteQueue.layer;
+    }
+
+    SpriteRecordingState state = {func, data, batchSize, runs};
+    rData->recordingInParallel = true;
+    parallelFor(count, batchSize, recordSpriteBatch, &state);
+    rData->recordingInParallel = false;
+
+    // Batch order is the order a serial loop would have recorded in, whichever thread ran each batch
+    for (u32 i = 0; i < batchCount; i++)
+    {
+        appendSpriteRun(rData->threadRecorders[runs[i].threadIndex], runs[i]);
+    }
+    for (SpriteRecorder& recorder : rData->threadRecorders)
+    {
+        recorder.opaqueCount = 0;
+        recorder.translucentCount = 0;
+    }
+}
+
+// Makes room for one more UI quad, the arena grows up to MAX_VERTEX_COUNT vertices and flushes after that
+void reserveQuadUI()
+{
+    if (!reserveVertices(rData->uiArena, rData->quadBufferUIPtr, 4))
+    {
+        flushUI();
+    }
+}
+
+// Makes room for [count] UI vertices in the current region. The ring doubles until it reaches MAX_VERTEX_COUNT
+// vertices a region and moves on to its next region after that
+void reserveUIRing(u64 count)
+{
+    const u64 capacity = rData->uiRing.regionSize / sizeof(Vertex);
+    if (count > capacity)
+    {
+        u64 newCapacity = capacity;
+        while (newCapacity < count)
+        {
+            newCapacity *= 2;
+        }
+        growStreamRing(rData->uiRing, std::min(newCapacity, MAX_VERTEX_COUNT) * sizeof(Vertex));
+        setupUIVertexArray();
+        resetUIRegion();
+    }
+    else if (rData->uiRingPtr + count > rData->uiRingEnd)
+    {
+        advanceStreamRing(rData->uiRing);
+        resetUIRegion();
+    }
+}
+
+// Called once the frame's draws are issued, the next frame writes into the next regions
+void advanceStreamRings()
+{
+    advanceStreamRing(rData->spriteRing);
+    resetSpriteRegion();
+    advanceStreamRing(rData->uiRing);
+    resetUIRegion();
+}
+
+RendererUsage getRendererUsage()
+{
+    RendererUsage retval;
+    {
+        std::lock_guard<std::mutex> lock(renderThreadState.mutex);
+        retval = renderThreadState.usage;
+    }
+    retval.cpuBytes = rData->quadArena->size + rData->lightVertexArena->size + rData->uiArena->size +
+                      getSpriteRecorderBytes(rData->spriteQueue);
+    for (const SpriteRecorder& recorder : rData->threadRecorders)
+    {
+        retval.cpuBytes += getSpriteRecorderBytes(recorder);
+    }
+    for (const RenderCommandList& list : renderThreadState.lists)
+    {
+        retval.cpuBytes += list.commands->size + list.data->size;
+    }
+    return retval;
+}
+
 void beginTriangleFan(glm::vec3 camera)
 {
     rData->aspectRatio = (f32)rData->resolutionX / (f32)rData->resolutionY;
     rData->camera = camera;
     worldPosToOpenGLPos(camera.x, camera.y);
     rData->quadBufferPtr = rData->quadBuffer;
-    
-    glUseProgram(rData->quadShaderPtr);
-    glUniform3f(glGetUniformLocation(rData->quadShaderPtr, "camera"), camera.x, camera.y, camera.z);
 }
 
 void addFanVertex(glm::vec2 pos, u64 index)
 {
+    if (!reserveVertices(rData->quadArena, rData->quadBufferPtr, 1))
+    {
+        logWarningEvery(1.0, "Triangle fan is over %llu vertices, the rest is dropped", MAX_VERTEX_COUNT);
+        return;
+    }
     u64 seed = index * 782349238;
     worldPosToOpenGLPos(pos.x, pos.y);
-    rData->quadBufferPtr->position = { pos, 0.0f };
-    rData->quadBufferPtr->texture = {0.0f, 0.0f};
-    rData->quadBufferPtr->color = glm::vec4(localStateRandomF32(seed), localStateRandomF32(seed * 23487), localStateRandomF32(seed * 49234), 0.3f);
-    rData->quadBufferPtr->texIndex = -1.0f;
+    rData->quadBufferPtr->position = pos;
+    rData->quadBufferPtr->uv[0] = 0;
+    rData->quadBufferPtr->uv[1] = 0;
+    rData->quadBufferPtr->color = packColor(glm::vec4(localStateRandomF32(seed), localStateRandomF32(seed * 23487), localStateRandomF32(seed * 49234), 0.3f));
+    rData->quadBufferPtr->texIndex = -1;
     rData->quadBufferPtr++;
 }
 
 void endTriangleFan()
 {
-    const i64 size = (u8*)rData->quadBufferPtr - (u8*)rData->quadBuffer;
-    assert(size / sizeof(Vertex) >= 3);
+    const u32 vertexCount = (u32)(rData->quadBufferPtr - rData->quadBuffer);
+    assert(vertexCount >= 3);
+    void* vertices = nullptr;
+    DrawTriangleFanCommand* command = recordRenderCommand<DrawTriangleFanCommand>(vertexCount * sizeof(Vertex), &vertices);
+    if (!command)
+    {
+        return;
+    }
+    memcpy(vertices, rData->quadBuffer, vertexCount * sizeof(Vertex));
+    command->vertices = (const Vertex*)vertices;
+    command->vertexCount = vertexCount;
+    command->camera = rData->camera;
+    worldPosToOpenGLPos(command->camera.x, command->camera.y);
+}
+
+void executeDrawTriangleFan(const DrawTriangleFanCommand& command)
+{
+    rData->usage.quadVertexHighWater = std::max(rData->usage.quadVertexHighWater, (u64)command.vertexCount);
     glUseProgram(rData->quadShaderPtr);
+    glUniform3f(glGetUniformLocation(rData->quadShaderPtr, "camera"), command.camera.x, command.camera.y, command.camera.z);
     glBindVertexArray(rData->quadVertexArray);
-    glBindBuffer(GL_ARRAY_BUFFER, rData->quadVertexBuffer);
-    glBufferSubData(GL_ARRAY_BUFFER, 0, size, rData->quadBuffer);
+    uploadStreamBuffer(rData->quadVertexBuffer, rData->quadVertexBufferSize, command.vertices, command.vertexCount * sizeof(Vertex));
     glBindFramebuffer(GL_FRAMEBUFFER, 0);
     
-    glDrawArrays(GL_TRIANGLE_FAN, 0, size / sizeof(Vertex));
+    glDrawArrays(GL_TRIANGLE_FAN, 0, command.vertexCount);
 }
 
 void addLight(glm::vec2 position, f32 radius, const glm::vec4& color)
@@ -922,7 +2022,8 @@ void renderLights()
     }
     glm::vec2 screenSize = getScreenSize();
 
-    Intersection* intersections = (Intersection*)temporaryAlloc(MB(8));
+    TempMemoryScope scratch(getTemporaryArena());
+    Intersection* intersections = (Intersection*)temporaryAlloc(MB(8), MemoryTag::Renderer);
     u32 intersectionCount = 0;
     addLightBlocker({rData->camera.x, rData->camera.y}, getScreenSize());
 
@@ -1006,6 +2107,14 @@ void renderLights()
         worldPosToOpenGLPos(glPos.x, glPos.y);
         f32 stub;
 
+        // One triangle per pair of neighbouring intersections plus the one closing the fan
+        if (!reserveVertices(rData->lightVertexArena, rData->lightVertexPtr, intersectionCount * 3))
+        {
+            logWarningEvery(1.0, "Light vertices are over %llu, lights are dropped", MAX_LIGHT_VERTEX_COUNT);
+            intersectionCount = 0;
+            continue;
+        }
+
         for (u32 i = 0; i != intersectionCount - 1; i++)
         {
             rData->lightVertexPtr->position = intersections[i].pos;
@@ -1052,43 +2161,69 @@ void renderLights()
         rData->lightVertexPtr++;
     }
 
-    u64 lightVertexBufferCount = rData->lightVertexPtr - rData->lightVertices;
-    assert(lightVertexBufferCount < MAX_VERTEX_COUNT);
+    const u32 vertexCount = (u32)(rData->lightVertexPtr - rData->lightVertices);
+    void* vertices = nullptr;
+    DrawLightsCommand* command = recordRenderCommand<DrawLightsCommand>(vertexCount * sizeof(LightVertex), &vertices);
+    if (!command)
+    {
+        return;
+    }
+    memcpy(vertices, rData->lightVertices, vertexCount * sizeof(LightVertex));
+    command->vertices = (const LightVertex*)vertices;
+    command->vertexCount = vertexCount;
+}
+
+void executeDrawLights(const DrawLightsCommand& command)
+{
+    rData->usage.lightVertexHighWater = std::max(rData->usage.lightVertexHighWater, (u64)command.vertexCount);
     glUseProgram(rData->lightShader);
     glBindVertexArray(rData->lightVertexArray);
-    glBindBuffer(GL_ARRAY_BUFFER, rData->lightVertexBuffer);
-    glBufferSubData(GL_ARRAY_BUFFER, 0, lightVertexBufferCount * sizeof(LightVertex), rData->lightVertices);
+    uploadStreamBuffer(rData->lightVertexBuffer, rData->lightVertexBufferSize, command.vertices, command.vertexCount * sizeof(LightVertex));
     glBindFramebuffer(GL_FRAMEBUFFER, rData->lightFramebuffer);
-    glDrawArrays(GL_TRIANGLES, 0, lightVertexBufferCount);
+    glDrawArrays(GL_TRIANGLES, 0, command.vertexCount);
 }
 
 void setBlurWholeScreen(bool value)
+{
+    recordRenderCommand<SetBlurCommand>()->blurWholeScreen = value;
+}
+
+void executeSetBlur(const SetBlurCommand& command)
 {
     glUseProgram(rData->mergeShader);
-    glUniform1f(glGetUniformLocation(rData->mergeShader, "blurWholeScreen"), (f32)value);
+    glUniform1f(glGetUniformLocation(rData->mergeShader, "blurWholeScreen"), (f32)command.blurWholeScreen);
 }
 
+// The game thread sees the new resolution right away, the framebuffers follow once the render thread gets here
 void resizeViewport(u32 x, u32 y)
 {
+    rData->resolutionX = x;
+    rData->resolutionY = y;
+    ResizeCommand* command = recordRenderCommand<ResizeCommand>();
+    command->x = x;
+    command->y = y;
+}
 
-    logDebug("%f %f");
+void executeResize(const ResizeCommand& command)
+{
+    const u32 x = command.x;
+    const u32 y = command.y;
+    logDebug("Resizing the framebuffers to %ux%u", x, y);
     glViewport(0, 0,
                x, y);
 
-    rData->resolutionX = x;
-    rData->resolutionY = y;
-
     glDeleteFramebuffers(1, &rData->lightFramebuffer);
     glDeleteFramebuffers(1, &rData->albedoFramebuffer);
 
     glDeleteTextures(1, &rData->lightTexture);
     glDeleteTextures(1, &rData->albedoTexture);
+    glDeleteRenderbuffers(1, &rData->albedoDepthBuffer);
 
     glCreateTextures(GL_TEXTURE_2D, 1, &rData->lightTexture);
     glBindTexture(GL_TEXTURE_2D, rData->lightTexture);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, rData->resolutionX, rData->resolutionY, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, x, y, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
 
     glBindTexture(GL_TEXTURE_2D, 0);
 
@@ -1103,59 +2238,221 @@ void resizeViewport(u32 x, u32 y)
     glBindTexture(GL_TEXTURE_2D, rData->albedoTexture);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, rData->resolutionX, rData->resolutionY, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, x, y, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
     glBindTexture(GL_TEXTURE_2D, 0);
 
+    glCreateRenderbuffers(1, &rData->albedoDepthBuffer);
+    glNamedRenderbufferStorage(rData->albedoDepthBuffer, GL_DEPTH_COMPONENT24, x, y);
+
     glCreateFramebuffers(1, &rData->albedoFramebuffer);
     glBindFramebuffer(GL_FRAMEBUFFER, rData->albedoFramebuffer);
     glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, rData->albedoTexture, 0);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, rData->albedoDepthBuffer);
 
     assert(glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE);
     glBindFramebuffer(GL_FRAMEBUFFER, 0);
 }
 
-u32 loadTexture(const char* textureFilePath)
+// Lowest row an image can sit on with its left edge at node [index], -1 when it does not fit there
+i32 skylineFit(const AtlasLayer& layer, u32 index, u32 width, u32 height)
 {
-    u32 retval = 0;
-    glCreateTextures(GL_TEXTURE_2D, 1, &retval);
-    glBindTexture(GL_TEXTURE_2D, retval);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-    i32 width, height, channels;
-    stbi_set_flip_vertically_on_load(true);
+    if (layer.nodes[index].x + width > ATLAS_SIZE)
+    {
+        return -1;
+    }
+
+    u32 y = 0;
+    u32 widthLeft = width;
+    for (u32 i = index; widthLeft > 0; i++)
+    {
+        y = std::max(y, (u32)layer.nodes[i].y);
+        if (y + height > ATLAS_SIZE)
+        {
+            return -1;
+        }
+        widthLeft -= std::min(widthLeft, (u32)layer.nodes[i].width);
+    }
+    return (i32)y;
+}
 
-    u8* image = stbi_load(textureFilePath, &width, &height, &channels, 0);
-    switch (channels)
+// Bottom left skyline packing: picks the spot that keeps the top of the image lowest, ties go to the narrower node
+bool skylinePack(AtlasLayer& layer, u32 width, u32 height, u32& x, u32& y)
+{
+    i32 bestIndex = -1;
+    u32 bestTop = UINT32_MAX;
+    u32 bestWidth = UINT32_MAX;
+    for (u32 i = 0; i < layer.nodeCount; i++)
     {
-        case 1:
+        const i32 fitY = skylineFit(layer, i, width, height);
+        if (fitY < 0)
+        {
+            continue;
+        }
+        const u32 top = (u32)fitY + height;
+        if (top < bestTop || (top == bestTop && layer.nodes[i].width < bestWidth))
         {
-            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_R8, GL_UNSIGNED_BYTE, image);
+            bestIndex = (i32)i;
+            bestTop = top;
+            bestWidth = layer.nodes[i].width;
         }
-        break;
+    }
+    if (bestIndex < 0)
+    {
+        return false;
+    }
+
+    x = layer.nodes[bestIndex].x;
+    y = bestTop - height;
+
+    // The new node sits on top of the image, the nodes under it shrink or go away
+    memmove(&layer.nodes[bestIndex + 1], &layer.nodes[bestIndex], (layer.nodeCount - bestIndex) * sizeof(SkylineNode));
+    layer.nodes[bestIndex] = {(u16)x, (u16)bestTop, (u16)width};
+    layer.nodeCount++;
 
-        case 2:
+    const u32 end = x + width;
+    const u32 next = bestIndex + 1;
+    while (next < layer.nodeCount && layer.nodes[next].x < end)
+    {
+        SkylineNode& node = layer.nodes[next];
+        const u32 overlap = end - node.x;
+        if (overlap < node.width)
         {
-            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RG, GL_UNSIGNED_BYTE, image);
+            node.x += (u16)overlap;
+            node.width -= (u16)overlap;
+            break;
         }
-        break;
+        memmove(&layer.nodes[next], &layer.nodes[next + 1], (layer.nodeCount - next - 1) * sizeof(SkylineNode));
+        layer.nodeCount--;
+    }
 
-        case 3:
+    for (u32 i = 0; i + 1 < layer.nodeCount;)
+    {
+        if (layer.nodes[i].y == layer.nodes[i + 1].y)
         {
-            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, image);
+            layer.nodes[i].width += layer.nodes[i + 1].width;
+            memmove(&layer.nodes[i + 1], &layer.nodes[i + 2], (layer.nodeCount - i - 2) * sizeof(SkylineNode));
+            layer.nodeCount--;
         }
-        break;
+        else
+        {
+            i++;
+        }
+    }
+    return true;
+}
+
+void addAtlasLayer()
+{
+    AtlasLayer& layer = rData->atlasLayers[rData->atlasLayerCount];
+    layer.nodes[0] = {0, 0, (u16)ATLAS_SIZE};
+    layer.nodeCount = 1;
+    rData->atlasLayerCount++;
+    recordRenderCommand<AddAtlasLayerCommand>()->layerCount = rData->atlasLayerCount;
+}
+
+// Array textures cannot grow in place, the packed layers are copied into a new texture with one more layer
+void executeAddAtlasLayer(const AddAtlasLayerCommand& command)
+{
+    const u32 layerCount = command.layerCount;
+    u32 atlas = 0;
+    glCreateTextures(GL_TEXTURE_2D_ARRAY, 1, &atlas);
+    glTextureStorage3D(atlas, 1, GL_RGBA8, ATLAS_SIZE, ATLAS_SIZE, layerCount);
+    glTextureParameteri(atlas, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTextureParameteri(atlas, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTextureParameteri(atlas, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTextureParameteri(atlas, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glClearTexImage(atlas, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+
+    if (layerCount > 1)
+    {
+        glCopyImageSubData(rData->atlasTexture, GL_TEXTURE_2D_ARRAY, 0, 0, 0, 0,
+                           atlas, GL_TEXTURE_2D_ARRAY, 0, 0, 0, 0,
+                           ATLAS_SIZE, ATLAS_SIZE, layerCount - 1);
+        glDeleteTextures(1, &rData->atlasTexture);
+    }
+    rData->atlasTexture = atlas;
+}
+
+// Packs an RGBA8 image into the first layer with room, surrounded by a one texel gutter that repeats its edges
+// so neighbouring images never bleed in. Returns the texture id, 0 when the atlas is full
+u32 addAtlasTexture(const u8* pixels, u32 width, u32 height)
+{
+    const u32 paddedWidth = width + 2;
+    const u32 paddedHeight = height + 2;
+    if (rData->textureCount == KAMSKI_MAX_TEXTURE_COUNT || paddedWidth > ATLAS_SIZE || paddedHeight > ATLAS_SIZE)
+    {
+        logError("No atlas room for a %ux%u texture", width, height);
+        return 0;
+    }
 
-        case 4:
+    u32 layer = 0;
+    u32 x = 0;
+    u32 y = 0;
+    while (layer < rData->atlasLayerCount && !skylinePack(rData->atlasLayers[layer], paddedWidth, paddedHeight, x, y))
+    {
+        layer++;
+    }
+    if (layer == rData->atlasLayerCount)
+    {
+        if (layer == KAMSKI_MAX_ATLAS_LAYERS)
         {
-            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, image);
+            logError("All %d atlas layers are full", KAMSKI_MAX_ATLAS_LAYERS);
+            return 0;
         }
-        break;
+        addAtlasLayer();
+        skylinePack(rData->atlasLayers[layer], paddedWidth, paddedHeight, x, y);
+    }
+
+    void* paddedBytes = nullptr;
+    UploadAtlasImageCommand* command = recordRenderCommand<UploadAtlasImageCommand>(paddedWidth * paddedHeight * sizeof(u32), &paddedBytes);
+    if (!command)
+    {
+        return 0;
+    }
+    u32* padded = (u32*)paddedBytes;
+    const u32* source = (const u32*)pixels;
+    for (u32 row = 0; row < paddedHeight; row++)
+    {
+        const u32 sourceRow = std::clamp(row, 1u, height) - 1;
+        u32* dest = padded + row * paddedWidth;
+        memcpy(dest + 1, source + sourceRow * width, width * sizeof(u32));
+        dest[0] = dest[1];
+        dest[paddedWidth - 1] = dest[paddedWidth - 2];
+    }
+    command->pixels = padded;
+    command->x = x;
+    command->y = y;
+    command->layer = layer;
+    command->width = paddedWidth;
+    command->height = paddedHeight;
+
+    const u32 texId = rData->textureCount++;
+    rData->textures[texId].uvRect = glm::vec4{x + 1, y + 1, x + 1 + width, y + 1 + height} / (f32)ATLAS_SIZE;
+    rData->textures[texId].packedUVs = packUVRect(rData->textures[texId].uvRect);
+    rData->textures[texId].layer = layer;
+    return texId;
+}
+
+void executeUploadAtlasImage(const UploadAtlasImageCommand& command)
+{
+    glTextureSubImage3D(rData->atlasTexture, 0, command.x, command.y, command.layer, command.width, command.height, 1,
+                        GL_RGBA, GL_UNSIGNED_BYTE, command.pixels);
+}
 
+u32 loadTexture(const char* textureFilePath)
+{
+    i32 width, height, channels;
+    stbi_set_flip_vertically_on_load(true);
+
+    // Expanded to RGBA whatever the file holds, the atlas has a single format
+    u8* image = stbi_load(textureFilePath, &width, &height, &channels, 4);
+    if (!image)
+    {
+        logError("Could not load texture %s", textureFilePath);
+        return 0;
     }
+    const u32 retval = addAtlasTexture(image, width, height);
     stbi_image_free(image);
-    glBindTexture(GL_TEXTURE_2D, 0);
     return retval;
 }
 
@@ -1165,19 +2462,36 @@ void beginBatch(glm::vec3 camera)
 
     rData->camera = camera;
     worldPosToOpenGLPos(camera.x, camera.y);
-    rData->quadBufferPtr = rData->quadBuffer;
+    rData->spriteQueue.opaqueCount = 0;
+    rData->spriteQueue.translucentCount = 0;
+    rData->spriteQueue.layer = RenderLayer::World;
     rData->lightBufferPtr = rData->lightBuffer;
     rData->lightBlockerBufferPtr = rData->lightBlockerBuffer;
     rData->lightVertexPtr = rData->lightVertices;
+    rData->worldToClip = {1.0f / (SCREEN_SIZE_WORLD_COORDS * rData->aspectRatio), 1.0f / SCREEN_SIZE_WORLD_COORDS};
 
-    glUseProgram(rData->quadShaderPtr);
-    glUniform3f(glGetUniformLocation(rData->quadShaderPtr, "camera"), camera.x, camera.y, camera.z);
+    BeginBatchCommand* command = recordRenderCommand<BeginBatchCommand>();
+    command->camera = camera;
+    command->worldToClip = rData->worldToClip;
+}
+
+void executeBeginBatch(const BeginBatchCommand& command)
+{
+    const glm::vec3 camera = command.camera;
+    glUseProgram(rData->spriteShader);
+    glUniform3f(glGetUniformLocation(rData->spriteShader, "camera"), camera.x, camera.y, camera.z);
+    glUniform2f(glGetUniformLocation(rData->spriteShader, "worldToClip"), command.worldToClip.x, command.worldToClip.y);
     glUseProgram(rData->lightShader);
     glUniform3f(glGetUniformLocation(rData->lightShader, "camera"), camera.x, camera.y, camera.z);
     glUseProgram(0);
 }
 
 void mergeFramebuffers()
+{
+    recordRenderCommand<MergeFramebuffersCommand>();
+}
+
+void executeMergeFramebuffers()
 {
     glUseProgram(rData->mergeShader);
     glBindFramebuffer(GL_FRAMEBUFFER, 0);
@@ -1195,42 +2509,119 @@ void endBatch()
     flush();
     renderLights();
     mergeFramebuffers();
-    glUseProgram(rData->quadShaderPtr);
-    glUniform3f(glGetUniformLocation(rData->quadShaderPtr, "camera"), 0, 0, 1);
     flushUI();
+    recordRenderCommand<EndBatchCommand>();
 }
 
+// Records the queued sprites as one list, the opaque ones first and the translucent ones sorted after them
 void flush()
 {
-    const i64 size = (u8*)rData->quadBufferPtr - (u8*)rData->quadBuffer;
-    glUseProgram(rData->quadShaderPtr);
-    glBindVertexArray(rData->quadVertexArray);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, rData->quadVertexIndicesBuffer);
-    glBindBuffer(GL_ARRAY_BUFFER, rData->quadVertexBuffer);
-    glBufferSubData(GL_ARRAY_BUFFER, 0, size, rData->quadBuffer);
-    glBindFramebuffer(GL_FRAMEBUFFER, rData->albedoFramebuffer);
+    SpriteRecorder& queue = rData->spriteQueue;
+    const u32 opaqueCount = queue.opaqueCount;
+    const u32 translucentCount = queue.translucentCount;
+    const u32 spriteCount = opaqueCount + translucentCount;
+    if (!spriteCount)
+    {
+        return;
+    }
 
-    for (u32 i = 0; i < rData->texSlotIndex; i++)
-        glBindTextureUnit(i, rData->texSlots[i]);
+    void* spriteBytes = nullptr;
+    DrawSpritesCommand* command = recordRenderCommand<DrawSpritesCommand>(spriteCount * sizeof(SpriteInstance), &spriteBytes);
+    if (command)
+    {
+        SpriteInstance* sprites = (SpriteInstance*)spriteBytes;
+        memcpy(sprites, queue.opaqueSprites, opaqueCount * sizeof(SpriteInstance));
+        if (translucentCount)
+        {
+            TempMemoryScope scratch(getTemporaryArena());
+            u64* sortScratch = (u64*)temporaryAlloc(translucentCount * sizeof(u64), MemoryTag::Renderer);
+            const u64* keys = radixSortSpriteKeys(queue.keys, sortScratch, translucentCount);
+            for (u32 i = 0; i < translucentCount; i++)
+            {
+                sprites[opaqueCount + i] = queue.translucentSprites[(u32)keys[i]];
+            }
+        }
+        command->sprites = sprites;
+        command->opaqueCount = opaqueCount;
+        command->translucentCount = translucentCount;
+    }
+    queue.opaqueCount = 0;
+    queue.translucentCount = 0;
+}
 
-    glDrawElements(GL_TRIANGLES, rData->indexCount, GL_UNSIGNED_INT, nullptr);
+// Draws the sprites in two instanced draws. With every texture in the atlas they share all state,
+// the opaque ones go first and fill the depth buffer, then the translucent ones blend over them
+void executeDrawSprites(const DrawSpritesCommand& command)
+{
+    const u32 opaqueCount = command.opaqueCount;
+    const u32 translucentCount = command.translucentCount;
+    const u32 spriteCount = opaqueCount + translucentCount;
+    rData->usage.spriteHighWater = std::max(rData->usage.spriteHighWater, (u64)spriteCount);
+
+    reserveSpriteRing(spriteCount);
+    const u32 baseInstance = (u32)(((u8*)rData->spritePtr - rData->spriteRing.mapped) / sizeof(SpriteInstance));
+    memcpy(rData->spritePtr, command.sprites, spriteCount * sizeof(SpriteInstance));
+    rData->spritePtr += spriteCount;
+
+    glUseProgram(rData->spriteShader);
+    glBindVertexArray(rData->spriteVertexArray);
+    glBindFramebuffer(GL_FRAMEBUFFER, rData->albedoFramebuffer);
+    glBindTextureUnit(0, rData->atlasTexture);
+    glEnable(GL_DEPTH_TEST);
 
-    rData->indexCount = 0;
-    rData->texSlotIndex = 0;
+    if (opaqueCount)
+    {
+        glUniform1f(glGetUniformLocation(rData->spriteShader, "alphaCutoff"), SPRITE_ALPHA_CUTOFF);
+        glDrawArraysInstancedBaseInstance(GL_TRIANGLE_STRIP, 0, 4, (i32)opaqueCount, baseInstance);
+    }
+    if (translucentCount)
+    {
+        // Tested against the opaque sprites but without hiding each other
+        glDepthMask(GL_FALSE);
+        glUniform1f(glGetUniformLocation(rData->spriteShader, "alphaCutoff"), 0.0f);
+        glDrawArraysInstancedBaseInstance(GL_TRIANGLE_STRIP, 0, 4, (i32)translucentCount, baseInstance + opaqueCount);
+        glDepthMask(GL_TRUE);
+    }
+    glDisable(GL_DEPTH_TEST);
 }
 
 void swapClear()
 {
+    recordRenderCommand<PresentCommand>()->recordedTime = kamskiPlatformGetTime();
+    submitRenderList(true);
+}
+
+// Presents, publishes the frame's timings and clears the framebuffers for the next frame
+void executePresent(const PresentCommand& command)
+{
+    RenderThreadInternal& state = renderThreadState;
     const float ambient = 0.1f;
     SwapBuffers(rData->deviceContext);
 
+    const f64 presentTime = kamskiPlatformGetTime();
+    rData->usage.gpuBytes = (rData->spriteRing.regionSize + rData->uiRing.regionSize) * STREAM_REGION_COUNT +
+                            rData->quadVertexBufferSize + rData->lightVertexBufferSize +
+                            rData->indexBufferQuadCount * 6 * sizeof(u32);
+    {
+        std::lock_guard<std::mutex> lock(state.mutex);
+        const u64 sample = state.framesPresented++ % KAMSKI_FRAME_COUNT;
+        state.latencies[sample] = presentTime - command.recordedTime;
+        state.renderTimes[sample] = state.frameRenderTime + (presentTime - state.replayStart);
+        state.presentIntervals[sample] = presentTime - state.lastPresentTime;
+        state.usage = rData->usage;
+    }
+    // Whatever the list holds after the present counts towards the next frame
+    state.frameRenderTime = 0.0;
+    state.replayStart = presentTime;
+    state.lastPresentTime = presentTime;
+
     glBindFramebuffer(GL_FRAMEBUFFER, rData->lightFramebuffer);
     glClearColor(ambient, ambient, ambient, 1.0f);
     glClear(GL_COLOR_BUFFER_BIT);
 
     glClearColor(0, 0, 0, 1.0);
     glBindFramebuffer(GL_FRAMEBUFFER, rData->albedoFramebuffer);
-    glClear(GL_COLOR_BUFFER_BIT);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
     glClearColor(0, 0, 0, 1.0);
     glBindFramebuffer(GL_FRAMEBUFFER, 0);
@@ -1238,297 +2629,245 @@ void swapClear()
 
 }
 
-void drawTexturedQuad(glm::vec2 position, glm::vec2 size, const u32 texId, f32 rotation)
+void drawTexturedQuad(glm::vec2 position, glm::vec2 size, const u32 texId, f32 rotation, f32 depth)
 {
-    glm::vec2 cullSize = glm::abs(size);
-    if (( position.x + cullSize.x / 2.0f - rData->camera.x) * rData->camera.z < -SCREEN_SIZE_WORLD_COORDS * rData->aspectRatio ||
-        ( position.x - cullSize.x / 2.0f - rData->camera.x) * rData->camera.z >  SCREEN_SIZE_WORLD_COORDS * rData->aspectRatio ||
-        ( position.y + cullSize.y / 2.0f - rData->camera.y) * rData->camera.z < -SCREEN_SIZE_WORLD_COORDS ||
-        ( position.y - cullSize.y / 2.0f - rData->camera.y) * rData->camera.z >  SCREEN_SIZE_WORLD_COORDS)
+    if (isSpriteCulled(position, size))
         return;
 
+    const AtlasRegion& region = getTextureRegion(texId);
+    pushSprite(position, size, rotation, 0xffffffff, region.uvRect, (i32)region.layer, depth);
+}
 
-    if (rData->indexCount >= MAX_INDEX_COUNT)
-    {
-        flush();
-        rData->quadBufferPtr = rData->quadBuffer;
-    }
-
-    f32 texIndex = -1.0f;
-
-    for (u32 i = 0; i < rData->texSlotIndex; i++)
-    {
-        if (rData->texSlots[i] == texId)
-        {
-            texIndex = (f32)i;
-            break;
-        }
-    }
-
-    if (texIndex == -1.0f)
-    {
-        if (rData->texSlotIndex == 32)
-        {
-            flush();
-            rData->quadBufferPtr = rData->quadBuffer;
-        }
-
-        rData->texSlots[rData->texSlotIndex] = texId;
-        texIndex = (f32)rData->texSlotIndex;
-        rData->texSlotIndex++;
-    }
-
-    glm::vec2 pos1 = glm::vec2{ -size.x, -size.y} / 2.0f;
-    glm::vec2 pos2 = glm::vec2{  size.x, -size.y} / 2.0f;
-    glm::vec2 pos3 = glm::vec2{  size.x,  size.y} / 2.0f;
-    glm::vec2 pos4 = glm::vec2{ -size.x,  size.y} / 2.0f;
-
-    pos1 = rotateVec2(pos1, rotation) + glm::vec2{position.x, position.y};
-    pos2 = rotateVec2(pos2, rotation) + glm::vec2{position.x, position.y};
-    pos3 = rotateVec2(pos3, rotation) + glm::vec2{position.x, position.y};
-    pos4 = rotateVec2(pos4, rotation) + glm::vec2{position.x, position.y};
-
-    worldPosToOpenGLPos(pos1.x, pos1.y);
-    worldPosToOpenGLPos(pos2.x, pos2.y);
-    worldPosToOpenGLPos(pos3.x, pos3.y);
-    worldPosToOpenGLPos(pos4.x, pos4.y);
-
-    rData->quadBufferPtr->position = { pos1, 0.0f };
-    rData->quadBufferPtr->color = {1.0f, 1.0f, 1.0f, 1.0f};
-    rData->quadBufferPtr->texture = {0.0f, 0.0f};
-    rData->quadBufferPtr->texIndex = texIndex;
-    rData->quadBufferPtr++;
+void drawQuad(glm::vec2 position, glm::vec2 size, const u32 texId, const glm::vec4& color, f32 rotation, f32 depth)
+{
+    if (isSpriteCulled(position, size))
+        return;
 
-    rData->quadBufferPtr->position = { pos2, 0.0f };
-    rData->quadBufferPtr->color = {1.0f, 1.0f, 1.0f, 1.0f};
-    rData->quadBufferPtr->texture = { 1.0f, 0.0f };
-    rData->quadBufferPtr->texIndex = texIndex;
-    rData->quadBufferPtr++;
+    const AtlasRegion& region = getTextureRegion(texId);
+    pushSprite(position, size, rotation, packColor(color), region.uvRect, (i32)region.layer, depth);
+}
 
-    rData->quadBufferPtr->position = { pos3, 0.0f };
-    rData->quadBufferPtr->color = {1.0f, 1.0f, 1.0f, 1.0f};
-    rData->quadBufferPtr->texture = { 1.0f, 1.0f };
-    rData->quadBufferPtr->texIndex = texIndex;
-    rData->quadBufferPtr++;
 
-    rData->quadBufferPtr->position = { pos4, 0.0f };
-    rData->quadBufferPtr->color = {1.0f, 1.0f, 1.0f, 1.0f};
-    rData->quadBufferPtr->texture = { 0.0f, 1.0f };
-    rData->quadBufferPtr->texIndex = texIndex;
+void drawQuadUI(glm::vec2 position, glm::vec2 size, const glm::vec4& color, f32 rotation)
+{
+    reserveQuadUI();
+    writeQuadVertices(rData->quadBufferUIPtr, position, size, rotation, packColor(color), FULL_UV_RECT, -1, rData->worldToClip);
+    rData->quadBufferUIPtr += 4;
+}
 
-    rData->quadBufferPtr++;
+void drawColoredQuad(glm::vec2 position, glm::vec2 size, const glm::vec4& color, f32 rotation, f32 depth)
+{
+    if (isSpriteCulled(position, size))
+        return;
 
-    rData->indexCount += 6;
+    pushSprite(position, size, rotation, packColor(color), {0.0f, 0.0f, 1.0f, 1.0f}, -1, depth);
 }
 
-void drawQuad(glm::vec2 position, glm::vec2 size, const u32 texId, const glm::vec4& color, f32 rotation)
+TileMapId createTileMap(glm::uvec2 size, glm::vec2 tileSize, glm::vec2 origin)
 {
-    glm::vec2 cullSize = glm::abs(size);
-    if (( position.x + cullSize.x / 2.0f - rData->camera.x) * rData->camera.z < -SCREEN_SIZE_WORLD_COORDS * rData->aspectRatio ||
-        ( position.x - cullSize.x / 2.0f - rData->camera.x) * rData->camera.z >  SCREEN_SIZE_WORLD_COORDS * rData->aspectRatio ||
-        ( position.y + cullSize.y / 2.0f - rData->camera.y) * rData->camera.z < -SCREEN_SIZE_WORLD_COORDS ||
-        ( position.y - cullSize.y / 2.0f - rData->camera.y) * rData->camera.z >  SCREEN_SIZE_WORLD_COORDS)
-        return;
-    
-    if (rData->indexCount >= MAX_INDEX_COUNT)
+    TileMapId id = 1;
+    while (id < KAMSKI_MAX_TILE_MAP_COUNT && rData->tileMaps[id].arena)
     {
-        flush();
-        rData->quadBufferPtr = rData->quadBuffer;
+        id++;
     }
-    
-    f32 texIndex = -1.0f;
-    
-    for (u32 i = 0; i < rData->texSlotIndex; i++)
+    if (id == KAMSKI_MAX_TILE_MAP_COUNT)
     {
-        if (rData->texSlots[i] == texId)
-        {
-            texIndex = (f32)i;
-            break;
-        }
+        logError("More than %d tile maps", KAMSKI_MAX_TILE_MAP_COUNT - 1);
+        return 0;
     }
-    
-    if (texIndex == -1.0f)
+
+    TileMap& map = rData->tileMaps[id];
+    map.size = size;
+    map.chunkCount = (size + (u32)TILE_CHUNK_SIZE - 1u) / (u32)TILE_CHUNK_SIZE;
+    map.tileSize = tileSize;
+    map.origin = origin;
+
+    const u64 tileCount = (u64)size.x * size.y;
+    const u64 chunkCount = (u64)map.chunkCount.x * map.chunkCount.y;
+    map.arena = allocArena(tileCount * sizeof(u32) + chunkCount * sizeof(TileChunk) + 8, MemoryTag::Renderer);
+    map.tiles = (u32*)map.arena->alloc(tileCount * sizeof(u32), alignof(u32));
+    map.chunks = (TileChunk*)map.arena->alloc(chunkCount * sizeof(TileChunk), alignof(TileChunk));
+    memset(map.tiles, 0, tileCount * sizeof(u32));
+    for (u64 i = 0; i < chunkCount; i++)
     {
-        if (rData->texSlotIndex == 32)
-        {
-            flush();
-            rData->quadBufferPtr = rData->quadBuffer;
-        }
-        
-        rData->texSlots[rData->texSlotIndex] = texId;
-        texIndex = (f32)rData->texSlotIndex;
-        rData->texSlotIndex++;
+        map.chunks[i] = {0, false};
     }
-    
-    glm::vec2 pos1 = glm::vec2{ -size.x, -size.y} / 2.0f;
-    glm::vec2 pos2 = glm::vec2{  size.x, -size.y} / 2.0f;
-    glm::vec2 pos3 = glm::vec2{  size.x,  size.y} / 2.0f;
-    glm::vec2 pos4 = glm::vec2{ -size.x,  size.y} / 2.0f;
-    
-    pos1 = rotateVec2(pos1, rotation) + glm::vec2{position.x, position.y};
-    pos2 = rotateVec2(pos2, rotation) + glm::vec2{position.x, position.y};
-    pos3 = rotateVec2(pos3, rotation) + glm::vec2{position.x, position.y};
-    pos4 = rotateVec2(pos4, rotation) + glm::vec2{position.x, position.y};
-    
-    worldPosToOpenGLPos(pos1.x, pos1.y);
-    worldPosToOpenGLPos(pos2.x, pos2.y);
-    worldPosToOpenGLPos(pos3.x, pos3.y);
-    worldPosToOpenGLPos(pos4.x, pos4.y);
-    
-    rData->quadBufferPtr->position = { pos1, 0.0f };
-    rData->quadBufferPtr->color = color;
-    rData->quadBufferPtr->texture = {0.0f, 0.0f};
-    rData->quadBufferPtr->texIndex = texIndex;
-    rData->quadBufferPtr++;
-    
-    rData->quadBufferPtr->position = { pos2, 0.0f };
-    rData->quadBufferPtr->color = color;
-    rData->quadBufferPtr->texture = { 1.0f, 0.0f };
-    rData->quadBufferPtr->texIndex = texIndex;
-    rData->quadBufferPtr++;
-    
-    rData->quadBufferPtr->position = { pos3, 0.0f };
-    rData->quadBufferPtr->color = color;
-    rData->quadBufferPtr->texture = { 1.0f, 1.0f };
-    rData->quadBufferPtr->texIndex = texIndex;
-    rData->quadBufferPtr++;
-    
-    rData->quadBufferPtr->position = { pos4, 0.0f };
-    rData->quadBufferPtr->color = color;
-    rData->quadBufferPtr->texture = { 0.0f, 1.0f };
-    rData->quadBufferPtr->texIndex = texIndex;
-    
-    rData->quadBufferPtr++;
-    
-    rData->indexCount += 6;
+
+    CreateTileMapCommand* command = recordRenderCommand<CreateTileMapCommand>();
+    command->id = id;
+    command->instanceCount = chunkCount * TILE_CHUNK_TILE_COUNT;
+    return id;
 }
 
+void executeCreateTileMap(const CreateTileMapCommand& command)
+{
+    TileMapBuffers& buffers = rData->tileMapBuffers[command.id];
+    glCreateBuffers(1, &buffers.instanceBuffer);
+    glNamedBufferStorage(buffers.instanceBuffer, command.instanceCount * sizeof(SpriteInstance), nullptr, GL_DYNAMIC_STORAGE_BIT);
+    glCreateVertexArrays(1, &buffers.vertexArray);
+    setSpriteAttributes(buffers.vertexArray, buffers.instanceBuffer);
+    glBindVertexArray(0);
+}
 
-void drawQuadUI(glm::vec2 position, glm::vec2 size, const glm::vec4& color, f32 rotation)
+// The id can be handed out again right away, its new buffers are created after the render thread deleted these
+void destroyTileMap(TileMapId id)
 {
-    
-    if (rData->indexCountUI >= MAX_INDEX_COUNT)
-    {
-        flushUI();
-        rData->quadBufferUIPtr = rData->quadBufferUI;
-    }
-    
-    const f32 texIndex = -1.0f;
-    
-    glm::vec2 pos1 = glm::vec2{ -size.x, -size.y} / 2.0f;
-    glm::vec2 pos2 = glm::vec2{  size.x, -size.y} / 2.0f;
-    glm::vec2 pos3 = glm::vec2{  size.x,  size.y} / 2.0f;
-    glm::vec2 pos4 = glm::vec2{ -size.x,  size.y} / 2.0f;
-    
-    pos1 = rotateVec2(pos1, rotation) + glm::vec2{position.x, position.y};
-    pos2 = rotateVec2(pos2, rotation) + glm::vec2{position.x, position.y};
-    pos3 = rotateVec2(pos3, rotation) + glm::vec2{position.x, position.y};
-    pos4 = rotateVec2(pos4, rotation) + glm::vec2{position.x, position.y};
-    
-    worldPosToOpenGLPos(pos1.x, pos1.y);
-    worldPosToOpenGLPos(pos2.x, pos2.y);
-    worldPosToOpenGLPos(pos3.x, pos3.y);
-    worldPosToOpenGLPos(pos4.x, pos4.y);
-    
-    rData->quadBufferUIPtr->position = { pos1, 0.0f };
-    rData->quadBufferUIPtr->texture = {0.0f, 0.0f};
-    rData->quadBufferUIPtr->color = color;
-    rData->quadBufferUIPtr->texIndex = texIndex;
-    
-    rData->quadBufferUIPtr++;
-    rData->quadBufferUIPtr->position = { pos2, 0.0f };
-    rData->quadBufferUIPtr->texture = { 1.0f, 0.0f };
-    rData->quadBufferUIPtr->color = color;
-    rData->quadBufferUIPtr->texIndex = texIndex;
-    rData->quadBufferUIPtr++;
-    
-    rData->quadBufferUIPtr->position = { pos3, 0.0f };
-    rData->quadBufferUIPtr->texture = { 1.0f, 1.0f };
-    rData->quadBufferUIPtr->color = color;
-    rData->quadBufferUIPtr->texIndex = texIndex;
-    
-    rData->quadBufferUIPtr++;
-    
-    rData->quadBufferUIPtr->position = { pos4, 0.0f };
-    rData->quadBufferUIPtr->texture = { 0.0f, 1.0f };
-    rData->quadBufferUIPtr->color = color;
-    rData->quadBufferUIPtr->texIndex = texIndex;
-    
-    rData->quadBufferUIPtr++;
-    
-    rData->indexCountUI += 6;
+    TileMap& map = rData->tileMaps[id];
+    assert(id != 0 && id < KAMSKI_MAX_TILE_MAP_COUNT && map.arena);
+    recordRenderCommand<DestroyTileMapCommand>()->id = id;
+    freeArena(map.arena);
+    map = {};
 }
 
-void drawColoredQuad(glm::vec2 position, glm::vec2 size, const glm::vec4& color, f32 rotation)
+void executeDestroyTileMap(const DestroyTileMapCommand& command)
 {
-    glm::vec2 cullSize = glm::abs(size);
-    if (( position.x + cullSize.x / 2.0f - rData->camera.x) * rData->camera.z < -SCREEN_SIZE_WORLD_COORDS * rData->aspectRatio ||
-        ( position.x - cullSize.x / 2.0f - rData->camera.x) * rData->camera.z >  SCREEN_SIZE_WORLD_COORDS * rData->aspectRatio ||
-        ( position.y + cullSize.y / 2.0f - rData->camera.y) * rData->camera.z < -SCREEN_SIZE_WORLD_COORDS ||
-        ( position.y - cullSize.y / 2.0f - rData->camera.y) * rData->camera.z >  SCREEN_SIZE_WORLD_COORDS)
-        return;
-    
-    if (rData->indexCount >= MAX_INDEX_COUNT)
+    TileMapBuffers& buffers = rData->tileMapBuffers[command.id];
+    glDeleteVertexArrays(1, &buffers.vertexArray);
+    glDeleteBuffers(1, &buffers.instanceBuffer);
+    buffers = {};
+}
+
+void setTile(TileMapId id, glm::uvec2 tile, u32 texId)
+{
+    TileMap& map = rData->tileMaps[id];
+    assert(map.arena && tile.x < map.size.x && tile.y < map.size.y);
+    u32& tileTexId = map.tiles[tile.y * map.size.x + tile.x];
+    if (tileTexId == texId)
     {
-        flush();
-        rData->quadBufferPtr = rData->quadBuffer;
+        return;
     }
+    tileTexId = texId;
+    map.chunks[(tile.y / TILE_CHUNK_SIZE) * map.chunkCount.x + tile.x / TILE_CHUNK_SIZE].dirty = true;
+}
 
-    const f32 texIndex = -1.0f;
-
-    glm::vec2 pos1 = glm::vec2{ -size.x, -size.y} / 2.0f;
-    glm::vec2 pos2 = glm::vec2{  size.x, -size.y} / 2.0f;
-    glm::vec2 pos3 = glm::vec2{  size.x,  size.y} / 2.0f;
-    glm::vec2 pos4 = glm::vec2{ -size.x,  size.y} / 2.0f;
-
-    pos1 = rotateVec2(pos1, rotation) + glm::vec2{position.x, position.y};
-    pos2 = rotateVec2(pos2, rotation) + glm::vec2{position.x, position.y};
-    pos3 = rotateVec2(pos3, rotation) + glm::vec2{position.x, position.y};
-    pos4 = rotateVec2(pos4, rotation) + glm::vec2{position.x, position.y};
+// Writes the non empty tiles of a chunk to the start of its slot in the instance buffer
+void rebuildTileChunk(TileMapId id, u32 chunkX, u32 chunkY)
+{
+    TileMap& map = rData->tileMaps[id];
+    TempMemoryScope scratch(getTemporaryArena());
+    SpriteInstance* instances = (SpriteInstance*)temporaryAlloc(TILE_CHUNK_TILE_COUNT * sizeof(SpriteInstance), MemoryTag::Renderer);
+    u32 instanceCount = 0;
 
-    worldPosToOpenGLPos(pos1.x, pos1.y);
-    worldPosToOpenGLPos(pos2.x, pos2.y);
-    worldPosToOpenGLPos(pos3.x, pos3.y);
-    worldPosToOpenGLPos(pos4.x, pos4.y);
+    const u32 endX = std::min((chunkX + 1) * (u32)TILE_CHUNK_SIZE, map.size.x);
+    const u32 endY = std::min((chunkY + 1) * (u32)TILE_CHUNK_SIZE, map.size.y);
+    for (u32 y = chunkY * TILE_CHUNK_SIZE; y < endY; y++)
+    {
+        for (u32 x = chunkX * TILE_CHUNK_SIZE; x < endX; x++)
+        {
+            const u32 texId = map.tiles[y * map.size.x + x];
+            if (!texId)
+            {
+                continue;
+            }
+            const AtlasRegion& region = getTextureRegion(texId);
+            const glm::vec2 position = map.origin + (glm::vec2{(f32)x, (f32)y} + 0.5f) * map.tileSize;
+            writeSprite(&instances[instanceCount++], position, map.tileSize, 0.0f, 0xffffffff, region.uvRect, (i32)region.layer,
+                        FARTHEST_SPRITE_DEPTH);
+        }
+    }
 
-    rData->quadBufferPtr->position = { pos1, 0.0f };
-    rData->quadBufferPtr->texture = {0.0f, 0.0f};
-    rData->quadBufferPtr->color = color;
-    rData->quadBufferPtr->texIndex = texIndex;
+    const u32 chunkIndex = chunkY * map.chunkCount.x + chunkX;
+    if (instanceCount)
+    {
+        void* uploadBytes = nullptr;
+        UploadTileChunkCommand* command = recordRenderCommand<UploadTileChunkCommand>(instanceCount * sizeof(SpriteInstance), &uploadBytes);
+        if (!command)
+        {
+            return;
+        }
+        memcpy(uploadBytes, instances, instanceCount * sizeof(SpriteInstance));
+        command->instances = (const SpriteInstance*)uploadBytes;
+        command->id = id;
+        command->chunkIndex = chunkIndex;
+        command->instanceCount = instanceCount;
+    }
+    map.chunks[chunkIndex].instanceCount = instanceCount;
+    map.chunks[chunkIndex].dirty = false;
+}
 
-    rData->quadBufferPtr++;
-    rData->quadBufferPtr->position = { pos2, 0.0f };
-    rData->quadBufferPtr->texture = { 1.0f, 0.0f };
-    rData->quadBufferPtr->color = color;
-    rData->quadBufferPtr->texIndex = texIndex;
-    rData->quadBufferPtr++;
+void executeUploadTileChunk(const UploadTileChunkCommand& command)
+{
+    glNamedBufferSubData(rData->tileMapBuffers[command.id].instanceBuffer,
+                         command.chunkIndex * TILE_CHUNK_TILE_COUNT * sizeof(SpriteInstance),
+                         command.instanceCount * sizeof(SpriteInstance), command.instances);
+}
 
-    rData->quadBufferPtr->position = { pos3, 0.0f };
-    rData->quadBufferPtr->texture = { 1.0f, 1.0f };
-    rData->quadBufferPtr->color = color;
-    rData->quadBufferPtr->texIndex = texIndex;
+void drawTileMap(TileMapId id)
+{
+    TileMap& map = rData->tileMaps[id];
+    assert(map.arena);
 
-    rData->quadBufferPtr++;
+    TempMemoryScope scratch(getTemporaryArena());
+    TileChunkDraw* draws = (TileChunkDraw*)temporaryAlloc(map.chunkCount.x * map.chunkCount.y * sizeof(TileChunkDraw), MemoryTag::Renderer);
+    u32 drawCount = 0;
+    const glm::vec2 chunkSize = map.tileSize * (f32)TILE_CHUNK_SIZE;
+    for (u32 chunkY = 0; chunkY < map.chunkCount.y; chunkY++)
+    {
+        for (u32 chunkX = 0; chunkX < map.chunkCount.x; chunkX++)
+        {
+            const glm::vec2 center = map.origin + (glm::vec2{(f32)chunkX, (f32)chunkY} + 0.5f) * chunkSize;
+            if (isSpriteCulled(center, chunkSize))
+            {
+                continue;
+            }
 
-    rData->quadBufferPtr->position = { pos4, 0.0f };
-    rData->quadBufferPtr->texture = { 0.0f, 1.0f };
-    rData->quadBufferPtr->color = color;
-    rData->quadBufferPtr->texIndex = texIndex;
+            // Chunks that change off screen are rebuilt once they come into view
+            const u32 chunkIndex = chunkY * map.chunkCount.x + chunkX;
+            if (map.chunks[chunkIndex].dirty)
+            {
+                rebuildTileChunk(id, chunkX, chunkY);
+            }
+            if (map.chunks[chunkIndex].instanceCount)
+            {
+                draws[drawCount++] = {chunkIndex * (u32)TILE_CHUNK_TILE_COUNT, map.chunks[chunkIndex].instanceCount};
+            }
+        }
+    }
+    if (!drawCount)
+    {
+        return;
+    }
 
-    rData->quadBufferPtr++;
+    // Recorded after the chunk uploads it draws from
+    void* drawBytes = nullptr;
+    DrawTileMapCommand* command = recordRenderCommand<DrawTileMapCommand>(drawCount * sizeof(TileChunkDraw), &drawBytes);
+    if (!command)
+    {
+        return;
+    }
+    memcpy(drawBytes, draws, drawCount * sizeof(TileChunkDraw));
+    command->chunks = (const TileChunkDraw*)drawBytes;
+    command->id = id;
+    command->chunkCount = drawCount;
+}
 
-    rData->indexCount += 6;
+void executeDrawTileMap(const DrawTileMapCommand& command)
+{
+    // Tiles sit on the far plane, queued sprites can wait for their flush and still end up on top
+    glUseProgram(rData->spriteShader);
+    glBindVertexArray(rData->tileMapBuffers[command.id].vertexArray);
+    glBindFramebuffer(GL_FRAMEBUFFER, rData->albedoFramebuffer);
+    glBindTextureUnit(0, rData->atlasTexture);
+    glUniform1f(glGetUniformLocation(rData->spriteShader, "alphaCutoff"), 0.0f);
+    glEnable(GL_DEPTH_TEST);
+    glDepthMask(GL_FALSE);
+    for (u32 i = 0; i < command.chunkCount; i++)
+    {
+        glDrawArraysInstancedBaseInstance(GL_TRIANGLE_STRIP, 0, 4, (i32)command.chunks[i].instanceCount, command.chunks[i].firstInstance);
+    }
+    glDepthMask(GL_TRUE);
+    glDisable(GL_DEPTH_TEST);
 }
 
 void loadFont(const char* path, u32 &fontTexId, stbtt_bakedchar *chars)
 {
     u64 fileSize = getFileSize(path);
-    Arena* arena = allocArena(fileSize + FONT_TEX_WIDTH * FONT_TEX_HEIGHT * 5);
+    Arena* arena = allocArena(fileSize + FONT_TEX_WIDTH * FONT_TEX_HEIGHT * 5, MemoryTag::Font);
     u8* fileBuffer = (u8*)arena->alloc(fileSize, 1);
     readWholeFile(fileBuffer, fileSize, path);
     u8* bitMap = (u8*)arena->alloc(FONT_TEX_WIDTH*FONT_TEX_HEIGHT, 1);
 
-    stbtt_BakeFontBitmap(fileBuffer,
+    const i32 bakedRows = stbtt_BakeFontBitmap(fileBuffer,
                          0,
                          FONT_HEIGHT,
                          bitMap,
@@ -1548,186 +2887,40 @@ void loadFont(const char* path, u32 &fontTexId, stbtt_bakedchar *chars)
         image[i+3] = 255 * (bitMap[pixel] != 0);
     }
 
-    glCreateTextures(GL_TEXTURE_2D, 1, &fontTexId);
-    glBindTexture(GL_TEXTURE_2D, fontTexId);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, FONT_TEX_WIDTH, FONT_TEX_HEIGHT, 0, GL_RGBA, GL_UNSIGNED_BYTE, image);
+    // Only the rows the glyphs were baked into go to the atlas, the bake returns the first unused one
+    const u32 usedRows = bakedRows > 0 ? (u32)bakedRows : FONT_TEX_HEIGHT;
+    fontTexId = addAtlasTexture(image, FONT_TEX_WIDTH, usedRows);
 
     freeArena(arena);
 }
 
-void drawCharacter(glm::vec2 position, const f32 scale, const char character)
+void drawCharacter(glm::vec2 position, const f32 scale, const char character, f32 depth)
 {
-    f32 rotation = 0.0f;
-
-    if (rData->indexCount >= MAX_INDEX_COUNT)
-    {
-        flush();
-        rData->quadBufferPtr = rData->quadBuffer;
-    }
-
-    f32 texIndex = -1.0f;
-
-    for (u32 i = 0; i < rData->texSlotIndex; i++)
-    {
-        if (rData->texSlots[i] == rData->fontTexId)
-        {
-            texIndex = (f32)i;
-            break;
-        }
-    }
-
-    if (texIndex == -1.0f)
-    {
-        if (rData->texSlotIndex == 32)
-        {
-            flush();
-            rData->quadBufferPtr = rData->quadBuffer;
-        }
-
-        rData->texSlots[rData->texSlotIndex] = rData->fontTexId;
-        texIndex = (f32)rData->texSlotIndex;
-        rData->texSlotIndex++;
-    }
-
-    f32 x0Refactored = rData->chars[character - ' '].x0 / (f32)FONT_TEX_WIDTH;
-    f32 x1Refactored = rData->chars[character - ' '].x1 / (f32)FONT_TEX_WIDTH;
-    f32 y0Refactored = rData->chars[character - ' '].y0 / (f32)FONT_TEX_HEIGHT;
-    f32 y1Refactored = rData->chars[character - ' '].y1 / (f32)FONT_TEX_HEIGHT;
-
-    f32 charWidth = (rData->chars[character - ' '].x1 - rData->chars[character - ' '].x0)/(f32)FONT_TEX_WIDTH * scale;
-    f32 charHeight = (rData->chars[character - ' '].y1 - rData->chars[character - ' '].y0)/(f32)FONT_TEX_HEIGHT * scale;
-
-    glm::vec2 pos1 = glm::vec2{ -charWidth, +charHeight};
-    glm::vec2 pos2 = glm::vec2{ charWidth, +charHeight};
-    glm::vec2 pos3 = glm::vec2{ charWidth, -charHeight};
-    glm::vec2 pos4 = glm::vec2{ -charWidth, -charHeight};
-
-    pos1 = rotateVec2(pos1, rotation) + glm::vec2{position.x, position.y};
-    pos2 = rotateVec2(pos2, rotation) + glm::vec2{position.x, position.y};
-    pos3 = rotateVec2(pos3, rotation) + glm::vec2{position.x, position.y};
-    pos4 = rotateVec2(pos4, rotation) + glm::vec2{position.x, position.y};
-
-    worldPosToOpenGLPos(pos1.x, pos1.y);
-    worldPosToOpenGLPos(pos2.x, pos2.y);
-    worldPosToOpenGLPos(pos3.x, pos3.y);
-    worldPosToOpenGLPos(pos4.x, pos4.y);
-
-    rData->quadBufferPtr->position = { pos1, 0.0f };
-    rData->quadBufferPtr->texture = { x0Refactored, y0Refactored };
-    rData->quadBufferPtr->texIndex = texIndex;
-    rData->quadBufferPtr++;
-
-    rData->quadBufferPtr->position = { pos2, 0.0f };
-    rData->quadBufferPtr->texture = { x1Refactored, y0Refactored };
-    rData->quadBufferPtr->texIndex = texIndex;
-    rData->quadBufferPtr++;
-
-    rData->quadBufferPtr->position = { pos3, 0.0f };
-    rData->quadBufferPtr->texture = { x1Refactored, y1Refactored };
-    rData->quadBufferPtr->texIndex = texIndex;
-
-    rData->quadBufferPtr++;
+    const i32 texIndex = (i32)rData->textures[rData->fontTexId].layer;
 
-    rData->quadBufferPtr->position = { pos4, 0.0f };
-    rData->quadBufferPtr->texture = { x0Refactored, y1Refactored };
-    rData->quadBufferPtr->texIndex = texIndex;
+    const stbtt_bakedchar& bakedChar = rData->chars[character - ' '];
+    const glm::vec4 uvs = getCharacterUvs(bakedChar);
 
-    rData->quadBufferPtr++;
-
-    rData->indexCount += 6;
+    // The baked rows run top down, so the bottom of the quad samples v1
+    const glm::vec2 size = glm::vec2{(bakedChar.x1 - bakedChar.x0) / (f32)FONT_TEX_WIDTH,
+                                     (bakedChar.y1 - bakedChar.y0) / (f32)FONT_TEX_HEIGHT} * scale * 2.0f;
+    pushSprite(position, size, 0.0f, 0xffffffff, {uvs.x, uvs.w, uvs.z, uvs.y}, texIndex, depth);
 }
 
 void drawCharacterUI(glm::vec2 position, const f32 scale, const char character)
 {
-    f32 rotation = 0.0f;
-
-    if (rData->indexCountUI >= MAX_INDEX_COUNT)
-    {
-        flushUI();
-        rData->quadBufferUIPtr = rData->quadBufferUI;
-    }
-
-    f32 texIndex = -1.0f;
-
-    for (u32 i = 0; i < rData->texSlotUiIndex; i++)
-    {
-        if (rData->texSlotsUi[i] == rData->fontTexId)
-        {
-            texIndex = (f32)i;
-            break;
-        }
-    }
-
-    if (texIndex == -1.0f)
-    {
-        if (rData->texSlotUiIndex == 32)
-        {
-            flushUI();
-            rData->quadBufferUIPtr = rData->quadBufferUI;
-        }
-
-        rData->texSlotsUi[rData->texSlotUiIndex] = rData->fontTexId;
-        texIndex = (f32)rData->texSlotUiIndex;
-        rData->texSlotUiIndex++;
-    }
-
-    f32 x0Refactored = rData->chars[character - ' '].x0 / (f32)FONT_TEX_WIDTH;
-    f32 x1Refactored = rData->chars[character - ' '].x1 / (f32)FONT_TEX_WIDTH;
-    f32 y0Refactored = rData->chars[character - ' '].y0 / (f32)FONT_TEX_HEIGHT;
-    f32 y1Refactored = rData->chars[character - ' '].y1 / (f32)FONT_TEX_HEIGHT;
-
-    f32 charWidth = (rData->chars[character - ' '].x1 - rData->chars[character - ' '].x0)/(f32)FONT_TEX_WIDTH * scale;
-    f32 charHeight = (rData->chars[character - ' '].y1 - rData->chars[character - ' '].y0)/(f32)FONT_TEX_HEIGHT * scale;
-
-    glm::vec2 pos1 = glm::vec2{ -charWidth, +charHeight};
-    glm::vec2 pos2 = glm::vec2{ charWidth, +charHeight};
-    glm::vec2 pos3 = glm::vec2{ charWidth, -charHeight};
-    glm::vec2 pos4 = glm::vec2{ -charWidth, -charHeight};
-
-    pos1 = rotateVec2(pos1, rotation) + glm::vec2{position.x, position.y};
-    pos2 = rotateVec2(pos2, rotation) + glm::vec2{position.x, position.y};
-    pos3 = rotateVec2(pos3, rotation) + glm::vec2{position.x, position.y};
-    pos4 = rotateVec2(pos4, rotation) + glm::vec2{position.x, position.y};
-
-    worldPosToOpenGLPos(pos1.x, pos1.y);
-    worldPosToOpenGLPos(pos2.x, pos2.y);
-    worldPosToOpenGLPos(pos3.x, pos3.y);
-    worldPosToOpenGLPos(pos4.x, pos4.y);
-
-    rData->quadBufferUIPtr->position = { pos1, 0.0f };
-    rData->quadBufferUIPtr->color= {1.0f, 1.0f, 1.0f, 1.0f};
-    rData->quadBufferUIPtr->texture = { x0Refactored, y0Refactored };
-    rData->quadBufferUIPtr->texIndex = texIndex;
-    rData->quadBufferUIPtr++;
-
-    rData->quadBufferUIPtr->position = { pos2, 0.0f };
-    rData->quadBufferUIPtr->color= {1.0f, 1.0f, 1.0f, 1.0f};
-    rData->quadBufferUIPtr->texture = { x1Refactored, y0Refactored };
-    rData->quadBufferUIPtr->texIndex = texIndex;
-    rData->quadBufferUIPtr++;
-
-    rData->quadBufferUIPtr->position = { pos3, 0.0f };
-    rData->quadBufferUIPtr->color= {1.0f, 1.0f, 1.0f, 1.0f};
-    rData->quadBufferUIPtr->texture = { x1Refactored, y1Refactored };
-    rData->quadBufferUIPtr->texIndex = texIndex;
-
-    rData->quadBufferUIPtr++;
+    reserveQuadUI();
+    const i16 texIndex = (i16)rData->textures[rData->fontTexId].layer;
 
-    rData->quadBufferUIPtr->position = { pos4, 0.0f };
-rData->quadBufferUIPtr->color= {1.0f, 1.0f, 1.0f, 1.0f};
-rData->quadBufferUIPtr->texture = { x0Refactored, y1Refactored };
-rData->quadBufferUIPtr->texIndex = texIndex;
-
-rData->quadBufferUIPtr++;
-
-rData->indexCountUI += 6;
+    const stbtt_bakedchar& bakedChar = rData->chars[character - ' '];
+    const glm::vec2 size = glm::vec2{(bakedChar.x1 - bakedChar.x0) / (f32)FONT_TEX_WIDTH,
+                                     (bakedChar.y1 - bakedChar.y0) / (f32)FONT_TEX_HEIGHT} * scale * 2.0f;
+    writeQuadVertices(rData->quadBufferUIPtr, position, size, 0.0f, 0xffffffff, rData->charUVs[character - ' '], texIndex,
+                      rData->worldToClip);
+    rData->quadBufferUIPtr += 4;
 }
 
-void drawText(glm::vec2 position, const f32 scale, const char* text)
+void drawText(glm::vec2 position, const f32 scale, const char* text, f32 depth)
 {
     glm::vec2 characterPosition = position;
     for (i32 i=0;i<strlen(text);i++)
@@ -1739,12 +2932,13 @@ void drawText(glm::vec2 position, const f32 scale, const char* text)
         f32 delta2 = (rData->chars[text[i] - ' '].x1 - rData->chars[text[i] - ' '].x0)/(FONT_TEX_WIDTH*0.85f)*scale;
         characterPosition.x += delta2;
         characterPosition.y -= delta;
-        drawCharacter(characterPosition, scale, text[i]);
+        drawCharacter(characterPosition, scale, text[i], depth);
         characterPosition.y += delta;
         characterPosition.x += delta2;
     }
 }
 
+// [position].z is the depth
 void drawText(const glm::vec3& position, const f32 scale, const char* text)
 {
     glm::vec3 characterPosition = position;
@@ -1757,7 +2951,7 @@ void drawText(const glm::vec3& position, const f32 scale, const char* text)
         f32 delta2 = (rData->chars[text[i] - ' '].x1 - rData->chars[text[i] - ' '].x0)/(FONT_TEX_WIDTH*0.85f)*scale;
         characterPosition.x += delta2;
         characterPosition.y -= delta;
-        drawCharacter(characterPosition, scale, text[i]);
+        drawCharacter(characterPosition, scale, text[i], position.z);
         characterPosition.y += delta;
         characterPosition.x += delta2;
     }
@@ -1781,7 +2975,7 @@ void drawTextUI(glm::vec2 position, const f32 scale, const char* text)
     }
 }
 
-void drawTextInsideBox(glm::vec2 topLeftCorner, glm::vec2 bottomRightCorner, const f32 scale, const char* text)
+void drawTextInsideBox(glm::vec2 topLeftCorner, glm::vec2 bottomRightCorner, const f32 scale, const char* text, f32 depth)
 {
     glm::vec2 characterPosition = topLeftCorner;
     characterPosition.y -= 1.25f * scale * FONT_HEIGHT / (f32)FONT_TEX_HEIGHT;
@@ -1813,7 +3007,7 @@ void drawTextInsideBox(glm::vec2 topLeftCorner, glm::vec2 bottomRightCorner, con
                         break;
                 }
                 characterPosition.y -= delta;
-                drawCharacter(characterPosition, scale, text[i]);
+                drawCharacter(characterPosition, scale, text[i], depth);
                 characterPosition.y += delta;
                 characterPosition.x += delta2;
             }
@@ -1915,113 +3109,63 @@ glm::vec2 getTextSizeInsideBox(glm::vec2 boxSize, const f32 scale, const char* t
 
 void flushUI()
 {
-    const i64 size = (u8*)rData->quadBufferUIPtr - (u8*)rData->quadBufferUI;
-    glBindBuffer(GL_ARRAY_BUFFER, rData->quadVertexBuffer);
-    glBufferSubData(GL_ARRAY_BUFFER, 0, size, rData->quadBufferUI);
-    glUseProgram(rData->quadShaderPtr);
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
-
-    for (u32 i = 0; i < rData->texSlotUiIndex ; i++)
-        glBindTextureUnit(i, rData->texSlotsUi[i]);
-
-    glBindVertexArray(rData->quadVertexArray);
-    glDrawElements(GL_TRIANGLES, rData->indexCountUI, GL_UNSIGNED_INT, nullptr);
-
-    rData->indexCountUI = 0;
-    rData->texSlotUiIndex = 0;
+    const u32 vertexCount = (u32)(rData->quadBufferUIPtr - rData->quadBufferUI);
     rData->quadBufferUIPtr = rData->quadBufferUI;
-}
-
-void drawUITex(glm::vec2 position, glm::vec2 size, const u32 texId)
-{
-    const f32 aspectRatio = (f32)rData->resolutionX / (f32)rData->resolutionY;
-
-    const f32 screenWorldSizeY = SCREEN_SIZE_WORLD_COORDS;
-    const f32 screenWorldSizeX = screenWorldSizeY * aspectRatio;
-
-    if (rData->indexCountUI >= MAX_INDEX_COUNT)
+    if (!vertexCount)
     {
-        flushUI();
-        rData->quadBufferUIPtr = rData->quadBufferUI;
-    }
-
-    f32 texIndex = -1.0f;
-
-    for (u32 i = 0; i < rData->texSlotUiIndex; i++)
-    {
-        if (rData->texSlotsUi[i] == texId)
-        {
-            texIndex = (f32)i;
-            break;
-        }
+        return;
     }
 
-    if (texIndex == -1.0f)
+    void* vertices = nullptr;
+    DrawUICommand* command = recordRenderCommand<DrawUICommand>(vertexCount * sizeof(Vertex), &vertices);
+    if (!command)
     {
-        if (rData->texSlotUiIndex == 32)
-        {
-            flushUI();
-            rData->quadBufferUIPtr = rData->quadBufferUI;
-        }
-
-        rData->texSlotsUi[rData->texSlotUiIndex] = texId;
-        texIndex = (f32)rData->texSlotUiIndex;
-        rData->texSlotUiIndex++;
-
+        return;
     }
+    memcpy(vertices, rData->quadBufferUI, vertexCount * sizeof(Vertex));
+    command->vertices = (const Vertex*)vertices;
+    command->vertexCount = vertexCount;
+}
 
-    glm::vec2 pos1 = glm::vec2{ -size.x, -size.y} / 2.0f;
-    glm::vec2 pos2 = glm::vec2{  size.x, -size.y} / 2.0f;
-    glm::vec2 pos3 = glm::vec2{  size.x,  size.y} / 2.0f;
-    glm::vec2 pos4 = glm::vec2{ -size.x,  size.y} / 2.0f;
-
-    pos1 += glm::vec2{position.x, position.y};
-    pos2 += glm::vec2{position.x, position.y};
-    pos3 += glm::vec2{position.x, position.y};
-    pos4 += glm::vec2{position.x, position.y};
-
-    worldPosToOpenGLPos(pos1.x, pos1.y);
-    worldPosToOpenGLPos(pos2.x, pos2.y);
-    worldPosToOpenGLPos(pos3.x, pos3.y);
-    worldPosToOpenGLPos(pos4.x, pos4.y);
-
-    rData->quadBufferUIPtr->position = { pos1, 0.0f };
-    rData->quadBufferUIPtr->color= {1.0f, 1.0f, 1.0f, 1.0f};
-    rData->quadBufferUIPtr->texture = {0.0f, 0.0f};
-    rData->quadBufferUIPtr->texIndex = texIndex;
-    rData->quadBufferUIPtr++;
-
-    rData->quadBufferUIPtr->position = { pos2, 0.0f };
-    rData->quadBufferUIPtr->color= {1.0f, 1.0f, 1.0f, 1.0f};
-    rData->quadBufferUIPtr->texture = { 1.0f, 0.0f };
-    rData->quadBufferUIPtr->texIndex = texIndex;
-    rData->quadBufferUIPtr++;
-
-    rData->quadBufferUIPtr->position = { pos3, 0.0f };
-    rData->quadBufferUIPtr->color= {1.0f, 1.0f, 1.0f, 1.0f};
-    rData->quadBufferUIPtr->texture = { 1.0f, 1.0f };
-    rData->quadBufferUIPtr->texIndex = texIndex;
-
-    rData->quadBufferUIPtr++;
+// UI quads are drawn straight to the screen without a camera
+void executeDrawUI(const DrawUICommand& command)
+{
+    rData->usage.uiVertexHighWater = std::max(rData->usage.uiVertexHighWater, (u64)command.vertexCount);
+    reserveUIRing(command.vertexCount);
+    const i32 baseVertex = (i32)(((u8*)rData->uiRingPtr - rData->uiRing.mapped) / sizeof(Vertex));
+    memcpy(rData->uiRingPtr, command.vertices, command.vertexCount * sizeof(Vertex));
+    rData->uiRingPtr += command.vertexCount;
 
-    rData->quadBufferUIPtr->position = { pos4, 0.0f };
-    rData->quadBufferUIPtr->color= {1.0f, 1.0f, 1.0f, 1.0f};
-    rData->quadBufferUIPtr->texture = { 0.0f, 1.0f };
-    rData->quadBufferUIPtr->texIndex = texIndex;
+    glUseProgram(rData->quadShaderPtr);
+    glUniform3f(glGetUniformLocation(rData->quadShaderPtr, "camera"), 0, 0, 1);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glBindTextureUnit(0, rData->atlasTexture);
 
-    rData->quadBufferUIPtr++;
+    const u32 quadCount = command.vertexCount / 4;
+    glBindVertexArray(rData->uiVertexArray);
+    reserveQuadIndices(quadCount);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, rData->quadVertexIndicesBuffer);
+    glDrawElementsBaseVertex(GL_TRIANGLES, quadCount * 6, GL_UNSIGNED_INT, nullptr, baseVertex);
+}
 
-    rData->indexCountUI += 6;
+void drawUITex(glm::vec2 position, glm::vec2 size, const u32 texId)
+{
+    reserveQuadUI();
+    const AtlasRegion& region = getTextureRegion(texId);
+    writeQuadVertices(rData->quadBufferUIPtr, position, size, 0.0f, 0xffffffff, region.packedUVs, (i16)region.layer,
+                      rData->worldToClip);
+    rData->quadBufferUIPtr += 4;
 }
 u32 loadShader(const char* vertexFilePath, const char* fragmentFilePath)
 {
+    TempMemoryScope scratch(getTemporaryArena());
 
     u64 vsSourceSize = kamskiPlatformGetFileSize(vertexFilePath);
-    char* vsSource = (char*)temporaryAlloc(vsSourceSize);
+    char* vsSource = (char*)temporaryAlloc(vsSourceSize, MemoryTag::Renderer);
     readWholeFile(vsSource, vsSourceSize, vertexFilePath);
 
     u64 fsSourceSize = kamskiPlatformGetFileSize(fragmentFilePath);
-    char* fsSource = (char*)temporaryAlloc(fsSourceSize);
+    char* fsSource = (char*)temporaryAlloc(fsSourceSize, MemoryTag::Renderer);
     readWholeFile(fsSource, fsSourceSize, fragmentFilePath);
 
     const u32 shader = glCreateShader(GL_VERTEX_SHADER);
@@ -2068,6 +3212,162 @@ u32 loadShader(const char* vertexFilePath, const char* fragmentFilePath)
     return retval;
 }
 
+// Points the Vertex attributes of [vertexArray] at the buffer bound to GL_ARRAY_BUFFER
+void setVertexAttributes(u32 vertexArray)
+{
+    glEnableVertexArrayAttrib(vertexArray, 0);
+    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (const void*)offsetof(Vertex, position));
+
+    glEnableVertexArrayAttrib(vertexArray, 1);
+    glVertexAttribPointer(1, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(Vertex), (const void*)offsetof(Vertex, color));
+
+    glEnableVertexArrayAttrib(vertexArray, 2);
+    glVertexAttribPointer(2, 2, GL_UNSIGNED_SHORT, GL_TRUE, sizeof(Vertex), (const void*)offsetof(Vertex, uv));
+
+    glEnableVertexArrayAttrib(vertexArray, 3);
+    glVertexAttribIPointer(3, 1, GL_SHORT, sizeof(Vertex), (const void*)offsetof(Vertex, texIndex));
+}
+
+// Points a sprite vertex array at [buffer], every attribute advances once per instance
+void setSpriteAttributes(u32 vertexArray, u32 buffer)
+{
+    glBindVertexArray(vertexArray);
+    glBindBuffer(GL_ARRAY_BUFFER, buffer);
+
+    glEnableVertexArrayAttrib(vertexArray, 0);
+    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, sizeof(SpriteInstance), (const void*)offsetof(SpriteInstance, position));
+    glVertexAttribDivisor(0, 1);
+
+    glEnableVertexArrayAttrib(vertexArray, 1);
+    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, sizeof(SpriteInstance), (const void*)offsetof(SpriteInstance, size));
+    glVertexAttribDivisor(1, 1);
+
+    glEnableVertexArrayAttrib(vertexArray, 2);
+    glVertexAttribPointer(2, 1, GL_FLOAT, GL_FALSE, sizeof(SpriteInstance), (const void*)offsetof(SpriteInstance, rotation));
+    glVertexAttribDivisor(2, 1);
+
+    glEnableVertexArrayAttrib(vertexArray, 3);
+    glVertexAttribPointer(3, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(SpriteInstance), (const void*)offsetof(SpriteInstance, color));
+    glVertexAttribDivisor(3, 1);
+
+    glEnableVertexArrayAttrib(vertexArray, 4);
+    glVertexAttribPointer(4, 4, GL_UNSIGNED_SHORT, GL_TRUE, sizeof(SpriteInstance), (const void*)offsetof(SpriteInstance, uvRect));
+    glVertexAttribDivisor(4, 1);
+
+    glEnableVertexArrayAttrib(vertexArray, 5);
+    glVertexAttribIPointer(5, 1, GL_INT, sizeof(SpriteInstance), (const void*)offsetof(SpriteInstance, texIndex));
+    glVertexAttribDivisor(5, 1);
+
+    glEnableVertexArrayAttrib(vertexArray, 6);
+    glVertexAttribPointer(6, 1, GL_FLOAT, GL_FALSE, sizeof(SpriteInstance), (const void*)offsetof(SpriteInstance, depth));
+    glVertexAttribDivisor(6, 1);
+
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+void setupUIVertexArray()
+{
+    glBindVertexArray(rData->uiVertexArray);
+    glBindBuffer(GL_ARRAY_BUFFER, rData->uiRing.buffer);
+    setVertexAttributes(rData->uiVertexArray);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+// Replays a submitted list on the render thread in the order it was recorded
+void executeRenderList(const RenderCommandList& list)
+{
+    const u8* cursor = list.commands->bytes;
+    const u8* end = cursor + list.commands->size;
+    while (cursor < end)
+    {
+        const RenderCommand* command = (const RenderCommand*)cursor;
+        const void* payload = cursor + sizeof(RenderCommand);
+        switch (command->type)
+        {
+            case RenderCommandType::Resize:
+            {
+                executeResize(*(const ResizeCommand*)payload);
+            }break;
+
+            case RenderCommandType::AddAtlasLayer:
+            {
+                executeAddAtlasLayer(*(const AddAtlasLayerCommand*)payload);
+            }break;
+
+            case RenderCommandType::UploadAtlasImage:
+            {
+                executeUploadAtlasImage(*(const UploadAtlasImageCommand*)payload);
+            }break;
+
+            case RenderCommandType::CreateTileMap:
+            {
+                executeCreateTileMap(*(const CreateTileMapCommand*)payload);
+            }break;
+
+            case RenderCommandType::DestroyTileMap:
+            {
+                executeDestroyTileMap(*(const DestroyTileMapCommand*)payload);
+            }break;
+
+            case RenderCommandType::UploadTileChunk:
+            {
+                executeUploadTileChunk(*(const UploadTileChunkCommand*)payload);
+            }break;
+
+            case RenderCommandType::DrawTileMap:
+            {
+                executeDrawTileMap(*(const DrawTileMapCommand*)payload);
+            }break;
+
+            case RenderCommandType::BeginBatch:
+            {
+                executeBeginBatch(*(const BeginBatchCommand*)payload);
+            }break;
+
+            case RenderCommandType::DrawSprites:
+            {
+                executeDrawSprites(*(const DrawSpritesCommand*)payload);
+            }break;
+
+            case RenderCommandType::DrawLights:
+            {
+                executeDrawLights(*(const DrawLightsCommand*)payload);
+            }break;
+
+            case RenderCommandType::MergeFramebuffers:
+            {
+                executeMergeFramebuffers();
+            }break;
+
+            case RenderCommandType::SetBlur:
+            {
+                executeSetBlur(*(const SetBlurCommand*)payload);
+            }break;
+
+            case RenderCommandType::DrawUI:
+            {
+                executeDrawUI(*(const DrawUICommand*)payload);
+            }break;
+
+            case RenderCommandType::DrawTriangleFan:
+            {
+                executeDrawTriangleFan(*(const DrawTriangleFanCommand*)payload);
+            }break;
+
+            case RenderCommandType::EndBatch:
+            {
+                advanceStreamRings();
+            }break;
+
+            case RenderCommandType::Present:
+            {
+                executePresent(*(const PresentCommand*)payload);
+            }break;
+        }
+        cursor += command->size;
+    }
+}
+
 void initRenderer(HWND window)
 {
     const HWND dummyWindow = CreateWindow("KamskiWindowClass", "DUMMY", WS_OVERLAPPEDWINDOW, 0, 0, 1, 1, NULL, NULL, GetModuleHandle(0), NULL);
@@ -2189,16 +3489,22 @@ void initRenderer(HWND window)
     glBindTexture(GL_TEXTURE_2D, 0);
 
 
+    // Sprites are depth tested, only the albedo pass needs a depth buffer
+    glCreateRenderbuffers(1, &rData->albedoDepthBuffer);
+    glNamedRenderbufferStorage(rData->albedoDepthBuffer, GL_DEPTH_COMPONENT24, rData->resolutionX, rData->resolutionY);
+
     glCreateFramebuffers(1, &rData->albedoFramebuffer);
     glBindFramebuffer(GL_FRAMEBUFFER, rData->albedoFramebuffer);
 
     glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, rData->albedoTexture, 0);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, rData->albedoDepthBuffer);
 
     assert(glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE);
 
     glBindFramebuffer(GL_FRAMEBUFFER, 0);
 
     rData->quadShaderPtr = loadShader("shaders/vertex.shader", "shaders/fragment.shader");
+    rData->spriteShader = loadShader("shaders/spriteVertex.shader", "shaders/fragment.shader");
     rData->lightShader = loadShader("shaders/lightingVertex.shader", "shaders/lightingFragment.shader");
     rData->mergeShader = loadShader("shaders/mergeVertex.shader", "shaders/mergeFragment.shader");
 
@@ -2206,52 +3512,57 @@ void initRenderer(HWND window)
     glEnable(GL_BLEND);
     glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
-    u32* indices = (u32*)globalAlloc(MAX_INDEX_COUNT * sizeof(u32));
-    u32 offset = 0;
-
-    for (i32 i = 0; i < MAX_INDEX_COUNT; i+=6)
+    // The arenas reserve the maximum sizes but only commit what the buffers grow to
+    rData->quadArena = allocArena(MAX_VERTEX_COUNT * sizeof(Vertex), MemoryTag::Renderer);
+    rData->lightVertexArena = allocArena(MAX_LIGHT_VERTEX_COUNT * sizeof(LightVertex), MemoryTag::Renderer);
+    rData->uiArena = allocArena(MAX_VERTEX_COUNT * sizeof(Vertex), MemoryTag::Renderer);
+    rData->indexScratchArena = allocArena(MAX_INDEX_COUNT * sizeof(u32), MemoryTag::Renderer);
+    rData->quadBuffer = (Vertex*)rData->quadArena->alloc(KAMSKI_INITIAL_QUAD_COUNT * 4 * sizeof(Vertex), 1);
+    rData->lightVertices = (LightVertex*)rData->lightVertexArena->alloc(KAMSKI_INITIAL_LIGHT_VERTEX_COUNT * sizeof(LightVertex), 1);
+    rData->quadBufferUI = (Vertex*)rData->uiArena->alloc(KAMSKI_INITIAL_QUAD_COUNT * 4 * sizeof(Vertex), 1);
+    rData->quadBufferPtr = rData->quadBuffer;
+    rData->lightVertexPtr = rData->lightVertices;
+    rData->quadBufferUIPtr = rData->quadBufferUI;
+    // Everything below that goes through the renderer API is recorded and replayed once the render thread runs
+    initRenderLists();
+    initSpriteRecorder(rData->spriteQueue);
+    for (SpriteRecorder& recorder : rData->threadRecorders)
     {
-        indices[i] = 0 + offset;
-        indices[i+1] = 1 + offset;
-        indices[i+2] = 2 + offset;
-
-        indices[i+3] = 2 + offset;
-        indices[i+4] = 3 + offset;
-        indices[i+5] = 0 + offset;
-
-        offset += 4;
+        initSpriteRecorder(recorder);
     }
 
     glCreateBuffers(1, &rData->quadVertexIndicesBuffer);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, rData->quadVertexIndicesBuffer);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, MAX_INDEX_COUNT * sizeof(u32), indices, GL_STATIC_DRAW);
+    rData->indexBufferQuadCount = 0;
+    reserveQuadIndices(KAMSKI_INITIAL_QUAD_COUNT);
     // Merge vertex array
 
     glCreateVertexArrays(1, &rData->mergeVertexArray);
     glBindVertexArray(rData->mergeVertexArray);
 
-    //Albedo vertex array
+    //Albedo vertex array, only the triangle fan still uploads through it
 
     glCreateVertexArrays(1, &rData->quadVertexArray);
     glBindVertexArray(rData->quadVertexArray);
 
     glCreateBuffers(1, &rData->quadVertexBuffer);
     glBindBuffer(GL_ARRAY_BUFFER, rData->quadVertexBuffer);
-    glBufferData(GL_ARRAY_BUFFER, MAX_VERTEX_COUNT * sizeof(Vertex), nullptr, GL_DYNAMIC_DRAW);
-
-    glEnableVertexArrayAttrib(rData->quadVertexArray, 0);
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (const void*)offsetof(Vertex,position));
+    rData->quadVertexBufferSize = KAMSKI_INITIAL_QUAD_COUNT * 4 * sizeof(Vertex);
+    glBufferData(GL_ARRAY_BUFFER, rData->quadVertexBufferSize, nullptr, GL_DYNAMIC_DRAW);
+    setVertexAttributes(rData->quadVertexArray);
 
-    glEnableVertexArrayAttrib(rData->quadVertexArray, 1);
-    glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, sizeof(Vertex), (const void*)offsetof(Vertex, color));
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    // Sprite and UI vertex arrays read from their stream rings
 
-    glEnableVertexArrayAttrib(rData->quadVertexArray, 2);
-    glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (const void*)offsetof(Vertex, texture));
+    createStreamRing(rData->spriteRing, KAMSKI_INITIAL_QUAD_COUNT * sizeof(SpriteInstance));
+    glCreateVertexArrays(1, &rData->spriteVertexArray);
+    setSpriteAttributes(rData->spriteVertexArray, rData->spriteRing.buffer);
+    resetSpriteRegion();
 
-    glEnableVertexArrayAttrib(rData->quadVertexArray, 3);
-    glVertexAttribPointer(3, 1, GL_FLOAT, GL_FALSE, sizeof(Vertex), (const void*)offsetof(Vertex, texIndex));
+    createStreamRing(rData->uiRing, KAMSKI_INITIAL_QUAD_COUNT * 4 * sizeof(Vertex));
+    glCreateVertexArrays(1, &rData->uiVertexArray);
+    setupUIVertexArray();
+    resetUIRegion();
 
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
     // Lightmap vertex array
 
     glCreateVertexArrays(1, &rData->lightVertexArray);
@@ -2259,7 +3570,8 @@ void initRenderer(HWND window)
 
     glCreateBuffers(1, &rData->lightVertexBuffer);
     glBindBuffer(GL_ARRAY_BUFFER, rData->lightVertexBuffer);
-    glBufferData(GL_ARRAY_BUFFER, MAX_VERTEX_COUNT * 24 * sizeof(LightVertex), nullptr, GL_DYNAMIC_DRAW);
+    rData->lightVertexBufferSize = KAMSKI_INITIAL_LIGHT_VERTEX_COUNT * sizeof(LightVertex);
+    glBufferData(GL_ARRAY_BUFFER, rData->lightVertexBufferSize, nullptr, GL_DYNAMIC_DRAW);
 
     glEnableVertexArrayAttrib(rData->lightVertexArray, 0);
     glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, sizeof(LightVertex), (const void*)offsetof(LightVertex, position));
@@ -2277,6 +3589,9 @@ void initRenderer(HWND window)
     // Enable texture overlapping
     glEnable(GL_BLEND);
     glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    // Only the sprite draws enable the depth test. Equal depths pass, so a later sprite still lands on top of an
+    // earlier one and everything passes at the far plane
+    glDepthFunc(GL_LEQUAL);
 
     i32 samplers[32];
     for (i32 i = 0; i < 32; i++) {
@@ -2284,23 +3599,30 @@ void initRenderer(HWND window)
     }
 
     glUseProgram(rData->quadShaderPtr);
-    glUniform1iv(glGetUniformLocation(rData->quadShaderPtr, "textures"), 32, samplers);
+    glUniform1i(glGetUniformLocation(rData->quadShaderPtr, "atlas"), 0);
+    glUseProgram(rData->spriteShader);
+    glUniform1i(glGetUniformLocation(rData->spriteShader, "atlas"), 0);
     glUseProgram(rData->mergeShader);
     u32 loc = glGetUniformLocation(rData->mergeShader, "framebuffers");
     glUniform1iv(loc, 2, samplers);
 
-    for (auto& textureSlot : rData->texSlots) {
-        textureSlot = 0;
-    }
+    rData->atlasLayerCount = 0;
+    rData->textureCount = 1;
+    addAtlasLayer();
 
     setBlurWholeScreen(false);
 
     rData->deviceContext = deviceContext;
-    rData->quadBufferUIPtr = rData->quadBufferUI;
+    rData->glContext = gl;
 //    wglSwapIntervalEXT(0);
 
     loadFont("fonts\\CompassPro.ttf", rData->fontTexId, rData->chars);
-    globalFree(indices);
+    for (u32 i = 0; i < FONT_CHARACTER_COUNT; i++)
+    {
+        // The baked rows run top down, so the bottom of the quad samples v1
+        const glm::vec4 uvs = getCharacterUvs(rData->chars[i]);
+        rData->charUVs[i] = packUVRect({uvs.x, uvs.w, uvs.z, uvs.y});
+    }
     rendererInitialized = true;
 }
 
@@ -2,6 +2,7 @@
 #define NOMINMAX
 #include <Windows.h>
 #include <cstdio>
+#include <cstring>
 
 struct Win32State
 {
@@ -82,12 +83,415 @@ u64 kamskiPlatformGetFileSize(const char* filePath)
 
 // LOGGER
 
-void kamskiLog(const char* const format,
-               const char* fileName,
-               const int lineNumber,
-               const char* funcName,
-               KamskiLogLevel logLevel,
-               ...)
+// Log calls copy their arguments into a ring of fixed size records and return, a writer thread formats
+// and writes them. Format, file and function names are kept by pointer, the bytes behind a %s are copied.
+
+enum class LogArgKind : u8
+{
+    None,
+    Signed,
+    Unsigned,
+    Float,
+    String,
+    Pointer,
+    Unsupported
+};
+
+struct LogFormatSpec
+{
+    // From the '%' up to the length modifier, then the conversion character
+    const char* start;
+    const char* modifierStart;
+    const char* end;
+    char conversion;
+    LogArgKind kind;
+    // 0 int, 1 long, 2 64-bit, 3 long double
+    u8 argSize;
+    // 1 for h, 2 for hh, the promoted int is truncated when printed
+    u8 shortCount;
+    bool widthArg;
+    bool precisionArg;
+    // Digits after the '.', -1 without them
+    i32 precision;
+};
+
+struct Win32LogRecord
+{
+    // Equals the ring position while the slot is free and position + 1 once a producer filled it
+    volatile LONG64 sequence;
+    const char* format;
+    const char* fileName;
+    const char* funcName;
+    f64 time;
+    i32 lineNumber;
+    u32 threadId;
+    KamskiLogLevel logLevel;
+    // The arguments did not fit, [args] holds the message formatted by the producer instead
+    bool preformatted;
+    u8 args[KAMSKI_LOG_ARGS_SIZE];
+};
+
+struct Win32Logger
+{
+    Win32LogRecord records[KAMSKI_LOG_RING_SIZE];
+    volatile LONG64 enqueuePosition;
+    // Advanced by the writer thread after every record it wrote
+    volatile LONG64 writtenPosition;
+    volatile LONG64 droppedCount;
+    volatile LONG running;
+    HANDLE file;
+};
+
+static_assert((KAMSKI_LOG_RING_SIZE & (KAMSKI_LOG_RING_SIZE - 1)) == 0, "KAMSKI_LOG_RING_SIZE must be a power of two");
+
+Win32Logger win32Logger = {};
+
+static bool isLogDigit(char c)
+{
+    return c >= '0' && c <= '9';
+}
+
+// Parses the printf conversion that starts at the '%' at [format]
+static LogFormatSpec parseLogFormatSpec(const char* format)
+{
+    LogFormatSpec spec = {};
+    spec.start = format;
+    spec.precision = -1;
+
+    const char* cursor = format + 1;
+    while (*cursor == '-' || *cursor == '+' || *cursor == ' ' || *cursor == '#' || *cursor == '0')
+        cursor++;
+
+    if (*cursor == '*')
+    {
+        spec.widthArg = true;
+        cursor++;
+    }
+    while (isLogDigit(*cursor))
+        cursor++;
+
+    if (*cursor == '.')
+    {
+        cursor++;
+        if (*cursor == '*')
+        {
+            spec.precisionArg = true;
+            cursor++;
+        }
+        else
+        {
+            spec.precision = 0;
+        }
+        while (isLogDigit(*cursor))
+        {
+            spec.precision = spec.precision * 10 + (*cursor - '0');
+            cursor++;
+        }
+    }
+
+    spec.modifierStart = cursor;
+    if (cursor[0] == 'l' && cursor[1] == 'l')
+    {
+        spec.argSize = 2;
+        cursor += 2;
+    }
+    else if (cursor[0] == 'I' && cursor[1] == '6' && cursor[2] == '4')
+    {
+        spec.argSize = 2;
+        cursor += 3;
+    }
+    else if (cursor[0] == 'I' && cursor[1] == '3' && cursor[2] == '2')
+    {
+        cursor += 3;
+    }
+    else if (*cursor == 'z' || *cursor == 'j' || *cursor == 't' || *cursor == 'I')
+    {
+        spec.argSize = 2;
+        cursor++;
+    }
+    else if (*cursor == 'l')
+    {
+        spec.argSize = 1;
+        cursor++;
+    }
+    else if (*cursor == 'L')
+    {
+        spec.argSize = 3;
+        cursor++;
+    }
+    else
+    {
+        // h and hh arguments are promoted to int
+        while (*cursor == 'h' && spec.shortCount < 2)
+        {
+            spec.shortCount++;
+            cursor++;
+        }
+    }
+
+    spec.conversion = *cursor;
+    spec.end = *cursor ? cursor + 1 : cursor;
+    switch (spec.conversion)
+    {
+        case 'd': case 'i': case 'c':
+            spec.kind = LogArgKind::Signed;
+            break;
+        case 'u': case 'o': case 'x': case 'X':
+            spec.kind = LogArgKind::Unsigned;
+            break;
+        case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A':
+            spec.kind = LogArgKind::Float;
+            break;
+        case 's':
+            // Wide strings are left to the producer side formatting
+            spec.kind = spec.argSize == 1 ? LogArgKind::Unsupported : LogArgKind::String;
+            break;
+        case 'p':
+            spec.kind = LogArgKind::Pointer;
+            break;
+        case '%':
+            spec.kind = LogArgKind::None;
+            break;
+        default:
+            spec.kind = LogArgKind::Unsupported;
+    }
+    return spec;
+}
+
+static bool packLogValue(u8*& cursor, const u8* end, u64 value)
+{
+    if (cursor + sizeof(value) > end)
+    {
+        return false;
+    }
+    memcpy(cursor, &value, sizeof(value));
+    cursor += sizeof(value);
+    return true;
+}
+
+// Copies the arguments [format] refers to into [buffer], false when they do not fit or can not be copied
+static bool packLogArgs(u8* buffer, const char* format, va_list args)
+{
+    u8* cursor = buffer;
+    const u8* end = buffer + KAMSKI_LOG_ARGS_SIZE;
+    for (const char* c = format; *c; c++)
+    {
+        if (*c != '%')
+        {
+            continue;
+        }
+
+        const LogFormatSpec spec = parseLogFormatSpec(c);
+        c = spec.end - 1;
+        if (spec.kind == LogArgKind::Unsupported)
+        {
+            return false;
+        }
+        if (spec.widthArg && !packLogValue(cursor, end, (u64)(i64)va_arg(args, int)))
+        {
+            return false;
+        }
+        i32 precision = spec.precision;
+        if (spec.precisionArg)
+        {
+            precision = va_arg(args, int);
+            if (!packLogValue(cursor, end, (u64)(i64)precision))
+            {
+                return false;
+            }
+        }
+
+        bool packed = true;
+        switch (spec.kind)
+        {
+            case LogArgKind::Signed:
+            {
+                const i64 value = spec.argSize == 2 ? va_arg(args, long long) : spec.argSize == 1 ? va_arg(args, long) : va_arg(args, int);
+                packed = packLogValue(cursor, end, (u64)value);
+            }
+            break;
+
+            case LogArgKind::Unsigned:
+            {
+                const u64 value = spec.argSize == 2 ? va_arg(args, unsigned long long) : spec.argSize == 1 ? va_arg(args, unsigned long) : va_arg(args, unsigned int);
+                packed = packLogValue(cursor, end, value);
+            }
+            break;
+
+            case LogArgKind::Float:
+            {
+                const f64 value = spec.argSize == 3 ? (f64)va_arg(args, long double) : va_arg(args, f64);
+                u64 bits;
+                memcpy(&bits, &value, sizeof(bits));
+                packed = packLogValue(cursor, end, bits);
+            }
+            break;
+
+            case LogArgKind::String:
+            {
+                const char* value = va_arg(args, const char*);
+                value = value ? value : "(null)";
+                // With a precision printf reads at most that many bytes and the string does not have to be terminated
+                const u64 length = precision >= 0 ? strnlen(value, (u64)precision) : strlen(value);
+                packed = cursor + length + 1 <= end;
+                if (packed)
+                {
+                    memcpy(cursor, value, length);
+                    cursor[length] = 0;
+                    cursor += length + 1;
+                }
+            }
+            break;
+
+            case LogArgKind::Pointer:
+            {
+                packed = packLogValue(cursor, end, (u64)va_arg(args, void*));
+            }
+            break;
+
+            default:
+            {
+            }
+        }
+
+        if (!packed)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+static u64 unpackLogValue(const u8*& cursor)
+{
+    u64 value;
+    memcpy(&value, cursor, sizeof(value));
+    cursor += sizeof(value);
+    return value;
+}
+
+// Formats [format] with the arguments packLogArgs copied, one conversion at a time
+static void unpackLogMessage(char* message, u64 messageSize, const char* format, const u8* args)
+{
+    char* out = message;
+    char* outEnd = message + messageSize - 1;
+    for (const char* c = format; *c && out < outEnd; c++)
+    {
+        if (*c != '%')
+        {
+            *out++ = *c;
+            continue;
+        }
+
+        const LogFormatSpec spec = parseLogFormatSpec(c);
+        c = spec.end - 1;
+
+        // Rebuilds the conversion with * replaced by the copied values and a length modifier matching what was copied
+        char specBuffer[64];
+        char* specOut = specBuffer;
+        char* specEnd = specBuffer + sizeof(specBuffer) - 24;
+        for (const char* s = spec.start; s < spec.modifierStart && specOut < specEnd; s++)
+        {
+            if (*s == '*')
+            {
+                const i32 value = (i32)(i64)unpackLogValue(args);
+                // A negative precision counts as none
+                if (value < 0 && specOut > specBuffer && specOut[-1] == '.')
+                {
+                    specOut--;
+                }
+                else
+                {
+                    specOut += sprintf(specOut, "%d", value);
+                }
+            }
+            else
+            {
+                *specOut++ = *s;
+            }
+        }
+        // h and hh are kept, they print the int they were given truncated like the caller's printf would
+        const bool integer = (spec.kind == LogArgKind::Signed || spec.kind == LogArgKind::Unsigned) && spec.conversion != 'c';
+        const bool wideInteger = integer && !spec.shortCount;
+        if (wideInteger)
+        {
+            *specOut++ = 'l';
+            *specOut++ = 'l';
+        }
+        else if (integer)
+        {
+            for (u8 i = 0; i < spec.shortCount; i++)
+            {
+                *specOut++ = 'h';
+            }
+        }
+        *specOut++ = spec.conversion;
+        *specOut = 0;
+
+        const u64 available = outEnd - out + 1;
+        i32 written = 0;
+        switch (spec.kind)
+        {
+            case LogArgKind::Signed:
+            {
+                const i64 value = (i64)unpackLogValue(args);
+                written = wideInteger ? snprintf(out, available, specBuffer, (long long)value) : snprintf(out, available, specBuffer, (i32)value);
+            }
+            break;
+
+            case LogArgKind::Unsigned:
+            {
+                const u64 value = unpackLogValue(args);
+                written = wideInteger ? snprintf(out, available, specBuffer, (unsigned long long)value) : snprintf(out, available, specBuffer, (u32)value);
+            }
+            break;
+
+            case LogArgKind::Float:
+            {
+                const u64 bits = unpackLogValue(args);
+                f64 value;
+                memcpy(&value, &bits, sizeof(value));
+                written = snprintf(out, available, specBuffer, value);
+            }
+            break;
+
+            case LogArgKind::String:
+            {
+                const char* value = (const char*)args;
+                args += strlen(value) + 1;
+                written = snprintf(out, available, specBuffer, value);
+            }
+            break;
+
+            case LogArgKind::Pointer:
+            {
+                written = snprintf(out, available, specBuffer, (void*)unpackLogValue(args));
+            }
+            break;
+
+            case LogArgKind::None:
+            {
+                *out = '%';
+                written = 1;
+            }
+            break;
+
+            default:
+            {
+            }
+        }
+        out += written > 0 ? ((u64)written < available ? written : available - 1) : 0;
+    }
+    *out = 0;
+}
+
+static void writeLogLine(KamskiLogLevel logLevel,
+                         const char* fileName,
+                         i32 lineNumber,
+                         const char* funcName,
+                         f64 time,
+                         u32 threadId,
+                         const char* message)
 {
     const HANDLE stdoutHandle = GetStdHandle(STD_OUTPUT_HANDLE);
 
@@ -98,23 +502,19 @@ void kamskiLog(const char* const format,
         "[DEBUG]"
     };
 
-    char buff[4096] = {};
-    va_list args;
-    va_start(args, logLevel);
-
-    vsprintf(buff, format, args);
-
-    va_end(args);
-
     char finalMessage[4096] = {};
 
-    const i32 charsWritten = sprintf(finalMessage,
-                                     "%s [%s][%s()]:%d : %s\n",
-                                     logLevelPrefixes[(u32)logLevel],
-                                     fileName,
-                                     funcName,
-                                     lineNumber,
-                                     buff);
+    i32 charsWritten = snprintf(finalMessage,
+                                sizeof(finalMessage),
+                                "%s [%.3f][%u][%s][%s()]:%d : %s\n",
+                                logLevelPrefixes[(u32)logLevel],
+                                time,
+                                threadId,
+                                fileName,
+                                funcName,
+                                lineNumber,
+                                message);
+    charsWritten = charsWritten < (i32)sizeof(finalMessage) ? charsWritten : (i32)sizeof(finalMessage) - 1;
 
     switch (logLevel)
     {
@@ -144,6 +544,353 @@ void kamskiLog(const char* const format,
 
     WriteConsole(stdoutHandle, finalMessage, charsWritten, nullptr, nullptr);
     SetConsoleTextAttribute(stdoutHandle, FOREGROUND_RED | FOREGROUND_GREEN | FOREGROUND_BLUE);
+
+    if (win32Logger.file && win32Logger.file != INVALID_HANDLE_VALUE)
+    {
+        WriteFile(win32Logger.file, finalMessage, charsWritten, nullptr, nullptr);
+    }
+}
+
+// Spins until the writer thread got past ring position [position]
+static void waitForLogPosition(LONG64 position)
+{
+    while (win32Logger.running && win32Logger.writtenPosition < position)
+    {
+        Sleep(0);
+    }
+}
+
+static DWORD WINAPI logWriterThread(LPVOID)
+{
+    char message[4096];
+    LONG64 position = 0;
+    for (;;)
+    {
+        Win32LogRecord* record = &win32Logger.records[position & (KAMSKI_LOG_RING_SIZE - 1)];
+        if (record->sequence != position + 1)
+        {
+            const LONG64 droppedCount = InterlockedExchange64(&win32Logger.droppedCount, 0);
+            if (droppedCount)
+            {
+                sprintf(message, "%lld log records dropped, the ring was full", droppedCount);
+                writeLogLine(KamskiLogLevel::Warning, __FILE__, __LINE__, __FUNCTION__, kamskiPlatformGetTime(), GetCurrentThreadId(), message);
+            }
+            Sleep(1);
+            continue;
+        }
+
+        if (record->preformatted)
+        {
+            writeLogLine(record->logLevel, record->fileName, record->lineNumber, record->funcName, record->time, record->threadId, (const char*)record->args);
+        }
+        else
+        {
+            unpackLogMessage(message, sizeof(message), record->format, record->args);
+            writeLogLine(record->logLevel, record->fileName, record->lineNumber, record->funcName, record->time, record->threadId, message);
+        }
+
+        InterlockedExchange64(&record->sequence, position + KAMSKI_LOG_RING_SIZE);
+        position++;
+        InterlockedExchange64(&win32Logger.writtenPosition, position);
+    }
+}
+
+void kamskiPlatformStartLogger()
+{
+    if (win32Logger.running)
+    {
+        return;
+    }
+
+    for (u32 i = 0; i < KAMSKI_LOG_RING_SIZE; i++)
+    {
+        win32Logger.records[i].sequence = i;
+    }
+#ifdef KAMSKI_LOG_FILE
+    win32Logger.file = CreateFileA(KAMSKI_LOG_FILE, GENERIC_WRITE, FILE_SHARE_READ, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+#endif
+
+    const HANDLE thread = CreateThread(nullptr, 0, logWriterThread, nullptr, 0, nullptr);
+    if (thread)
+    {
+        CloseHandle(thread);
+        win32Logger.running = 1;
+    }
+}
+
+void kamskiPlatformFlushLog()
+{
+    waitForLogPosition(win32Logger.enqueuePosition);
+}
+
+static void kamskiLogV(const char* format,
+                       const char* fileName,
+                       int lineNumber,
+                       const char* funcName,
+                       KamskiLogLevel logLevel,
+                       va_list args)
+{
+    // Before the writer thread runs (and in tools without one) the message is written right away
+    if (!win32Logger.running)
+    {
+        char message[4096];
+        vsnprintf(message, sizeof(message), format, args);
+        writeLogLine(logLevel, fileName, lineNumber, funcName, kamskiPlatformGetTime(), GetCurrentThreadId(), message);
+        return;
+    }
+
+    LONG64 position = win32Logger.enqueuePosition;
+    Win32LogRecord* record;
+    for (;;)
+    {
+        record = &win32Logger.records[position & (KAMSKI_LOG_RING_SIZE - 1)];
+        const LONG64 difference = record->sequence - position;
+        if (difference == 0)
+        {
+            const LONG64 previous = InterlockedCompareExchange64(&win32Logger.enqueuePosition, position + 1, position);
+            if (previous == position)
+            {
+                break;
+            }
+            position = previous;
+        }
+        else if (difference < 0)
+        {
+            // The ring is full. Errors wait for room, everything else is counted and dropped
+            if (logLevel != KamskiLogLevel::Error)
+            {
+                InterlockedIncrement64(&win32Logger.droppedCount);
+                return;
+            }
+            Sleep(0);
+            position = win32Logger.enqueuePosition;
+        }
+        else
+        {
+            position = win32Logger.enqueuePosition;
+        }
+    }
+
+    record->format = format;
+    record->fileName = fileName;
+    record->funcName = funcName;
+    record->time = kamskiPlatformGetTime();
+    record->lineNumber = lineNumber;
+    record->threadId = GetCurrentThreadId();
+    record->logLevel = logLevel;
+
+    va_list argsCopy;
+    va_copy(argsCopy, args);
+    record->preformatted = !packLogArgs(record->args, format, argsCopy);
+    va_end(argsCopy);
+    if (record->preformatted)
+    {
+        vsnprintf((char*)record->args, KAMSKI_LOG_ARGS_SIZE, format, args);
+    }
+
+    InterlockedExchange64(&record->sequence, position + 1);
+
+    // An error is often followed by a crash (see assert), so it only returns once it is on screen
+    if (logLevel == KamskiLogLevel::Error)
+    {
+        waitForLogPosition(position + 1);
+    }
+}
+
+void kamskiLog(const char* const format,
+               const char* fileName,
+               const int lineNumber,
+               const char* funcName,
+               KamskiLogLevel logLevel,
+               ...)
+{
+    va_list args;
+    va_start(args, logLevel);
+    kamskiLogV(format, fileName, lineNumber, funcName, logLevel, args);
+    va_end(args);
+}
+
+void kamskiLogEvery(f64 interval,
+                    f64* lastTime,
+                    const char* format,
+                    const char* fileName,
+                    int lineNumber,
+                    const char* funcName,
+                    KamskiLogLevel logLevel,
+                    ...)
+{
+    const f64 now = kamskiPlatformGetTime();
+    if (now - *lastTime < interval)
+    {
+        return;
+    }
+    *lastTime = now;
+
+    va_list args;
+    va_start(args, logLevel);
+    kamskiLogV(format, fileName, lineNumber, funcName, logLevel, args);
+    va_end(args);
+}
+
+// VIRTUAL MEMORY
+
+// The engine reserves one block and commits KAMSKI_COMMIT_GRANULE sized granules of it on demand.
+// The bitmap lives outside the block so restoring a snapshot of the block can not corrupt it.
+struct Win32VirtualMemory
+{
+    u8* base;
+    u64 reservedSize;
+    u64 granuleCount;
+    // Large pages are committed with the reservation and can not be decommitted
+    bool largePages;
+    volatile LONG64 committedSize;
+    volatile LONG64* committedGranules;
+};
+
+Win32VirtualMemory win32VirtualMemory = {};
+
+bool isGranuleCommitted(u64 granule)
+{
+    return win32VirtualMemory.committedGranules[granule / 64] & (1ll << (granule % 64));
+}
+
+void commitGranule(u64 granule)
+{
+    const LONG64 mask = 1ll << (granule % 64);
+    if (win32VirtualMemory.committedGranules[granule / 64] & mask)
+    {
+        return;
+    }
+
+    if (!VirtualAlloc(win32VirtualMemory.base + granule * KAMSKI_COMMIT_GRANULE, KAMSKI_COMMIT_GRANULE, MEM_COMMIT, PAGE_READWRITE))
+    {
+        logError("Could not commit %llu bytes, error %lu", KAMSKI_COMMIT_GRANULE, GetLastError());
+        return;
+    }
+
+    // Another thread may have committed the same granule meanwhile, only the one that flips the bit counts it
+    if (!(InterlockedOr64(&win32VirtualMemory.committedGranules[granule / 64], mask) & mask))
+    {
+        InterlockedAdd64(&win32VirtualMemory.committedSize, KAMSKI_COMMIT_GRANULE);
+    }
+}
+
+void decommitGranule(u64 granule)
+{
+    if (win32VirtualMemory.largePages)
+    {
+        memset(win32VirtualMemory.base + granule * KAMSKI_COMMIT_GRANULE, 0, KAMSKI_COMMIT_GRANULE);
+        return;
+    }
+
+    const LONG64 mask = 1ll << (granule % 64);
+    if (InterlockedAnd64(&win32VirtualMemory.committedGranules[granule / 64], ~mask) & mask)
+    {
+        VirtualFree(win32VirtualMemory.base + granule * KAMSKI_COMMIT_GRANULE, KAMSKI_COMMIT_GRANULE, MEM_DECOMMIT);
+        InterlockedAdd64(&win32VirtualMemory.committedSize, -(LONG64)KAMSKI_COMMIT_GRANULE);
+    }
+}
+
+// MEM_LARGE_PAGES needs SeLockMemoryPrivilege, which the user must have been granted ("Lock pages in memory")
+bool enableLockMemoryPrivilege()
+{
+    HANDLE token;
+    if (!OpenProcessToken(GetCurrentProcess(), TOKEN_ADJUST_PRIVILEGES | TOKEN_QUERY, &token))
+    {
+        return false;
+    }
+
+    TOKEN_PRIVILEGES privileges = {};
+    privileges.PrivilegeCount = 1;
+    privileges.Privileges[0].Attributes = SE_PRIVILEGE_ENABLED;
+    // AdjustTokenPrivileges succeeds without assigning anything when the privilege is missing, hence GetLastError
+    const bool enabled = LookupPrivilegeValueA(nullptr, "SeLockMemoryPrivilege", &privileges.Privileges[0].Luid) &&
+                         AdjustTokenPrivileges(token, FALSE, &privileges, 0, nullptr, nullptr) &&
+                         GetLastError() == ERROR_SUCCESS;
+    CloseHandle(token);
+    return enabled;
+}
+
+u8* reserveLargePages(void* baseAddress, u64& size)
+{
+    const u64 largePageSize = GetLargePageMinimum();
+    if (!largePageSize || !enableLockMemoryPrivilege())
+    {
+        logWarning("Large pages are not available, falling back to regular pages");
+        return nullptr;
+    }
+
+    const u64 largeSize = (size + largePageSize - 1) / largePageSize * largePageSize;
+    u8* base = (u8*)VirtualAlloc(baseAddress, largeSize, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+    if (!base)
+    {
+        logWarning("Could not get %llu bytes of large pages (error %lu), falling back to regular pages", largeSize, GetLastError());
+        return nullptr;
+    }
+
+    logInfo("Engine memory backed by %llu KB pages", largePageSize / KB(1));
+    size = largeSize;
+    return base;
+}
+
+void* kamskiPlatformReserveMemory(void* baseAddress, u64 size, bool largePages)
+{
+    assert(!win32VirtualMemory.base);
+    size = (size + KAMSKI_COMMIT_GRANULE - 1) / KAMSKI_COMMIT_GRANULE * KAMSKI_COMMIT_GRANULE;
+
+    if (largePages)
+    {
+        win32VirtualMemory.base = reserveLargePages(baseAddress, size);
+        win32VirtualMemory.largePages = win32VirtualMemory.base != nullptr;
+    }
+    if (!win32VirtualMemory.base)
+    {
+        win32VirtualMemory.base = (u8*)VirtualAlloc(baseAddress, size, MEM_RESERVE, PAGE_NOACCESS);
+    }
+    if (!win32VirtualMemory.base)
+    {
+        logError("Could not reserve %llu bytes, error %lu", size, GetLastError());
+        return nullptr;
+    }
+
+    win32VirtualMemory.reservedSize = size;
+    win32VirtualMemory.granuleCount = size / KAMSKI_COMMIT_GRANULE;
+    const u64 bitmapSize = (win32VirtualMemory.granuleCount + 63) / 64 * sizeof(LONG64);
+    win32VirtualMemory.committedGranules = (volatile LONG64*)VirtualAlloc(nullptr, bitmapSize, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+
+    if (win32VirtualMemory.largePages)
+    {
+        memset((void*)win32VirtualMemory.committedGranules, 0xff, bitmapSize);
+        win32VirtualMemory.committedSize = (LONG64)size;
+    }
+    return win32VirtualMemory.base;
+}
+
+// Commits every granule overlapping [address, address + size), ranges outside the reserved block are ignored
+void kamskiPlatformCommitMemory(void* address, u64 size)
+{
+    u8* const begin = (u8*)address;
+    if (size == 0 || begin < win32VirtualMemory.base || begin >= win32VirtualMemory.base + win32VirtualMemory.reservedSize)
+    {
+        return;
+    }
+
+    const u64 firstGranule = (begin - win32VirtualMemory.base) / KAMSKI_COMMIT_GRANULE;
+    u64 lastGranule = (begin + size - 1 - win32VirtualMemory.base) / KAMSKI_COMMIT_GRANULE;
+    if (lastGranule >= win32VirtualMemory.granuleCount)
+    {
+        lastGranule = win32VirtualMemory.granuleCount - 1;
+    }
+
+    for (u64 granule = firstGranule; granule <= lastGranule; granule++)
+    {
+        commitGranule(granule);
+    }
+}
+
+MemoryUsage kamskiPlatformGetMemoryUsage()
+{
+    return { (u64)win32VirtualMemory.committedSize, win32VirtualMemory.reservedSize };
 }
 
 // TIME
@@ -165,6 +912,7 @@ f64 kamskiPlatformGetTime()
 
 void exit(u32 code)
 {
+    kamskiPlatformFlushLog();
     ShowWindow(win32State->window, SW_HIDE);
     ExitProcess(code);
 }
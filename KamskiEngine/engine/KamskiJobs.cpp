@@ -0,0 +1,826 @@
+#include "../KamskiEngine.h"
+#include <algorithm>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#ifndef _WIN32
+#include <cstdlib>
+#include <ucontext.h>
+#endif
+
+static_assert((KAMSKI_JOB_POOL_SIZE & (KAMSKI_JOB_POOL_SIZE - 1)) == 0, "KAMSKI_JOB_POOL_SIZE must be a power of two");
+static_assert((KAMSKI_JOB_DEQUE_SIZE & (KAMSKI_JOB_DEQUE_SIZE - 1)) == 0, "KAMSKI_JOB_DEQUE_SIZE must be a power of two");
+
+#ifdef _MSC_VER
+#define KAMSKI_NOINLINE __declspec(noinline)
+#else
+#define KAMSKI_NOINLINE __attribute__((noinline))
+#endif
+
+// ######## Fibers ########
+
+// Fibers run jobs so a job that waits parks its stack instead of blocking the worker thread.
+// Every thread starts on its own base fiber, jobs run on fibers taken from a fixed pool.
+
+static constexpr u32 JOB_ANY_THREAD = ~0u;
+
+struct JobFiber
+{
+#ifdef _WIN32
+    void* handle;
+#else
+    ucontext_t context;
+    u8* stack;
+#endif
+    // Next fiber in the free, ready or waiting list the fiber is in
+    JobFiber* next;
+    // Thread that has to resume the fiber, JOB_ANY_THREAD when any may
+    u32 homeThread;
+    // Set by runOnFiber, the fiber runs it when it gets switched to
+    JobFunc entryFunc;
+    void* entryData;
+    JobCounter* entryCounter;
+};
+
+using FiberEntryFunc = void (*)();
+
+#ifdef _WIN32
+
+static void WINAPI fiberTrampoline(void* entry)
+{
+    ((FiberEntryFunc)entry)();
+}
+
+static void platformConvertThreadToFiber(JobFiber* fiber)
+{
+    fiber->handle = ConvertThreadToFiber(nullptr);
+    assert(fiber->handle);
+}
+
+static void platformConvertFiberToThread()
+{
+    ConvertFiberToThread();
+}
+
+static void platformCreateFiber(JobFiber* fiber, FiberEntryFunc entry)
+{
+    // Only the reserve is KAMSKI_FIBER_STACK_SIZE, pages get committed as the stack grows
+    fiber->handle = CreateFiberEx(0, KAMSKI_FIBER_STACK_SIZE, 0, fiberTrampoline, (void*)entry);
+    assert(fiber->handle);
+}
+
+static void platformDestroyFiber(JobFiber* fiber)
+{
+    DeleteFiber(fiber->handle);
+}
+
+static void platformSwitchFiber(JobFiber* from, JobFiber* to)
+{
+    (void)from;
+    SwitchToFiber(to->handle);
+}
+
+#else
+
+// ucontext, swapcontext also saves the signal mask so a switch costs a system call
+static void platformConvertThreadToFiber(JobFiber* fiber)
+{
+    (void)fiber;
+}
+
+static void platformConvertFiberToThread()
+{
+}
+
+static void platformCreateFiber(JobFiber* fiber, FiberEntryFunc entry)
+{
+    fiber->stack = (u8*)malloc(KAMSKI_FIBER_STACK_SIZE);
+    getcontext(&fiber->context);
+    fiber->context.uc_stack.ss_sp = fiber->stack;
+    fiber->context.uc_stack.ss_size = KAMSKI_FIBER_STACK_SIZE;
+    fiber->context.uc_link = nullptr;
+    makecontext(&fiber->context, entry, 0);
+}
+
+static void platformDestroyFiber(JobFiber* fiber)
+{
+    free(fiber->stack);
+}
+
+static void platformSwitchFiber(JobFiber* from, JobFiber* to)
+{
+    swapcontext(&from->context, &to->context);
+}
+
+#endif
+
+struct JobFiberList
+{
+    JobFiber* head;
+    std::atomic<u32> count;
+};
+
+struct Job
+{
+    JobFunc func;
+    void* data;
+    JobCounter* counter;
+    // Next continuation waiting on the same counter
+    Job* next;
+    // Set while the job is queued or running, the pool slot is reused only after it clears
+    std::atomic<bool> inFlight;
+};
+
+// Chase-Lev work-stealing deque: the owner pushes and pops at the bottom, every other thread steals from the top
+struct alignas(64) JobDeque
+{
+    std::atomic<i64> top;
+    alignas(64) std::atomic<i64> bottom;
+    std::atomic<Job*> slots[KAMSKI_JOB_DEQUE_SIZE];
+
+    bool push(Job* job)
+    {
+        const i64 b = bottom.load(std::memory_order_relaxed);
+        const i64 t = top.load(std::memory_order_acquire);
+        if (b - t >= KAMSKI_JOB_DEQUE_SIZE)
+        {
+            return false;
+        }
+        slots[b & (KAMSKI_JOB_DEQUE_SIZE - 1)].store(job, std::memory_order_relaxed);
+        // Publishes the job to thieves, which load bottom with acquire
+        bottom.store(b + 1, std::memory_order_release);
+        return true;
+    }
+
+    Job* pop()
+    {
+        const i64 b = bottom.load(std::memory_order_relaxed) - 1;
+        bottom.store(b, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        i64 t = top.load(std::memory_order_relaxed);
+
+        Job* job = nullptr;
+        if (t <= b)
+        {
+            job = slots[b & (KAMSKI_JOB_DEQUE_SIZE - 1)].load(std::memory_order_relaxed);
+            if (t == b)
+            {
+                // Last job, race the thieves for it
+                if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+                {
+                    job = nullptr;
+                }
+                bottom.store(b + 1, std::memory_order_relaxed);
+            }
+        }
+        else
+        {
+            bottom.store(b + 1, std::memory_order_relaxed);
+        }
+        return job;
+    }
+
+    Job* steal()
+    {
+        i64 t = top.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        const i64 b = bottom.load(std::memory_order_acquire);
+        if (t >= b)
+        {
+            return nullptr;
+        }
+        Job* job = slots[t & (KAMSKI_JOB_DEQUE_SIZE - 1)].load(std::memory_order_relaxed);
+        if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+        {
+            return nullptr;
+        }
+        return job;
+    }
+
+    bool isEmpty()
+    {
+        return top.load(std::memory_order_acquire) >= bottom.load(std::memory_order_acquire);
+    }
+};
+
+struct JobThreadState
+{
+    JobDeque deque;
+    Job pool[KAMSKI_JOB_POOL_SIZE];
+    u32 poolIndex;
+    u64 randomState;
+
+    JobFiber baseFiber;
+    JobFiber* currentFiber;
+    // Left for the fiber switched to, it can only be done once the old stack is no longer in use
+    JobFiber* releaseFiber;
+    JobCounter* unlockCounter;
+};
+
+struct JobSystemInternal
+{
+    // Index 0 belongs to the thread that called initJobSystem, the workers follow
+    JobThreadState threads[KAMSKI_MAX_THREAD_COUNT];
+    std::thread workers[KAMSKI_MAX_THREAD_COUNT];
+    u32 workerCount;
+    void (*threadInit)(u32 threadIndex);
+
+    std::atomic<bool> quit;
+    std::atomic<u32> sleeperCount;
+    // Idle workers sleep here, submitJob posts a wakeup when it sees one
+    std::mutex sleepMutex;
+    std::condition_variable sleepCondition;
+    u32 wakeupCount;
+
+    JobFiber fibers[KAMSKI_FIBER_COUNT];
+    // Guards the fiber lists, always taken after a counter lock and never the other way round
+    std::atomic<bool> fiberLock;
+    JobFiber* freeFibers;
+    JobFiberList readyFibers;
+    // Ready fibers that have to resume on one thread, such as a waiting base fiber
+    JobFiberList pinnedReadyFibers[KAMSKI_MAX_THREAD_COUNT];
+};
+
+JobSystemInternal jobSystemState;
+
+thread_local u32 jobThreadIndex = 0;
+
+// A fiber can resume on another thread, so code that may have switched reads the index through here
+// instead of keeping a thread local address the compiler computed before the switch
+static KAMSKI_NOINLINE u32 getJobThreadIndex()
+{
+    return jobThreadIndex;
+}
+
+// Spins before an idle worker goes to sleep
+static constexpr u32 JOB_IDLE_SPIN_COUNT = 64;
+
+static void wakeWorker()
+{
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (jobSystemState.sleeperCount.load(std::memory_order_relaxed) == 0)
+    {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(jobSystemState.sleepMutex);
+        jobSystemState.wakeupCount++;
+    }
+    jobSystemState.sleepCondition.notify_one();
+}
+
+static Job* allocJob(JobFunc func, void* data, JobCounter* counter)
+{
+    assert(getJobThreadIndex() <= jobSystemState.workerCount);
+    JobThreadState& thread = jobSystemState.threads[getJobThreadIndex()];
+    Job* job = &thread.pool[thread.poolIndex++ & (KAMSKI_JOB_POOL_SIZE - 1)];
+    // Wrapped onto a job that has not run yet, raise KAMSKI_JOB_POOL_SIZE
+    assert(!job->inFlight.load(std::memory_order_acquire));
+    job->func = func;
+    job->data = data;
+    job->counter = counter;
+    job->next = nullptr;
+    job->inFlight.store(true, std::memory_order_relaxed);
+    return job;
+}
+
+static void lockFlag(std::atomic<bool>& flag)
+{
+    while (flag.exchange(true, std::memory_order_acquire))
+    {
+        std::this_thread::yield();
+    }
+}
+
+static void unlockFlag(std::atomic<bool>& flag)
+{
+    flag.store(false, std::memory_order_release);
+}
+
+static JobFiber* acquireFreeFiber()
+{
+    lockFlag(jobSystemState.fiberLock);
+    JobFiber* fiber = jobSystemState.freeFibers;
+    if (fiber)
+    {
+        jobSystemState.freeFibers = fiber->next;
+    }
+    unlockFlag(jobSystemState.fiberLock);
+
+    // Every fiber is waiting on a counter, raise KAMSKI_FIBER_COUNT
+    assert(fiber);
+    fiber->next = nullptr;
+    fiber->homeThread = JOB_ANY_THREAD;
+    return fiber;
+}
+
+static void releaseFiber(JobFiber* fiber)
+{
+    lockFlag(jobSystemState.fiberLock);
+    fiber->next = jobSystemState.freeFibers;
+    jobSystemState.freeFibers = fiber;
+    unlockFlag(jobSystemState.fiberLock);
+}
+
+static void makeFiberReady(JobFiber* fiber)
+{
+    JobFiberList& list = fiber->homeThread == JOB_ANY_THREAD ? jobSystemState.readyFibers : jobSystemState.pinnedReadyFibers[fiber->homeThread];
+    lockFlag(jobSystemState.fiberLock);
+    fiber->next = list.head;
+    list.head = fiber;
+    list.count.fetch_add(1, std::memory_order_release);
+    unlockFlag(jobSystemState.fiberLock);
+    wakeWorker();
+}
+
+static JobFiber* popReadyFiber(u32 threadIndex)
+{
+    JobFiberList* list = &jobSystemState.pinnedReadyFibers[threadIndex];
+    if (!list->count.load(std::memory_order_acquire))
+    {
+        list = &jobSystemState.readyFibers;
+        if (!list->count.load(std::memory_order_acquire))
+        {
+            return nullptr;
+        }
+    }
+
+    lockFlag(jobSystemState.fiberLock);
+    JobFiber* fiber = list->head;
+    if (fiber)
+    {
+        list->head = fiber->next;
+        list->count.fetch_sub(1, std::memory_order_relaxed);
+    }
+    unlockFlag(jobSystemState.fiberLock);
+    return fiber;
+}
+
+// Runs on the fiber that was switched to, which is not always on the thread it was suspended on
+static void finishFiberSwitch()
+{
+    JobThreadState& thread = jobSystemState.threads[getJobThreadIndex()];
+    if (thread.releaseFiber)
+    {
+        releaseFiber(thread.releaseFiber);
+        thread.releaseFiber = nullptr;
+    }
+    if (thread.unlockCounter)
+    {
+        unlockFlag(thread.unlockCounter->locked);
+        thread.unlockCounter = nullptr;
+    }
+}
+
+static void switchToFiber(JobFiber* fiber)
+{
+    JobThreadState& thread = jobSystemState.threads[getJobThreadIndex()];
+    JobFiber* current = thread.currentFiber;
+    thread.currentFiber = fiber;
+    platformSwitchFiber(current, fiber);
+    finishFiberSwitch();
+}
+
+// Parks the current fiber on [counter] and switches to [next], or to whatever fiber is ready when it is null
+static void parkOnCounter(JobCounter* counter, JobFiber* next)
+{
+    const u32 threadIndex = getJobThreadIndex();
+    JobThreadState& thread = jobSystemState.threads[threadIndex];
+    JobFiber* current = thread.currentFiber;
+    // Jobs run while this fiber is parked allocate from the same frame arena, see TempMemoryScope
+    assert(getTemporaryArena()->openScopes == 0);
+
+    lockFlag(counter->locked);
+    if (counter->value.load(std::memory_order_acquire) == 0)
+    {
+        unlockFlag(counter->locked);
+        if (next)
+        {
+            releaseFiber(next);
+        }
+        return;
+    }
+    current->next = counter->waitingFibers;
+    counter->waitingFibers = current;
+    // Unlocked by the next fiber, a finishing job could otherwise resume this one before its stack is saved
+    thread.unlockCounter = counter;
+
+    if (!next)
+    {
+        next = popReadyFiber(threadIndex);
+    }
+    if (!next)
+    {
+        next = acquireFreeFiber();
+    }
+    switchToFiber(next);
+}
+
+static void runJob(Job* job);
+
+static void pushJob(Job* job)
+{
+    if (jobSystemState.workerCount == 0 || !jobSystemState.threads[getJobThreadIndex()].deque.push(job))
+    {
+        // No workers or the deque is full, running it here keeps the submitter from outpacing them
+        runJob(job);
+        return;
+    }
+    wakeWorker();
+}
+
+// Counts a finished job off [counter], the last one releases the continuations and the fibers waiting on it
+static void finishCounter(JobCounter* counter)
+{
+    i32 value = counter->value.load(std::memory_order_relaxed);
+    while (value > 1)
+    {
+        if (counter->value.compare_exchange_weak(value, value - 1, std::memory_order_acq_rel, std::memory_order_relaxed))
+        {
+            return;
+        }
+    }
+
+    // The last job reaches zero under the lock, so a waiter that saw zero and the lock free may drop the counter
+    lockFlag(counter->locked);
+    Job* continuation = nullptr;
+    JobFiber* waitingFiber = nullptr;
+    if (counter->value.fetch_sub(1, std::memory_order_acq_rel) == 1)
+    {
+        continuation = counter->continuations;
+        counter->continuations = nullptr;
+        waitingFiber = counter->waitingFibers;
+        counter->waitingFibers = nullptr;
+    }
+    unlockFlag(counter->locked);
+
+    while (waitingFiber)
+    {
+        JobFiber* next = waitingFiber->next;
+        makeFiberReady(waitingFiber);
+        waitingFiber = next;
+    }
+    while (continuation)
+    {
+        Job* next = continuation->next;
+        pushJob(continuation);
+        continuation = next;
+    }
+}
+
+static void runJob(Job* job)
+{
+    JobCounter* counter = job->counter;
+    job->func(job->data);
+
+    job->inFlight.store(false, std::memory_order_release);
+    if (counter)
+    {
+        finishCounter(counter);
+    }
+}
+
+static bool isCounterDone(JobCounter* counter)
+{
+    return counter->value.load(std::memory_order_acquire) == 0 && !counter->locked.load(std::memory_order_acquire);
+}
+
+// Pops from the own deque first, then steals from the others starting at a random one
+static Job* findJob()
+{
+    const u32 threadIndex = getJobThreadIndex();
+    JobThreadState& thread = jobSystemState.threads[threadIndex];
+    Job* job = thread.deque.pop();
+    if (job)
+    {
+        return job;
+    }
+
+    const u32 threadCount = jobSystemState.workerCount + 1;
+    thread.randomState ^= thread.randomState << 13;
+    thread.randomState ^= thread.randomState >> 7;
+    thread.randomState ^= thread.randomState << 17;
+    const u32 start = (u32)(thread.randomState % threadCount);
+    for (u32 i = 0; i != threadCount; i++)
+    {
+        const u32 victim = (start + i) % threadCount;
+        if (victim != threadIndex)
+        {
+            job = jobSystemState.threads[victim].deque.steal();
+            if (job)
+            {
+                return job;
+            }
+        }
+    }
+    return nullptr;
+}
+
+static bool anyJobQueued()
+{
+    if (jobSystemState.readyFibers.count.load(std::memory_order_acquire))
+    {
+        return true;
+    }
+    for (u32 i = 0; i <= jobSystemState.workerCount; i++)
+    {
+        if (!jobSystemState.threads[i].deque.isEmpty())
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Body of every pool fiber: resumes ready fibers first, then runs jobs. On the main thread it only runs
+// while the base fiber waits, which it gets back to once that is ready again
+static void schedulerLoop()
+{
+    u32 idleCount = 0;
+    for (;;)
+    {
+        // Both can change on every pass, a job or a switch may have moved this fiber to another thread
+        const u32 threadIndex = getJobThreadIndex();
+        JobThreadState& thread = jobSystemState.threads[threadIndex];
+        JobFiber* current = thread.currentFiber;
+
+        if (current->entryFunc)
+        {
+            const JobFunc func = current->entryFunc;
+            current->entryFunc = nullptr;
+            func(current->entryData);
+            current->homeThread = JOB_ANY_THREAD;
+            finishCounter(current->entryCounter);
+            continue;
+        }
+
+        if (threadIndex != 0 && jobSystemState.quit.load(std::memory_order_acquire))
+        {
+            thread.releaseFiber = current;
+            switchToFiber(&thread.baseFiber);
+            continue;
+        }
+
+        JobFiber* ready = popReadyFiber(threadIndex);
+        if (ready)
+        {
+            thread.releaseFiber = current;
+            switchToFiber(ready);
+            idleCount = 0;
+            continue;
+        }
+
+        Job* job = findJob();
+        if (job)
+        {
+            runJob(job);
+            idleCount = 0;
+            continue;
+        }
+
+        // The main thread never sleeps, its base fiber has to be picked up as soon as it is ready
+        if (threadIndex == 0 || ++idleCount < JOB_IDLE_SPIN_COUNT)
+        {
+            std::this_thread::yield();
+            continue;
+        }
+
+        // Announce the sleep before the last look, so a submitter either sees the sleeper or the worker sees the job
+        jobSystemState.sleeperCount.fetch_add(1, std::memory_order_seq_cst);
+        if (!anyJobQueued())
+        {
+            std::unique_lock<std::mutex> lock(jobSystemState.sleepMutex);
+            jobSystemState.sleepCondition.wait_for(lock, std::chrono::milliseconds(10), []()
+            {
+                return jobSystemState.wakeupCount || jobSystemState.quit.load(std::memory_order_relaxed);
+            });
+            if (jobSystemState.wakeupCount)
+            {
+                jobSystemState.wakeupCount--;
+            }
+        }
+        jobSystemState.sleeperCount.fetch_sub(1, std::memory_order_relaxed);
+        idleCount = 0;
+    }
+}
+
+static void fiberEntry()
+{
+    finishFiberSwitch();
+    schedulerLoop();
+}
+
+static void convertToBaseFiber(u32 threadIndex)
+{
+    JobThreadState& thread = jobSystemState.threads[threadIndex];
+    platformConvertThreadToFiber(&thread.baseFiber);
+    thread.baseFiber.homeThread = threadIndex;
+    thread.currentFiber = &thread.baseFiber;
+}
+
+static void workerMain(u32 threadIndex)
+{
+    jobThreadIndex = threadIndex;
+    if (jobSystemState.threadInit)
+    {
+        jobSystemState.threadInit(threadIndex);
+    }
+
+    convertToBaseFiber(threadIndex);
+    switchToFiber(acquireFreeFiber());
+    // Back on the base fiber once the job system quits
+    platformConvertFiberToThread();
+}
+
+void initJobSystem(u32 workerCount, void (*threadInit)(u32 threadIndex))
+{
+    if (workerCount == 0)
+    {
+        const u32 coreCount = std::thread::hardware_concurrency();
+        workerCount = coreCount > 1 ? coreCount - 1 : 0;
+    }
+    if (workerCount > KAMSKI_MAX_THREAD_COUNT - 1)
+    {
+        workerCount = KAMSKI_MAX_THREAD_COUNT - 1;
+    }
+
+    jobThreadIndex = 0;
+    jobSystemState.workerCount = workerCount;
+    jobSystemState.threadInit = threadInit;
+    jobSystemState.quit.store(false, std::memory_order_relaxed);
+    jobSystemState.wakeupCount = 0;
+    for (u32 i = 0; i <= workerCount; i++)
+    {
+        jobSystemState.threads[i].randomState = 0x9E3779B97F4A7C15ull * (i + 1);
+    }
+
+    jobSystemState.freeFibers = nullptr;
+    for (JobFiber& fiber : jobSystemState.fibers)
+    {
+        platformCreateFiber(&fiber, fiberEntry);
+        fiber.next = jobSystemState.freeFibers;
+        jobSystemState.freeFibers = &fiber;
+    }
+    convertToBaseFiber(0);
+
+    for (u32 i = 1; i <= workerCount; i++)
+    {
+        jobSystemState.workers[i] = std::thread(workerMain, i);
+    }
+    logInfo("Job system started %u workers with %u fibers", workerCount, KAMSKI_FIBER_COUNT);
+}
+
+// Drains what is left and joins the workers, nothing may submit jobs anymore
+void shutdownJobSystem()
+{
+    Job* job;
+    while ((job = findJob()))
+    {
+        runJob(job);
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(jobSystemState.sleepMutex);
+        jobSystemState.quit.store(true, std::memory_order_release);
+    }
+    jobSystemState.sleepCondition.notify_all();
+    for (u32 i = 1; i <= jobSystemState.workerCount; i++)
+    {
+        jobSystemState.workers[i].join();
+    }
+    jobSystemState.workerCount = 0;
+
+    platformConvertFiberToThread();
+    u32 freeCount = 0;
+    for (JobFiber* fiber = jobSystemState.freeFibers; fiber; fiber = fiber->next)
+    {
+        freeCount++;
+    }
+    // A fiber is still parked on a counter that never reached zero
+    assert(freeCount == KAMSKI_FIBER_COUNT);
+    for (JobFiber& fiber : jobSystemState.fibers)
+    {
+        platformDestroyFiber(&fiber);
+    }
+}
+
+u32 getWorkerCount()
+{
+    return jobSystemState.workerCount;
+}
+
+void submitJob(JobFunc func, void* data, JobCounter* counter)
+{
+    if (counter)
+    {
+        counter->value.fetch_add(1, std::memory_order_relaxed);
+    }
+    pushJob(allocJob(func, data, counter));
+}
+
+void submitJobAfter(JobCounter* dependency, JobFunc func, void* data, JobCounter* counter)
+{
+    if (counter)
+    {
+        counter->value.fetch_add(1, std::memory_order_relaxed);
+    }
+    Job* job = allocJob(func, data, counter);
+
+    lockFlag(dependency->locked);
+    if (dependency->value.load(std::memory_order_acquire) == 0)
+    {
+        unlockFlag(dependency->locked);
+        pushJob(job);
+        return;
+    }
+    job->next = dependency->continuations;
+    dependency->continuations = job;
+    unlockFlag(dependency->locked);
+}
+
+void waitCounter(JobCounter* counter)
+{
+    if (isCounterDone(counter))
+    {
+        return;
+    }
+    parkOnCounter(counter, nullptr);
+    // Resumed after the last job released the counter, a late submitJobAfter may still hold the lock
+    while (!isCounterDone(counter))
+    {
+        std::this_thread::yield();
+    }
+}
+
+void runOnFiber(JobFunc func, void* data)
+{
+    JobCounter counter = {};
+    counter.value.store(1, std::memory_order_relaxed);
+
+    JobFiber* fiber = acquireFreeFiber();
+    fiber->entryFunc = func;
+    fiber->entryData = data;
+    fiber->entryCounter = &counter;
+    fiber->homeThread = getJobThreadIndex();
+    parkOnCounter(&counter, fiber);
+    while (!isCounterDone(&counter))
+    {
+        std::this_thread::yield();
+    }
+}
+
+struct ParallelForState
+{
+    ParallelForFunc func;
+    void* data;
+    u32 count;
+    u32 batchSize;
+    // First item no thread has claimed yet
+    std::atomic<u32> next;
+};
+
+// Every helper claims batches until none are left, so a slow or late thread never holds up the rest
+static void parallelForBatches(void* data)
+{
+    ParallelForState* state = (ParallelForState*)data;
+    for (;;)
+    {
+        const u32 begin = state->next.fetch_add(state->batchSize, std::memory_order_relaxed);
+        if (begin >= state->count)
+        {
+            return;
+        }
+        const u32 end = std::min(begin + state->batchSize, state->count);
+        state->func(state->data, begin, end);
+    }
+}
+
+void parallelFor(u32 count, u32 batchSize, ParallelForFunc func, void* data)
+{
+    if (count == 0)
+    {
+        return;
+    }
+    if (batchSize == 0)
+    {
+        batchSize = 1;
+    }
+
+    const u32 batchCount = (count - 1) / batchSize + 1;
+    const u32 helperCount = std::min(batchCount - 1, jobSystemState.workerCount);
+    if (helperCount == 0)
+    {
+        func(data, 0, count);
+        return;
+    }
+
+    ParallelForState state = {func, data, count, batchSize, {0}};
+    JobCounter counter = {};
+    for (u32 i = 0; i != helperCount; i++)
+    {
+        submitJob(parallelForBatches, &state, &counter);
+    }
+    parallelForBatches(&state);
+    waitCounter(&counter);
+}
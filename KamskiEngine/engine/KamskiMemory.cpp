@@ -0,0 +1,562 @@
+#include "../KamskiEngine.h"
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+// ######## GeneralAllocator ########
+
+using TlsfBlock = GeneralAllocator::BlockHeader;
+
+static constexpr u64 TLSF_BLOCK_FREE = 1;
+static constexpr u64 TLSF_PREV_BLOCK_FREE = 2;
+static constexpr u64 TLSF_FLAGS = TLSF_BLOCK_FREE | TLSF_PREV_BLOCK_FREE;
+// Block sizes stay below 2^FIRST_LEVEL_MAX, so the top byte of sizeAndFlags holds the tag of a used block
+static constexpr u32 TLSF_TAG_SHIFT = 56;
+static constexpr u64 TLSF_TAG_MASK = 0xffull << TLSF_TAG_SHIFT;
+static_assert(GeneralAllocator::FIRST_LEVEL_MAX < TLSF_TAG_SHIFT);
+
+static_assert(sizeof(TlsfBlock) == 4 * sizeof(u64), "TlsfBlock layout is assumed by the overhead constants");
+
+static inline u32 lowestSetBit(u64 bits)
+{
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward64(&index, bits);
+    return (u32)index;
+#else
+    return (u32)__builtin_ctzll(bits);
+#endif
+}
+
+static inline u32 highestSetBit(u64 bits)
+{
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanReverse64(&index, bits);
+    return (u32)index;
+#else
+    return 63 - (u32)__builtin_clzll(bits);
+#endif
+}
+
+static inline u64 alignUp(u64 value, u64 alignment)
+{
+    return (value + alignment - 1) & ~(alignment - 1);
+}
+
+static inline u64 tlsfBlockSize(const TlsfBlock* block)
+{
+    return block->sizeAndFlags & ~(TLSF_FLAGS | TLSF_TAG_MASK);
+}
+
+static inline void tlsfSetBlockSize(TlsfBlock* block, u64 size)
+{
+    block->sizeAndFlags = size | (block->sizeAndFlags & (TLSF_FLAGS | TLSF_TAG_MASK));
+}
+
+static inline bool tlsfIsFree(const TlsfBlock* block)
+{
+    return block->sizeAndFlags & TLSF_BLOCK_FREE;
+}
+
+static inline bool tlsfIsPrevFree(const TlsfBlock* block)
+{
+    return block->sizeAndFlags & TLSF_PREV_BLOCK_FREE;
+}
+
+static inline bool tlsfIsLast(const TlsfBlock* block)
+{
+    return tlsfBlockSize(block) == 0;
+}
+
+static inline void* tlsfBlockToPtr(TlsfBlock* block)
+{
+    return (u8*)block + GeneralAllocator::BLOCK_START_OFFSET;
+}
+
+static inline TlsfBlock* tlsfPtrToBlock(void* ptr)
+{
+    return (TlsfBlock*)((u8*)ptr - GeneralAllocator::BLOCK_START_OFFSET);
+}
+
+// The next block header starts in the last 8 bytes of this block (its prevPhysical field)
+static inline TlsfBlock* tlsfNextBlock(TlsfBlock* block)
+{
+    return (TlsfBlock*)((u8*)tlsfBlockToPtr(block) + tlsfBlockSize(block) - GeneralAllocator::BLOCK_OVERHEAD);
+}
+
+static inline TlsfBlock* tlsfLinkNext(TlsfBlock* block)
+{
+    TlsfBlock* next = tlsfNextBlock(block);
+    next->prevPhysical = block;
+    return next;
+}
+
+static inline void tlsfMarkFree(TlsfBlock* block)
+{
+    TlsfBlock* next = tlsfLinkNext(block);
+    next->sizeAndFlags |= TLSF_PREV_BLOCK_FREE;
+    block->sizeAndFlags |= TLSF_BLOCK_FREE;
+}
+
+static inline void tlsfMarkUsed(TlsfBlock* block)
+{
+    TlsfBlock* next = tlsfNextBlock(block);
+    next->sizeAndFlags &= ~TLSF_PREV_BLOCK_FREE;
+    block->sizeAndFlags &= ~TLSF_BLOCK_FREE;
+}
+
+// Appends [next]'s header and bytes to [block]
+static inline void tlsfAbsorb(TlsfBlock* block, TlsfBlock* next)
+{
+    tlsfSetBlockSize(block, tlsfBlockSize(block) + tlsfBlockSize(next) + GeneralAllocator::BLOCK_OVERHEAD);
+    tlsfLinkNext(block);
+}
+
+// Size class of a block of [size] bytes
+static inline void tlsfMapping(u64 size, u32& firstLevel, u32& secondLevel)
+{
+    if (size < GeneralAllocator::SMALL_BLOCK_SIZE)
+    {
+        firstLevel = 0;
+        secondLevel = (u32)(size / (GeneralAllocator::SMALL_BLOCK_SIZE / GeneralAllocator::SECOND_LEVEL_COUNT));
+    }
+    else
+    {
+        const u32 highBit = highestSetBit(size);
+        secondLevel = (u32)(size >> (highBit - GeneralAllocator::SECOND_LEVEL_LOG2)) ^ GeneralAllocator::SECOND_LEVEL_COUNT;
+        firstLevel = highBit - (GeneralAllocator::FIRST_LEVEL_SHIFT - 1);
+    }
+}
+
+// Size class whose every block is at least [size] bytes, so the first block found always fits
+static inline void tlsfMappingSearch(u64 size, u32& firstLevel, u32& secondLevel)
+{
+    if (size >= GeneralAllocator::SMALL_BLOCK_SIZE)
+    {
+        size += (1ull << (highestSetBit(size) - GeneralAllocator::SECOND_LEVEL_LOG2)) - 1;
+    }
+    tlsfMapping(size, firstLevel, secondLevel);
+}
+
+// Rounds a request up to the block granularity, 0 when it can not be served
+static inline u64 tlsfAdjustSize(u64 size)
+{
+    if (size == 0 || size >= GeneralAllocator::BLOCK_SIZE_MAX)
+    {
+        return 0;
+    }
+    const u64 aligned = alignUp(size, GeneralAllocator::ALIGNMENT);
+    return aligned < GeneralAllocator::BLOCK_SIZE_MIN ? GeneralAllocator::BLOCK_SIZE_MIN : aligned;
+}
+
+static inline bool tlsfCanSplit(const TlsfBlock* block, u64 size)
+{
+    return tlsfBlockSize(block) >= sizeof(TlsfBlock) + size;
+}
+
+GeneralAllocator::GeneralAllocator(u64 capacity, CommitFunc commit):
+capacity(capacity),
+commit(commit),
+freeBytes(0),
+firstLevelBitmap(0)
+{
+    for (u32 i = 0; i < FIRST_LEVEL_COUNT; i++)
+    {
+        secondLevelBitmaps[i] = 0;
+        for (u32 j = 0; j < SECOND_LEVEL_COUNT; j++)
+        {
+            freeLists[i][j] = nullptr;
+        }
+    }
+
+    // One free block spanning the pool followed by a zero sized used sentinel that stops coalescing
+    const u64 poolSize = (capacity - BLOCK_START_OFFSET - BLOCK_OVERHEAD) & ~(ALIGNMENT - 1);
+    assert(capacity > BLOCK_START_OFFSET + BLOCK_OVERHEAD + BLOCK_SIZE_MIN);
+    assert(poolSize < BLOCK_SIZE_MAX);
+
+    TlsfBlock* block = (TlsfBlock*)bytes;
+    if (commit)
+    {
+        commit(block, sizeof(TlsfBlock));
+        commit((u8*)tlsfBlockToPtr(block) + poolSize - BLOCK_OVERHEAD, BLOCK_START_OFFSET);
+    }
+    block->sizeAndFlags = poolSize;
+    tlsfMarkFree(block);
+    insertFreeBlock(block);
+
+    TlsfBlock* sentinel = tlsfLinkNext(block);
+    sentinel->sizeAndFlags = TLSF_PREV_BLOCK_FREE;
+}
+
+void GeneralAllocator::insertFreeBlock(BlockHeader* block)
+{
+    u32 firstLevel, secondLevel;
+    tlsfMapping(tlsfBlockSize(block), firstLevel, secondLevel);
+
+    BlockHeader* head = freeLists[firstLevel][secondLevel];
+    block->nextFree = head;
+    block->prevFree = nullptr;
+    if (head)
+    {
+        head->prevFree = block;
+    }
+    freeLists[firstLevel][secondLevel] = block;
+    firstLevelBitmap |= 1ull << firstLevel;
+    secondLevelBitmaps[firstLevel] |= 1u << secondLevel;
+    freeBytes += tlsfBlockSize(block);
+}
+
+void GeneralAllocator::removeFreeBlock(BlockHeader* block)
+{
+    u32 firstLevel, secondLevel;
+    tlsfMapping(tlsfBlockSize(block), firstLevel, secondLevel);
+
+    if (block->prevFree)
+    {
+        block->prevFree->nextFree = block->nextFree;
+    }
+    else
+    {
+        assert(freeLists[firstLevel][secondLevel] == block);
+        freeLists[firstLevel][secondLevel] = block->nextFree;
+        if (!block->nextFree)
+        {
+            secondLevelBitmaps[firstLevel] &= ~(1u << secondLevel);
+            if (!secondLevelBitmaps[firstLevel])
+            {
+                firstLevelBitmap &= ~(1ull << firstLevel);
+            }
+        }
+    }
+    if (block->nextFree)
+    {
+        block->nextFree->prevFree = block->prevFree;
+    }
+    freeBytes -= tlsfBlockSize(block);
+}
+
+// Takes the head of the first non empty list that is guaranteed to fit [size], nullptr when out of memory
+GeneralAllocator::BlockHeader* GeneralAllocator::findFreeBlock(u64 size)
+{
+    u32 firstLevel, secondLevel;
+    tlsfMappingSearch(size, firstLevel, secondLevel);
+    if (firstLevel >= FIRST_LEVEL_COUNT)
+    {
+        return nullptr;
+    }
+
+    u32 secondLevelMap = secondLevelBitmaps[firstLevel] & (~0u << secondLevel);
+    if (!secondLevelMap)
+    {
+        const u64 firstLevelMap = firstLevel + 1 < 64 ? firstLevelBitmap & (~0ull << (firstLevel + 1)) : 0;
+        if (!firstLevelMap)
+        {
+            return nullptr;
+        }
+        firstLevel = lowestSetBit(firstLevelMap);
+        secondLevelMap = secondLevelBitmaps[firstLevel];
+    }
+    secondLevel = lowestSetBit(secondLevelMap);
+
+    BlockHeader* block = freeLists[firstLevel][secondLevel];
+    assert(block && tlsfBlockSize(block) >= size);
+    removeFreeBlock(block);
+    return block;
+}
+
+// Cuts [block] down to [size] bytes and returns the (free) remainder
+GeneralAllocator::BlockHeader* GeneralAllocator::splitBlock(BlockHeader* block, u64 size)
+{
+    BlockHeader* remaining = (BlockHeader*)((u8*)tlsfBlockToPtr(block) + size - BLOCK_OVERHEAD);
+    const u64 remainingSize = tlsfBlockSize(block) - (size + BLOCK_OVERHEAD);
+    assert(remainingSize >= BLOCK_SIZE_MIN);
+    if (commit)
+    {
+        commit(remaining, sizeof(BlockHeader));
+    }
+
+    remaining->sizeAndFlags = remainingSize;
+    tlsfSetBlockSize(block, size);
+    tlsfMarkFree(remaining);
+    return remaining;
+}
+
+// Returns the tail of a free block past [size] bytes to the free lists
+void GeneralAllocator::trimFree(BlockHeader* block, u64 size)
+{
+    if (tlsfCanSplit(block, size))
+    {
+        BlockHeader* remaining = splitBlock(block, size);
+        tlsfLinkNext(block);
+        remaining->sizeAndFlags |= TLSF_PREV_BLOCK_FREE;
+        insertFreeBlock(remaining);
+    }
+}
+
+// Returns the first [size] bytes of a free block to the free lists and hands back the rest
+GeneralAllocator::BlockHeader* GeneralAllocator::trimFreeLeading(BlockHeader* block, u64 size)
+{
+    BlockHeader* remaining = block;
+    if (tlsfCanSplit(block, size))
+    {
+        remaining = splitBlock(block, size - BLOCK_OVERHEAD);
+        remaining->sizeAndFlags |= TLSF_PREV_BLOCK_FREE;
+        tlsfLinkNext(block);
+        insertFreeBlock(block);
+    }
+    return remaining;
+}
+
+void* GeneralAllocator::prepareUsed(BlockHeader* block, u64 size, MemoryTag tag)
+{
+    trimFree(block, size);
+    tlsfMarkUsed(block);
+    block->sizeAndFlags = (block->sizeAndFlags & ~TLSF_TAG_MASK) | ((u64)tag << TLSF_TAG_SHIFT);
+    return tlsfBlockToPtr(block);
+}
+
+void* GeneralAllocator::alloc(u64 allocSize, u8 alignment, MemoryTag tag)
+{
+    if (allocSize == 0)
+    {
+        logDebug("0 byte allocation");
+        return nullptr;
+    }
+    assert(alignment && !(alignment & (alignment - 1)));
+
+    const u64 size = tlsfAdjustSize(allocSize);
+    if (!size)
+    {
+        return nullptr;
+    }
+
+    if (alignment <= ALIGNMENT)
+    {
+        BlockHeader* block = findFreeBlock(size);
+        return block ? prepareUsed(block, size, tag) : nullptr;
+    }
+
+    // Over-allocate so a free block of at least a header fits in front of the aligned address
+    const u64 gapMinimum = sizeof(BlockHeader);
+    const u64 sizeWithGap = tlsfAdjustSize(size + alignment + gapMinimum);
+    if (!sizeWithGap)
+    {
+        return nullptr;
+    }
+
+    BlockHeader* block = findFreeBlock(sizeWithGap);
+    if (!block)
+    {
+        return nullptr;
+    }
+
+    const u64 ptr = (u64)tlsfBlockToPtr(block);
+    u64 aligned = alignUp(ptr, alignment);
+    u64 gap = aligned - ptr;
+    if (gap && gap < gapMinimum)
+    {
+        const u64 gapRemaining = gapMinimum - gap;
+        const u64 offset = gapRemaining > alignment ? gapRemaining : alignment;
+        aligned = alignUp(aligned + offset, alignment);
+        gap = aligned - ptr;
+    }
+
+    if (gap)
+    {
+        block = trimFreeLeading(block, gap);
+    }
+    return prepareUsed(block, size, tag);
+}
+
+void GeneralAllocator::free(void* ptr)
+{
+    if (!ptr)
+        return;
+
+    BlockHeader* block = tlsfPtrToBlock(ptr);
+    assert(!tlsfIsFree(block));
+    tlsfMarkFree(block);
+
+    if (tlsfIsPrevFree(block))
+    {
+        BlockHeader* prev = block->prevPhysical;
+        assert(prev && tlsfIsFree(prev));
+        removeFreeBlock(prev);
+        tlsfAbsorb(prev, block);
+        block = prev;
+    }
+
+    BlockHeader* next = tlsfNextBlock(block);
+    if (tlsfIsFree(next))
+    {
+        removeFreeBlock(next);
+        tlsfAbsorb(block, next);
+    }
+
+    insertFreeBlock(block);
+}
+
+u64 GeneralAllocator::allocationSize(const void* ptr) const
+{
+    const TlsfBlock* block = tlsfPtrToBlock((void*)ptr);
+    assert(!tlsfIsFree(block));
+    return tlsfBlockSize(block);
+}
+
+MemoryTag GeneralAllocator::allocationTag(const void* ptr) const
+{
+    const TlsfBlock* block = tlsfPtrToBlock((void*)ptr);
+    assert(!tlsfIsFree(block));
+    return (MemoryTag)(block->sizeAndFlags >> TLSF_TAG_SHIFT);
+}
+
+// Only the highest non empty list can hold the biggest block, but its blocks are not sorted
+u64 GeneralAllocator::largestFreeBlock() const
+{
+    if (!firstLevelBitmap)
+    {
+        return 0;
+    }
+    const u32 firstLevel = highestSetBit(firstLevelBitmap);
+    const u32 secondLevel = highestSetBit(secondLevelBitmaps[firstLevel]);
+
+    u64 retval = 0;
+    for (const BlockHeader* block = freeLists[firstLevel][secondLevel]; block; block = block->nextFree)
+    {
+        const u64 size = tlsfBlockSize(block);
+        retval = size > retval ? size : retval;
+    }
+    return retval;
+}
+
+void GeneralAllocator::printAllocations(bool printFreeChunks) const
+{
+    // Only read by logInfo, which compiles out without KAMSKI_DEBUG
+    [[maybe_unused]] static constexpr const char* suffixes[] = {"B", "KB", "MB", "GB"};
+    for (TlsfBlock* block = (TlsfBlock*)bytes; !tlsfIsLast(block); block = tlsfNextBlock(block))
+    {
+        if (!printFreeChunks && tlsfIsFree(block))
+        {
+            continue;
+        }
+
+        u64 suffixIndex = 0;
+        f64 size = tlsfBlockSize(block);
+        while (size >= 1024.0f)
+        {
+            size /= 1024.0f;
+            suffixIndex ++;
+        }
+        if (tlsfIsFree(block))
+        {
+            logInfo("%f%s free at %p", size, suffixes[suffixIndex], tlsfBlockToPtr(block));
+        }
+        else
+        {
+            logInfo("%f%s allocated at %p", size, suffixes[suffixIndex], tlsfBlockToPtr(block));
+        }
+    }
+}
+
+// ######## SlabAllocator ########
+
+static inline u32 slabClassIndex(u64 size)
+{
+    return size <= (1ull << SlabAllocator::MIN_CLASS_LOG2) ? 0 : highestSetBit(size - 1) + 1 - SlabAllocator::MIN_CLASS_LOG2;
+}
+
+SlabAllocator::SlabAllocator(u64 capacity, CommitFunc commit):
+capacity(capacity),
+commit(commit),
+usedPageCount(0)
+{
+    for (u32 i = 0; i < TAG_COUNT; i++)
+    {
+        for (u32 j = 0; j < CLASS_COUNT; j++)
+        {
+            classes[i][j] = {};
+        }
+    }
+
+    // The page table sits in front of the pages, one page worth of slack covers aligning them
+    pageCount = capacity / (KAMSKI_SLAB_PAGE_SIZE + 1);
+    pageCount = pageCount ? pageCount - 1 : 0;
+    pages = (u8*)alignUp((u64)bytes + pageCount, KAMSKI_SLAB_PAGE_SIZE);
+    assert(pages + pageCount * KAMSKI_SLAB_PAGE_SIZE <= bytes + capacity);
+    if (commit)
+    {
+        commit(bytes, pageCount);
+    }
+}
+
+void* SlabAllocator::alloc(u64 allocSize, MemoryTag tag)
+{
+    if (allocSize == 0 || allocSize > MAX_SIZE)
+    {
+        return nullptr;
+    }
+
+    const u32 classIndex = slabClassIndex(allocSize);
+    SizeClass& sizeClass = classes[(u32)tag][classIndex];
+
+    if (sizeClass.freeList)
+    {
+        FreeSlot* slot = sizeClass.freeList;
+        sizeClass.freeList = slot->next;
+        return slot;
+    }
+
+    if (sizeClass.cursor == sizeClass.end)
+    {
+        if (usedPageCount == pageCount)
+        {
+            return nullptr;
+        }
+        bytes[usedPageCount] = (u8)(classIndex | ((u32)tag << PAGE_CLASS_BITS));
+        sizeClass.cursor = pages + usedPageCount * KAMSKI_SLAB_PAGE_SIZE;
+        if (commit)
+        {
+            commit(sizeClass.cursor, KAMSKI_SLAB_PAGE_SIZE);
+        }
+        sizeClass.end = sizeClass.cursor + KAMSKI_SLAB_PAGE_SIZE;
+        usedPageCount++;
+    }
+
+    void* retval = sizeClass.cursor;
+    sizeClass.cursor += 1ull << (MIN_CLASS_LOG2 + classIndex);
+    return retval;
+}
+
+void SlabAllocator::free(void* ptr)
+{
+    if (!ptr)
+        return;
+    assert(owns(ptr));
+
+    const u8 page = bytes[((u8*)ptr - pages) / KAMSKI_SLAB_PAGE_SIZE];
+    SizeClass& sizeClass = classes[page >> PAGE_CLASS_BITS][page & ((1u << PAGE_CLASS_BITS) - 1)];
+    FreeSlot* slot = (FreeSlot*)ptr;
+    slot->next = sizeClass.freeList;
+    sizeClass.freeList = slot;
+}
+
+bool SlabAllocator::owns(const void* ptr) const
+{
+    return (const u8*)ptr >= pages && (const u8*)ptr < pages + usedPageCount * KAMSKI_SLAB_PAGE_SIZE;
+}
+
+u64 SlabAllocator::allocationSize(const void* ptr) const
+{
+    assert(owns(ptr));
+    const u8 page = bytes[((const u8*)ptr - pages) / KAMSKI_SLAB_PAGE_SIZE];
+    return 1ull << (MIN_CLASS_LOG2 + (page & ((1u << PAGE_CLASS_BITS) - 1)));
+}
+
+MemoryTag SlabAllocator::allocationTag(const void* ptr) const
+{
+    assert(owns(ptr));
+    const u8 page = bytes[((const u8*)ptr - pages) / KAMSKI_SLAB_PAGE_SIZE];
+    return (MemoryTag)(page >> PAGE_CLASS_BITS);
+}
@@ -0,0 +1,109 @@
+#include "../KamskiEngine.h"
+#include <cmath>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define KAMSKI_SSE2 1
+#include <emmintrin.h>
+#else
+#define KAMSKI_SSE2 0
+#endif
+
+// ######## Quad vertices ########
+
+// 20 bytes, [color] is RGBA8 and [uv] 16 bit normalized
+struct Vertex
+{
+    glm::vec2 position;
+    u16 uv[2];
+    u32 color;
+    // Atlas layer, -1 for an untextured vertex
+    i16 texIndex;
+    u16 padding;
+};
+
+static_assert(sizeof(Vertex) == 20, "Vertex layout is mirrored by setVertexAttributes and writeQuadVertices");
+
+inline u32 packColor(const glm::vec4& color)
+{
+    const glm::vec4 bytes = glm::clamp(color, 0.0f, 1.0f) * 255.0f + 0.5f;
+    return (u32)bytes.r | (u32)bytes.g << 8 | (u32)bytes.b << 16 | (u32)bytes.a << 24;
+}
+
+inline u16 packUnorm16(f32 value)
+{
+    return (u16)(glm::clamp(value, 0.0f, 1.0f) * 65535.0f + 0.5f);
+}
+
+// The uvs of the 4 quad corners packed the way Vertex stores them, pack a rect once where it is created
+struct PackedUVRect
+{
+    u32 corners[4];
+};
+
+// Corners go bottom left, bottom right, top right, top left and get the uvs (x, y), (z, y), (z, w), (x, w) of [uvRect]
+inline PackedUVRect packUVRect(const glm::vec4& uvRect)
+{
+    const u32 u0 = packUnorm16(uvRect.x);
+    const u32 v0 = (u32)packUnorm16(uvRect.y) << 16;
+    const u32 u1 = packUnorm16(uvRect.z);
+    const u32 v1 = (u32)packUnorm16(uvRect.w) << 16;
+    return {{u0 | v0, u1 | v0, u1 | v1, u0 | v1}};
+}
+
+// packUVRect({0, 0, 1, 1}), for untextured quads
+inline constexpr PackedUVRect FULL_UV_RECT = {{0x00000000u, 0x0000ffffu, 0xffffffffu, 0xffff0000u}};
+
+// Writes the 4 vertices of a quad centered on [position], in clip space, corners in the order of [uvs].
+// [worldToClip] is the inverse of the screen size in world units, a zero [rotation] skips the sincos
+inline void writeQuadVertices(Vertex* out, glm::vec2 position, glm::vec2 size, f32 rotation, u32 color,
+                              const PackedUVRect& uvs, i16 texIndex, glm::vec2 worldToClip)
+{
+#if KAMSKI_SSE2
+    const __m128 halfX = _mm_set1_ps(size.x * 0.5f);
+    const __m128 halfY = _mm_set1_ps(size.y * 0.5f);
+    __m128 x = _mm_mul_ps(halfX, _mm_setr_ps(-1.0f, 1.0f, 1.0f, -1.0f));
+    __m128 y = _mm_mul_ps(halfY, _mm_setr_ps(-1.0f, -1.0f, 1.0f, 1.0f));
+    if (rotation != 0.0f)
+    {
+        const __m128 c = _mm_set1_ps(cosf(rotation));
+        const __m128 s = _mm_set1_ps(sinf(rotation));
+        const __m128 rotatedX = _mm_sub_ps(_mm_mul_ps(x, c), _mm_mul_ps(y, s));
+        y = _mm_add_ps(_mm_mul_ps(x, s), _mm_mul_ps(y, c));
+        x = rotatedX;
+    }
+    x = _mm_mul_ps(_mm_add_ps(x, _mm_set1_ps(position.x)), _mm_set1_ps(worldToClip.x));
+    y = _mm_mul_ps(_mm_add_ps(y, _mm_set1_ps(position.y)), _mm_set1_ps(worldToClip.y));
+
+    // (x, y, uv, color) of every corner is one store, the texture index goes right after it
+    const __m128 uvWords = _mm_castsi128_ps(_mm_loadu_si128((const __m128i*)uvs.corners));
+    const __m128 colors = _mm_castsi128_ps(_mm_set1_epi32((i32)color));
+    const __m128 xy01 = _mm_unpacklo_ps(x, y);
+    const __m128 xy23 = _mm_unpackhi_ps(x, y);
+    const __m128 uvColor01 = _mm_unpacklo_ps(uvWords, colors);
+    const __m128 uvColor23 = _mm_unpackhi_ps(uvWords, colors);
+    const __m128 corners[4] = {_mm_movelh_ps(xy01, uvColor01), _mm_movehl_ps(uvColor01, xy01),
+                               _mm_movelh_ps(xy23, uvColor23), _mm_movehl_ps(uvColor23, xy23)};
+
+    const u32 texIndexBits = (u16)texIndex;
+    for (u32 i = 0; i < 4; i++)
+    {
+        _mm_storeu_ps((f32*)&out[i], corners[i]);
+        memcpy(&out[i].texIndex, &texIndexBits, sizeof(texIndexBits));
+    }
+#else
+    const glm::vec2 corners[4] = {{-0.5f, -0.5f}, {0.5f, -0.5f}, {0.5f, 0.5f}, {-0.5f, 0.5f}};
+    const f32 c = rotation != 0.0f ? cosf(rotation) : 1.0f;
+    const f32 s = rotation != 0.0f ? sinf(rotation) : 0.0f;
+    for (u32 i = 0; i < 4; i++)
+    {
+        const glm::vec2 offset = corners[i] * size;
+        const glm::vec2 rotated = {offset.x * c - offset.y * s, offset.x * s + offset.y * c};
+        out[i].position = (position + rotated) * worldToClip;
+        memcpy(out[i].uv, &uvs.corners[i], sizeof(uvs.corners[i]));
+        out[i].color = color;
+        out[i].texIndex = texIndex;
+        out[i].padding = 0;
+    }
+#endif
+}
@@ -1,21 +1,26 @@
 #version 450
 
-layout (location=0) in float outIndex;
+layout (location=0) flat in int outIndex;
 layout (location=1) in vec2 outUv;
 layout (location=2) in vec4 outColor;
 
 out vec4 fragColor;
-uniform sampler2D textures[32];
+uniform sampler2DArray atlas;
+// Alpha tested draws discard below it, 0 keeps every fragment
+uniform float alphaCutoff;
 
 void main() 
 {
-	int index = int(outIndex);
-	if(outIndex != -1.0f)
+	if(outIndex != -1)
 	{
-    	fragColor = texture(textures[index], outUv) * outColor;
+    	fragColor = texture(atlas, vec3(outUv, outIndex)) * outColor;
 	}
 	else
 	{
 		fragColor = outColor;
 	}
+	if(fragColor.a < alphaCutoff)
+	{
+		discard;
+	}
 }
\ No newline at end of file
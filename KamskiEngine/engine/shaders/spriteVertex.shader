@@ -0,0 +1,33 @@
+#version 450
+layout (location=0) in vec2 position;
+layout (location=1) in vec2 size;
+layout (location=2) in float rotation;
+layout (location=3) in vec4 color;
+layout (location=4) in vec4 uvRect;
+layout (location=5) in int texIndex;
+layout (location=6) in float depth;
+
+layout (location=0) flat out int outIndex;
+layout (location=1) out vec2 outUv;
+layout (location=2) out vec4 outColor;
+
+uniform vec3 camera;
+uniform vec2 worldToClip;
+
+// One instance per sprite, drawn as a 4 vertex triangle strip
+void main() 
+{
+    vec2 corner = vec2(gl_VertexID & 1, gl_VertexID >> 1);
+    vec2 offset = (corner - 0.5) * size;
+    float c = cos(rotation);
+    float s = sin(rotation);
+    vec2 pos = position + vec2(offset.x * c - offset.y * s, offset.x * s + offset.y * c);
+
+    outUv = mix(uvRect.xy, uvRect.zw, corner);
+    outIndex = texIndex;
+    outColor = color;
+    pos = pos * worldToClip - camera.xy;
+    // Depth goes through the same transform as y, halved so depths up to a screen past the edges stay apart
+    float z = clamp((depth * worldToClip.y - camera.y) * camera.z * 0.5, -1.0, 1.0);
+    gl_Position = vec4(pos * camera.z, z, 1.0);
+}
@@ -0,0 +1,277 @@
+// Turns the KAMSKI_COMPONENTS list of a game header into a flat component registry.
+//
+// Build once:
+//     cl /O2 /std:c++17 KamskiRegistryGenerator.cpp          (or)   g++ -O2 -std=c++17 KamskiRegistryGenerator.cpp -o KamskiRegistryGenerator
+// Run as a pre-build step of the game DLL:
+//     KamskiRegistryGenerator KamskiGame/headers/Defines.h KamskiGame/headers/ComponentRegistry.h
+//
+// The output defines `ComponentRegistry`, a drop-in replacement for ComponentList<KAMSKI_COMPONENTS>:
+// one named ComponentStorage per component, constexpr ids in list order and non-recursive accessors.
+// The file is only rewritten when its contents change so it does not trigger needless rebuilds.
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cctype>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+using u32 = uint32_t;
+using u64 = uint64_t;
+
+static const char* componentsDefine = "KAMSKI_COMPONENTS";
+
+static bool readFile(const char* path, std::string& out)
+{
+    FILE* file = fopen(path, "rb");
+    if (!file)
+    {
+        return false;
+    }
+
+    char buffer[4096];
+    size_t read;
+    while ((read = fread(buffer, 1, sizeof(buffer), file)) != 0)
+    {
+        out.append(buffer, read);
+    }
+    fclose(file);
+    return true;
+}
+
+static bool isIdentifierChar(char c)
+{
+    return isalnum((unsigned char)c) || c == '_';
+}
+
+// Finds "#define KAMSKI_COMPONENTS" and returns its body with line continuations joined
+static bool extractDefine(const std::string& source, std::string& body)
+{
+    size_t lineStart = 0;
+    while (lineStart < source.size())
+    {
+        size_t cursor = lineStart;
+        while (cursor < source.size() && (source[cursor] == ' ' || source[cursor] == '\t'))
+        {
+            cursor++;
+        }
+
+        if (source.compare(cursor, 7, "#define") == 0)
+        {
+            cursor += 7;
+            while (cursor < source.size() && (source[cursor] == ' ' || source[cursor] == '\t'))
+            {
+                cursor++;
+            }
+
+            const size_t nameLength = strlen(componentsDefine);
+            if (source.compare(cursor, nameLength, componentsDefine) == 0 &&
+                !isIdentifierChar(source[cursor + nameLength]))
+            {
+                cursor += nameLength;
+                while (cursor < source.size())
+                {
+                    const char c = source[cursor];
+                    if (c == '\\' && cursor + 1 < source.size() && (source[cursor + 1] == '\n' || source[cursor + 1] == '\r'))
+                    {
+                        cursor++;
+                        if (source[cursor] == '\r' && cursor + 1 < source.size() && source[cursor + 1] == '\n')
+                        {
+                            cursor++;
+                        }
+                        cursor++;
+                        body += ' ';
+                        continue;
+                    }
+                    if (c == '\n' || c == '\r')
+                    {
+                        break;
+                    }
+                    if (c == '/' && cursor + 1 < source.size() && source[cursor + 1] == '/')
+                    {
+                        break;
+                    }
+                    body += c;
+                    cursor++;
+                }
+                return true;
+            }
+        }
+
+        const size_t nextLine = source.find('\n', lineStart);
+        if (nextLine == std::string::npos)
+        {
+            break;
+        }
+        lineStart = nextLine + 1;
+    }
+    return false;
+}
+
+static bool splitComponents(const std::string& body, std::vector<std::string>& components)
+{
+    size_t cursor = 0;
+    while (cursor <= body.size())
+    {
+        size_t comma = body.find(',', cursor);
+        if (comma == std::string::npos)
+        {
+            comma = body.size();
+        }
+
+        size_t begin = cursor;
+        size_t end = comma;
+        while (begin < end && isspace((unsigned char)body[begin]))
+        {
+            begin++;
+        }
+        while (end > begin && isspace((unsigned char)body[end - 1]))
+        {
+            end--;
+        }
+
+        std::string name = body.substr(begin, end - begin);
+        if (name.empty())
+        {
+            fprintf(stderr, "error: empty entry in %s\n", componentsDefine);
+            return false;
+        }
+        for (char c : name)
+        {
+            if (!isIdentifierChar(c) && c != ':')
+            {
+                fprintf(stderr, "error: '%s' is not a plain type name\n", name.c_str());
+                return false;
+            }
+        }
+        for (const std::string& other : components)
+        {
+            if (other == name)
+            {
+                fprintf(stderr, "error: '%s' is listed twice\n", name.c_str());
+                return false;
+            }
+        }
+        components.push_back(name);
+        cursor = comma + 1;
+    }
+    return !components.empty();
+}
+
+// TransformComponent -> transformComponent, ns::Foo -> foo
+static std::string memberName(const std::string& typeName)
+{
+    const size_t scope = typeName.rfind(':');
+    std::string name = scope == std::string::npos ? typeName : typeName.substr(scope + 1);
+    name[0] = (char)tolower((unsigned char)name[0]);
+    return name;
+}
+
+static std::string generate(const std::vector<std::string>& components)
+{
+    std::string out;
+    char line[1024];
+
+    out += "// Generated by KamskiEngine/tools/KamskiRegistryGenerator.cpp from KAMSKI_COMPONENTS, do not edit.\n";
+    out += "#pragma once\n";
+    out += "#include \"Components.h\"\n\n";
+
+    out += "// Fails when KAMSKI_COMPONENTS changed without regenerating this file\n";
+    out += "static_assert(std::is_same_v<ComponentTypeList<KAMSKI_COMPONENTS>, ComponentTypeList<";
+    for (size_t i = 0; i < components.size(); i++)
+    {
+        out += i ? ", " : "";
+        out += components[i];
+    }
+    out += ">>, \"ComponentRegistry.h is stale, rerun KamskiRegistryGenerator\");\n\n";
+
+    out += "struct ComponentRegistry\n{\n";
+    snprintf(line, sizeof(line), "    static constexpr u64 size = %llu;\n\n", (unsigned long long)components.size());
+    out += line;
+    out += "    template<typename Component>\n";
+    out += "    static constexpr u64 componentId();\n\n";
+    out += "    template<typename Component>\n";
+    out += "    ComponentStorage<Component>& getComponentVector();\n\n";
+    out += "    template<typename Component>\n";
+    out += "    const ComponentStorage<Component>& getComponentVector() const;\n\n";
+    out += "    void removeEntity(Entity eId)\n    {\n";
+    for (const std::string& component : components)
+    {
+        out += "        " + memberName(component) + ".removeComponent(eId);\n";
+    }
+    out += "    }\n\n";
+    out += "    void swapBuffers()\n    {\n";
+    for (const std::string& component : components)
+    {
+        out += "        swapComponentBuffers(" + memberName(component) + ");\n";
+    }
+    out += "    }\n\n";
+    for (const std::string& component : components)
+    {
+        out += "    ComponentStorage<" + component + "> " + memberName(component) + ";\n";
+    }
+    out += "};\n";
+
+    for (size_t i = 0; i < components.size(); i++)
+    {
+        const std::string& component = components[i];
+        const std::string member = memberName(component);
+        out += "\n";
+        snprintf(line, sizeof(line), "template<> constexpr u64 ComponentRegistry::componentId<%s>() { return %llu; }\n",
+                 component.c_str(), (unsigned long long)i);
+        out += line;
+        out += "template<> inline ComponentStorage<" + component + ">& ComponentRegistry::getComponentVector<" + component + ">() { return " + member + "; }\n";
+        out += "template<> inline const ComponentStorage<" + component + ">& ComponentRegistry::getComponentVector<" + component + ">() const { return " + member + "; }\n";
+    }
+
+    return out;
+}
+
+int main(int argc, char** argv)
+{
+    if (argc != 3)
+    {
+        fprintf(stderr, "usage: %s <header with %s> <output header>\n", argv[0], componentsDefine);
+        return EXIT_FAILURE;
+    }
+
+    std::string source;
+    if (!readFile(argv[1], source))
+    {
+        fprintf(stderr, "error: could not read %s\n", argv[1]);
+        return EXIT_FAILURE;
+    }
+
+    std::string body;
+    if (!extractDefine(source, body))
+    {
+        fprintf(stderr, "error: %s has no #define %s\n", argv[1], componentsDefine);
+        return EXIT_FAILURE;
+    }
+
+    std::vector<std::string> components;
+    if (!splitComponents(body, components))
+    {
+        return EXIT_FAILURE;
+    }
+    const std::string generated = generate(components);
+
+    std::string previous;
+    if (readFile(argv[2], previous) && previous == generated)
+    {
+        return 0;
+    }
+
+    FILE* file = fopen(argv[2], "wb");
+    if (!file)
+    {
+        fprintf(stderr, "error: could not write %s\n", argv[2]);
+        return EXIT_FAILURE;
+    }
+    fwrite(generated.data(), 1, generated.size(), file);
+    fclose(file);
+
+    printf("%s: %llu components\n", argv[2], (unsigned long long)components.size());
+    return 0;
+}
@@ -1,5 +1,6 @@
 #include "headers/Defines.h"
 #include "headers/Components.h"
+#include "headers/ComponentRegistry.h"
 #include <random>
 
 class Game {
@@ -60,13 +61,16 @@ class Game {
     
     // MEMORY THAT SHOULDN'T BE CHANGED
     TextureId textureIdsByTag[(u32)TextureTag::COUNT];
+    // Engine side copy of the map tiles, drawn in cached chunks. Kept out of the disposable memory so a restart
+    // can destroy the previous one, 0 when there is none
+    TileMapId mapTileMap;
     
     // MEMORY THAT YOU CAN RESET
     union {
         struct {
             f64 deltaTime;
             Entity playerEId;
-            EntityRegistry<ComponentList<KAMSKI_COMPONENTS>> entityRegistry;
+            EntityRegistry<ComponentRegistry> entityRegistry;
             glm::vec3 camera;
             bool isVroomOn;
             glm::vec2 startPosition;
@@ -121,13 +125,13 @@ class Game {
         for(u32 i = 0; i < map.roomCount; i++)
         {
             glm::vec2 entrance = map.rooms[i].entranceLeftTop;
-            ENGINE.drawColoredQuad(entrance, map.quadSize, glm::vec4(1.0f,1.0f,1.0f,1.0f), 0);
+            ENGINE.drawColoredQuad(entrance, map.quadSize, glm::vec4(1.0f,1.0f,1.0f,1.0f), 0, 0.0f);
             entrance = map.rooms[i].entranceLeftBottom;
-            ENGINE.drawColoredQuad(entrance, map.quadSize, glm::vec4(1.0f,1.0f,1.0f,1.0f), 0);
+            ENGINE.drawColoredQuad(entrance, map.quadSize, glm::vec4(1.0f,1.0f,1.0f,1.0f), 0, 0.0f);
             entrance = map.rooms[i].entranceRightTop;
-            ENGINE.drawColoredQuad(entrance, map.quadSize, glm::vec4(1.0f,1.0f,1.0f,1.0f), 0);
+            ENGINE.drawColoredQuad(entrance, map.quadSize, glm::vec4(1.0f,1.0f,1.0f,1.0f), 0, 0.0f);
             entrance = map.rooms[i].entranceRightBottom;
-            ENGINE.drawColoredQuad(entrance, map.quadSize, glm::vec4(1.0f,1.0f,1.0f,1.0f), 0);
+            ENGINE.drawColoredQuad(entrance, map.quadSize, glm::vec4(1.0f,1.0f,1.0f,1.0f), 0, 0.0f);
         }
     }
     
@@ -290,7 +294,8 @@ class Game {
                 ENGINE.drawTexturedQuad({}, 
                                         ENGINE.getScreenSize() * zoom, 
                                         getTextureIdByTag(tags[menuTagIndex]), 
-                                        0);
+                                        0,
+                                        0.0f);
                 if(menuTime >= 4.0f)
                 {
                     menuTime = 0.0f;
@@ -307,13 +312,15 @@ class Game {
                                 ENGINE.getScreenSize() * zoom, 
                                 getTextureIdByTag(tags[menuTagIndex]), 
                                 glm::vec4(transition), 
-                                0);
+                                0,
+                                0.0f);
                 
                 ENGINE.drawQuad({},
                                 ENGINE.getScreenSize() * zoom2, 
                                 getTextureIdByTag(tags[(menuTagIndex + 1) % ARRAY_COUNT(tags)]), 
                                 glm::vec4(1.0f - transition), 
-                                0);
+                                0,
+                                0.0f);
                 
                 if(menuTime >= 4.0f)
                 {
@@ -355,8 +362,8 @@ class Game {
     
     void updateFollowers()
     {
-        ComponentVector<FollowComponent>& followers = entityRegistry.getComponentVector<FollowComponent>();
-        ComponentVector<TransformComponent>& transforms = entityRegistry.getComponentVector<TransformComponent>();
+        auto& followers = entityRegistry.getComponentVector<FollowComponent>();
+        auto& transforms = entityRegistry.getComponentVector<TransformComponent>();
         
         for (Entity followerId: followers.iterateEntities())
         {
@@ -904,35 +911,29 @@ class Game {
         }
     }
     
-    void renderSprites()
+    struct SpriteBatchContext
     {
-        u32 cnt = 0;
-        ComponentVector<SpriteComponent>& sprites = entityRegistry.getComponentVector<SpriteComponent>();
-        Entity* entityIds = (Entity*)(ENGINE.temporaryAlloc(sprites.size() * sizeof(Entity)));
-        
-        for (Entity entityId: sprites.iterateEntities())
-        {
-            entityIds[cnt++] = entityId;
-        }
-        
-        std::sort(entityIds, entityIds + cnt, [this](const Entity A, const Entity B)
-                  {
-                      const f32 aY = entityRegistry.getComponent<TransformComponent>(A).position.y;
-                      const f32 bY = entityRegistry.getComponent<TransformComponent>(B).position.y;
-                      return aY > bY;
-                  });
-        
-        const SpriteComponent& playerSprite = entityRegistry.getComponent<SpriteComponent>(playerEId);
-        TextureId playerTextureId = ENGINE.getAnimationFrame(playerSprite.animation, playerSprite.startTime);
-        const TransformComponent& playerTransform = entityRegistry.getComponent<TransformComponent>(playerEId);
-        for (u32 i = 0; i < cnt; ++i)
+        Game* game;
+        const ComponentVector<SpriteComponent>* sprites;
+        const ComponentVector<TransformComponent>* transforms;
+        const Entity* entities;
+        TextureId playerTextureId;
+        TransformComponent playerTransform;
+    };
+
+    // Runs on the engine workers, only reads the game state and draws world sprites
+    static void renderSpriteBatch(void* data, u32 begin, u32 end)
+    {
+        const SpriteBatchContext& context = *(SpriteBatchContext*)data;
+        for (u32 i = begin; i != end; i++)
         {
-            const SpriteComponent& entitySprite = entityRegistry.getComponent<SpriteComponent>(entityIds[i]);
+            const Entity entityId = context.entities[i];
+            const SpriteComponent& entitySprite = context.sprites->getComponent(entityId);
             TextureId textureId = ENGINE.getAnimationFrame(entitySprite.animation, entitySprite.startTime);
-            TransformComponent entityTransform = entityRegistry.getComponent<TransformComponent>(entityIds[i]);
-            if (playerTextureId == textureId)
+            TransformComponent entityTransform = context.transforms->getComponent(entityId);
+            if (context.playerTextureId == textureId)
             {
-                if (cursorPosition.x < 0)
+                if (context.game->cursorPosition.x < 0)
                 {
                     entityTransform.size.x = -abs(entityTransform.size.x);
                 }
@@ -942,9 +943,9 @@ class Game {
                 }
             }
             // it's not item and it's not the player
-            else if (entityRegistry.hasComponent<TypeComponent>(entityIds[i]) && entityIds[i] != playerEId)
+            else if (context.game->entityRegistry.hasComponent<TypeComponent>(entityId) && entityId != context.game->playerEId)
             {
-                if (playerTransform.position.x < entityTransform.position.x)
+                if (context.playerTransform.position.x < entityTransform.position.x)
                 {
                     entityTransform.size.x = -abs(entityTransform.size.x);
                 }
@@ -958,17 +959,32 @@ class Game {
                                     entityTransform.position,
                                     ENTITIES_SIZE_MULTIPLIER * entityTransform.size,
                                     textureId,
-                                    entityTransform.rotation
+                                    entityTransform.rotation,
+                                    entityTransform.position.y
                                     );
         }
+    }
+    
+    void renderSprites()
+    {
+        // Transforms and sprites come from the copy published by the last swapBuffers
+        const ComponentVector<SpriteComponent>& sprites = entityRegistry.getRenderComponentVector<SpriteComponent>();
+        const ComponentVector<TransformComponent>& transforms = entityRegistry.getRenderComponentVector<TransformComponent>();
+        
+        const SpriteComponent& playerSprite = sprites.getComponent(playerEId);
+        TextureId playerTextureId = ENGINE.getAnimationFrame(playerSprite.animation, playerSprite.startTime);
+        const TransformComponent& playerTransform = transforms.getComponent(playerEId);
+        // The renderer sorts by depth, entities further up the screen are drawn behind
+        SpriteBatchContext context = {this, &sprites, &transforms, sprites.iterateEntities().begin(), playerTextureId, playerTransform};
+        ENGINE.recordSpritesParallel((u32)sprites.size(), 256, renderSpriteBatch, &context);
         // draw light
         ENGINE.addLight(playerTransform.position, 100.0f, {1.0f, 1.0f, 1.0f, 1.0f});
         
         for (Entity colorId: entityRegistry.iterateEntities<SolidColorComponent, TransformComponent>())
         {
-            TransformComponent& colorTransform = entityRegistry.getComponent<TransformComponent>(colorId);
+            const TransformComponent& colorTransform = transforms.getComponent(colorId);
             glm::vec4 color = entityRegistry.getComponent<SolidColorComponent>(colorId).color;
-            ENGINE.drawColoredQuad(colorTransform.position, colorTransform.size, color, colorTransform.rotation);
+            ENGINE.drawColoredQuad(colorTransform.position, colorTransform.size, color, colorTransform.rotation, colorTransform.position.y);
         }
         
         const EntityComponent& playerEntity = entityRegistry.getComponent<EntityComponent>(playerEId);
@@ -999,6 +1015,19 @@ class Game {
         ENGINE.drawUITex(quickItemsSlotPos[2], glm::vec2{120,120}, ID(MANA_POTION));
     }
     
+    // Keeps transforms in Z-order of position and the components read alongside them in the same order,
+    // a bounded amount per frame, so joined loops and neighbour queries walk memory forwards
+    void sortComponentsSystem()
+    {
+        entityRegistry.sortComponents<TransformComponent>([](const TransformComponent& transform, Entity)
+                                                          {
+                                                              return mortonKey(transform.position, COMPONENT_SORT_CELL_SIZE);
+                                                          }, COMPONENT_SORT_BUDGET);
+        entityRegistry.sortComponentsLike<SpriteComponent, TransformComponent>(COMPONENT_SORT_BUDGET);
+        entityRegistry.sortComponentsLike<ColliderComponent, TransformComponent>(COMPONENT_SORT_BUDGET);
+        entityRegistry.sortComponentsLike<EntityComponent, TransformComponent>(COMPONENT_SORT_BUDGET);
+    }
+    
     void velocitySystem()
     {
         for (Entity vEid: entityRegistry.iterateEntities<VelocityComponent>())
@@ -1280,7 +1309,7 @@ class Game {
     
     void fill()
     {
-        bool* mat = (bool*)ENGINE.globalAlloc(sizeof(bool) * map.size.x * map.size.y);
+        bool* mat = (bool*)ENGINE.globalAlloc(sizeof(bool) * map.size.x * map.size.y, MemoryTag::Map);
         memset(mat, false, sizeof(bool) * map.size.x * map.size.y);
         for (i32 i = 0; i < map.size.y; ++i)
         {
@@ -1309,8 +1338,8 @@ class Game {
     {
         map.size.x = sizeX;
         map.size.y = sizeY;
-        map.tiles = (TextureTag*)ENGINE.globalAlloc(sizeof(TextureTag) * sizeY * sizeX);
-        map.walls = (Map::Wall*)ENGINE.globalAlloc(sizeof(Map::Wall) * MAX_WALLS);
+        map.tiles = (TextureTag*)ENGINE.globalAlloc(sizeof(TextureTag) * sizeY * sizeX, MemoryTag::Map);
+        map.walls = (Map::Wall*)ENGINE.globalAlloc(sizeof(Map::Wall) * MAX_WALLS, MemoryTag::Map);
         map.numberOfWalls = 0;
         for (u32 i = 0; i < sizeY * sizeX; ++i)
         {
@@ -1335,6 +1364,26 @@ class Game {
             logInfo("(%u,%u)", tile.x, tile.y);
         }
         triangulatePolygon(vertexArr, vertexArrSize);
+        initMapTileMap();
+    }
+    
+    void initMapTileMap()
+    {
+        if (mapTileMap)
+        {
+            ENGINE.destroyTileMap(mapTileMap);
+        }
+        mapTileMap = ENGINE.createTileMap(map.size, map.quadSize, {0.0f, 0.0f});
+        if (!mapTileMap)
+        {
+            logError("Could not create the map tile map, the floor will not be drawn");
+            return;
+        }
+        for (u32 i = 0; i < map.tilesArrSize; ++i)
+        {
+            glm::uvec2 tile = map.tilesArr[i];
+            ENGINE.setTile(mapTileMap, tile, getTextureIdByTag(map.tiles[tile.y * map.size.x + tile.x]));
+        }
     }
     
     f32 sign(glm::vec2 p1, glm::vec2 p2, glm::vec2 p3)
@@ -1407,8 +1456,10 @@ class Game {
     
     void triangulatePolygon(glm::vec2* points, u32 pointCount)
     {
+        // The list nodes and the triangle scratch buffer are dead once the triangles are copied out
+        TempMemoryScope scratch(ENGINE.getTemporaryArena());
         u32 trianglesCount = 0;
-        Polygon* triangles = (Polygon*)ENGINE.temporaryAlloc(10000 * sizeof(Polygon));
+        Polygon* triangles = (Polygon*)ENGINE.temporaryAlloc(10000 * sizeof(Polygon), MemoryTag::Navmesh);
         
         struct Node
         {
@@ -1426,13 +1477,13 @@ class Game {
             {
                 if(!head)
                 {
-                    head = (Node*)ENGINE.temporaryAlloc(sizeof(Node));
+                    head = (Node*)ENGINE.temporaryAlloc(sizeof(Node), MemoryTag::Navmesh);
                     head->vertex = vertex;
                     head->prev = head;
                     head->next = head;
                 } else
                 {
-                    Node* temp = (Node*)ENGINE.temporaryAlloc(sizeof(Node));
+                    Node* temp = (Node*)ENGINE.temporaryAlloc(sizeof(Node), MemoryTag::Navmesh);
                     
                     temp->vertex = vertex;
                     temp->prev = head->prev;
@@ -1495,7 +1546,7 @@ class Game {
                 
                 if(!shouldBreak)
                 {
-                    glm::vec2* triangle = (glm::vec2*)ENGINE.globalAlloc(sizeof(glm::vec2) * 3);
+                    glm::vec2* triangle = (glm::vec2*)ENGINE.slabAlloc(sizeof(glm::vec2) * 3, MemoryTag::Navmesh);
                     
                     triangle[0] = ptr->prev->vertex;
                     triangle[1] = ptr->vertex;
@@ -1511,7 +1562,7 @@ class Game {
             }
         }
         
-        map.navMesh.polygons = (Polygon*)ENGINE.globalAlloc(trianglesCount * sizeof(Polygon));
+        map.navMesh.polygons = (Polygon*)ENGINE.globalAlloc(trianglesCount * sizeof(Polygon), MemoryTag::Navmesh);
         map.navMesh.polygonCount = trianglesCount;
         memcpy(map.navMesh.polygons, triangles, trianglesCount * sizeof(Polygon));
         
@@ -1549,14 +1600,9 @@ class Game {
     
     void renderMap() const
     {
-        u32 idk = map.tilesArrSize;
-        for (u32 i = 0; i < map.tilesArrSize; ++i)
+        if (mapTileMap)
         {
-            glm::uvec2* t = &map.tilesArr[i];
-            glm::uvec2 tile = map.tilesArr[i];
-            glm::vec2 position = getCenterPositionByTile(tile);
-            u32 tileIndex = tile.y * map.size.x + tile.x;
-            ENGINE.drawTexturedQuad(position, map.quadSize, getTextureIdByTag(map.tiles[tileIndex]), 0);
+            ENGINE.drawTileMap(mapTileMap);
         }
         for (u32 i = 0; i < map.numberOfWalls; ++i)
         {
@@ -1777,7 +1823,7 @@ class Game {
                     ++map.tilesArrSize;
             }
         }
-        map.tilesArr = (glm::uvec2*)ENGINE.globalAlloc(map.tilesArrSize * sizeof(glm::uvec2));
+        map.tilesArr = (glm::uvec2*)ENGINE.globalAlloc(map.tilesArrSize * sizeof(glm::uvec2), MemoryTag::Map);
         glm::uvec2* debug = map.tilesArr;
         u32 cnt = 0;
         for (u32 i = 0; i < map.size.y; ++i)
@@ -1794,7 +1840,7 @@ class Game {
     {
         map.size = {200,100};
         u32 bufferSize = (map.size.x + 2) * map.size.y + 5;
-        char* buffer = (char*)ENGINE.temporaryAlloc(bufferSize);
+        char* buffer = (char*)ENGINE.temporaryAlloc(bufferSize, MemoryTag::Map);
         memset(buffer, 0, bufferSize);
         ENGINE.readWholeFile(buffer, bufferSize, path);
         
@@ -1969,7 +2015,7 @@ class Game {
         }
         LOOP_END:
         vertexArrSize = 0;
-        vertexArr = (glm::vec2*)ENGINE.temporaryAlloc(10000 * sizeof(glm::vec2));
+        vertexArr = (glm::vec2*)ENGINE.temporaryAlloc(10000 * sizeof(glm::vec2), MemoryTag::Navmesh);
         {
             glm::uvec2 pos = startPos;
             vertexArr[vertexArrSize++] = getCenterPositionByTile(pos);
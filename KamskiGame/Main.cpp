@@ -126,7 +126,7 @@ void Game::gameUpdate()
             
             TransformComponent& tr = entityRegistry.getComponent<TransformComponent>(playerEId);
             glm::uvec2 tileCheck = getTileByPosition(tr.position);
-            logError("PlayerPos: %u %u", tileCheck.x, tileCheck.y);
+            logDebugEvery(1.0, "PlayerPos: %u %u", tileCheck.x, tileCheck.y);
             
             EntityComponent& ent = entityRegistry.getComponent<EntityComponent>(playerEId);
             if(actionState.hp == KeyState::PRESS)
@@ -143,6 +143,7 @@ void Game::gameUpdate()
             updateHealthBars();
             moveProjectiles();
             updatePlayer();
+            sortComponentsSystem();
             break;
         }
         [[unlikely]]
@@ -163,6 +164,8 @@ void Game::gameUpdate()
         break;
     }
 
+    // Publish this frame's transforms and sprites to the render path
+    entityRegistry.swapBuffers();
 }
 
 void Game::gameRender()
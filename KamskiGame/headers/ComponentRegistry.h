@@ -0,0 +1,113 @@
+// Generated by KamskiEngine/tools/KamskiRegistryGenerator.cpp from KAMSKI_COMPONENTS, do not edit.
+#pragma once
+#include "Components.h"
+
+// Fails when KAMSKI_COMPONENTS changed without regenerating this file
+static_assert(std::is_same_v<ComponentTypeList<KAMSKI_COMPONENTS>, ComponentTypeList<TransformComponent, TypeComponent, ColliderComponent, SpriteComponent, SolidColorComponent, FollowComponent, EntityComponent, ProjectileComponent, HealthBarComponent, ItemComponent, VelocityComponent, EnemyComponent>>, "ComponentRegistry.h is stale, rerun KamskiRegistryGenerator");
+
+struct ComponentRegistry
+{
+    static constexpr u64 size = 12;
+
+    template<typename Component>
+    static constexpr u64 componentId();
+
+    template<typename Component>
+    ComponentStorage<Component>& getComponentVector();
+
+    template<typename Component>
+    const ComponentStorage<Component>& getComponentVector() const;
+
+    void removeEntity(Entity eId)
+    {
+        transformComponent.removeComponent(eId);
+        typeComponent.removeComponent(eId);
+        colliderComponent.removeComponent(eId);
+        spriteComponent.removeComponent(eId);
+        solidColorComponent.removeComponent(eId);
+        followComponent.removeComponent(eId);
+        entityComponent.removeComponent(eId);
+        projectileComponent.removeComponent(eId);
+        healthBarComponent.removeComponent(eId);
+        itemComponent.removeComponent(eId);
+        velocityComponent.removeComponent(eId);
+        enemyComponent.removeComponent(eId);
+    }
+
+    void swapBuffers()
+    {
+        swapComponentBuffers(transformComponent);
+        swapComponentBuffers(typeComponent);
+        swapComponentBuffers(colliderComponent);
+        swapComponentBuffers(spriteComponent);
+        swapComponentBuffers(solidColorComponent);
+        swapComponentBuffers(followComponent);
+        swapComponentBuffers(entityComponent);
+        swapComponentBuffers(projectileComponent);
+        swapComponentBuffers(healthBarComponent);
+        swapComponentBuffers(itemComponent);
+        swapComponentBuffers(velocityComponent);
+        swapComponentBuffers(enemyComponent);
+    }
+
+    ComponentStorage<TransformComponent> transformComponent;
+    ComponentStorage<TypeComponent> typeComponent;
+    ComponentStorage<ColliderComponent> colliderComponent;
+    ComponentStorage<SpriteComponent> spriteComponent;
+    ComponentStorage<SolidColorComponent> solidColorComponent;
+    ComponentStorage<FollowComponent> followComponent;
+    ComponentStorage<EntityComponent> entityComponent;
+    ComponentStorage<ProjectileComponent> projectileComponent;
+    ComponentStorage<HealthBarComponent> healthBarComponent;
+    ComponentStorage<ItemComponent> itemComponent;
+    ComponentStorage<VelocityComponent> velocityComponent;
+    ComponentStorage<EnemyComponent> enemyComponent;
+};
+
+template<> constexpr u64 ComponentRegistry::componentId<TransformComponent>() { return 0; }
+template<> inline ComponentStorage<TransformComponent>& ComponentRegistry::getComponentVector<TransformComponent>() { return transformComponent; }
+template<> inline const ComponentStorage<TransformComponent>& ComponentRegistry::getComponentVector<TransformComponent>() const { return transformComponent; }
+
+template<> constexpr u64 ComponentRegistry::componentId<TypeComponent>() { return 1; }
+template<> inline ComponentStorage<TypeComponent>& ComponentRegistry::getComponentVector<TypeComponent>() { return typeComponent; }
+template<> inline const ComponentStorage<TypeComponent>& ComponentRegistry::getComponentVector<TypeComponent>() const { return typeComponent; }
+
+template<> constexpr u64 ComponentRegistry::componentId<ColliderComponent>() { return 2; }
+template<> inline ComponentStorage<ColliderComponent>& ComponentRegistry::getComponentVector<ColliderComponent>() { return colliderComponent; }
+template<> inline const ComponentStorage<ColliderComponent>& ComponentRegistry::getComponentVector<ColliderComponent>() const { return colliderComponent; }
+
+template<> constexpr u64 ComponentRegistry::componentId<SpriteComponent>() { return 3; }
+template<> inline ComponentStorage<SpriteComponent>& ComponentRegistry::getComponentVector<SpriteComponent>() { return spriteComponent; }
+template<> inline const ComponentStorage<SpriteComponent>& ComponentRegistry::getComponentVector<SpriteComponent>() const { return spriteComponent; }
+
+template<> constexpr u64 ComponentRegistry::componentId<SolidColorComponent>() { return 4; }
+template<> inline ComponentStorage<SolidColorComponent>& ComponentRegistry::getComponentVector<SolidColorComponent>() { return solidColorComponent; }
+template<> inline const ComponentStorage<SolidColorComponent>& ComponentRegistry::getComponentVector<SolidColorComponent>() const { return solidColorComponent; }
+
+template<> constexpr u64 ComponentRegistry::componentId<FollowComponent>() { return 5; }
+template<> inline ComponentStorage<FollowComponent>& ComponentRegistry::getComponentVector<FollowComponent>() { return followComponent; }
+template<> inline const ComponentStorage<FollowComponent>& ComponentRegistry::getComponentVector<FollowComponent>() const { return followComponent; }
+
+template<> constexpr u64 ComponentRegistry::componentId<EntityComponent>() { return 6; }
+template<> inline ComponentStorage<EntityComponent>& ComponentRegistry::getComponentVector<EntityComponent>() { return entityComponent; }
+template<> inline const ComponentStorage<EntityComponent>& ComponentRegistry::getComponentVector<EntityComponent>() const { return entityComponent; }
+
+template<> constexpr u64 ComponentRegistry::componentId<ProjectileComponent>() { return 7; }
+template<> inline ComponentStorage<ProjectileComponent>& ComponentRegistry::getComponentVector<ProjectileComponent>() { return projectileComponent; }
+template<> inline const ComponentStorage<ProjectileComponent>& ComponentRegistry::getComponentVector<ProjectileComponent>() const { return projectileComponent; }
+
+template<> constexpr u64 ComponentRegistry::componentId<HealthBarComponent>() { return 8; }
+template<> inline ComponentStorage<HealthBarComponent>& ComponentRegistry::getComponentVector<HealthBarComponent>() { return healthBarComponent; }
+template<> inline const ComponentStorage<HealthBarComponent>& ComponentRegistry::getComponentVector<HealthBarComponent>() const { return healthBarComponent; }
+
+template<> constexpr u64 ComponentRegistry::componentId<ItemComponent>() { return 9; }
+template<> inline ComponentStorage<ItemComponent>& ComponentRegistry::getComponentVector<ItemComponent>() { return itemComponent; }
+template<> inline const ComponentStorage<ItemComponent>& ComponentRegistry::getComponentVector<ItemComponent>() const { return itemComponent; }
+
+template<> constexpr u64 ComponentRegistry::componentId<VelocityComponent>() { return 10; }
+template<> inline ComponentStorage<VelocityComponent>& ComponentRegistry::getComponentVector<VelocityComponent>() { return velocityComponent; }
+template<> inline const ComponentStorage<VelocityComponent>& ComponentRegistry::getComponentVector<VelocityComponent>() const { return velocityComponent; }
+
+template<> constexpr u64 ComponentRegistry::componentId<EnemyComponent>() { return 11; }
+template<> inline ComponentStorage<EnemyComponent>& ComponentRegistry::getComponentVector<EnemyComponent>() { return enemyComponent; }
+template<> inline const ComponentStorage<EnemyComponent>& ComponentRegistry::getComponentVector<EnemyComponent>() const { return enemyComponent; }
@@ -28,6 +28,10 @@ struct SpriteComponent
     f64 endTime;
 };
 
+// Written by update, read by renderSprites through getRenderComponentVector
+KAMSKI_DOUBLE_BUFFERED(TransformComponent);
+KAMSKI_DOUBLE_BUFFERED(SpriteComponent);
+
 struct SolidColorComponent
 {
     glm::vec4 color;
@@ -31,6 +31,10 @@ inline constexpr f32 HEALTH_BAR_HEIGHT = 2.0f;
 inline constexpr f32 HEALTH_BAR_HEIGHT_OFFSET = 5.0f;
 inline constexpr f32 ANIMATIONS_MULTIPLIER = 1.0f;
 inline constexpr f32 ENTITIES_SIZE_MULTIPLIER = 1.0f;
+// work per component per frame when keeping them in spatial order: compares for sortComponents, lead entries
+// visited for sortComponentsLike
+inline constexpr u32 COMPONENT_SORT_BUDGET = 512;
+inline constexpr f32 COMPONENT_SORT_CELL_SIZE = 4.0f * QUAD_SIZE;
 //TODO: create a math library
 inline constexpr f32 PI = 3.14159265f;
 
@@ -387,6 +391,7 @@ enum States {
 
 // #define PROCEDURAL_MAP_GENERATION
 #define KASMKI_MAX_ENTITY_COUNT 20000
+// Rerun KamskiEngine/tools/KamskiRegistryGenerator after editing, it regenerates headers/ComponentRegistry.h
 #define KAMSKI_COMPONENTS TransformComponent, TypeComponent, ColliderComponent, SpriteComponent, SolidColorComponent, FollowComponent, EntityComponent, ProjectileComponent, HealthBarComponent, ItemComponent, VelocityComponent, EnemyComponent
 #define ID(TAG) getTextureIdByTag(TextureTag::TAG)
 #define TAG(TEXTURE) ((u32)TextureTag::TEXTURE)